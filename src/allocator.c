@@ -0,0 +1,421 @@
+#include "allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vk_enum_string_helper.h>
+
+static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static VkDeviceSize align_down(VkDeviceSize value, VkDeviceSize alignment) {
+    return value / alignment * alignment;
+}
+
+bool allocator_init(allocator *allocator, VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size) {
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->physical_device = physical_device;
+    allocator->device = device;
+    allocator->block_size = block_size ? block_size : DEFAULT_BLOCK_SIZE;
+
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->memory_properties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    allocator->non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+
+    return true;
+}
+
+void allocator_destroy(allocator *allocator) {
+    for(uint32_t i = 0; i < allocator->block_count; i++) {
+        memory_block *block = &allocator->blocks[i];
+        if(block->allocation_count > 0) {
+            fprintf(stderr, "Allocator: block %u destroyed with %u live allocations\n", i, block->allocation_count);
+        }
+
+        if(block->mapped) {
+            vkUnmapMemory(allocator->device, block->memory);
+        }
+
+        vkFreeMemory(allocator->device, block->memory, NULL);
+        free(block->free_ranges);
+    }
+
+    free(allocator->blocks);
+    memset(allocator, 0, sizeof(*allocator));
+}
+
+uint32_t allocator_find_memory_type(const allocator *allocator, uint32_t type_filter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    const VkPhysicalDeviceMemoryProperties *memory_properties = &allocator->memory_properties;
+
+    // Try to satisfy the preferred flags first, then fall back to any type with just the required flags.
+    const VkMemoryPropertyFlags candidates[] = { required | preferred, required };
+    for (uint32_t c = 0; c < 2; c++) {
+        for (uint32_t i = 0; i < memory_properties->memoryTypeCount; i++) {
+            if ((type_filter & (1 << i)) && (memory_properties->memoryTypes[i].propertyFlags & candidates[c]) == candidates[c]) {
+                return i;
+            }
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+static bool reserve_free_ranges(memory_block *block, uint32_t count) {
+    if(count > block->free_range_capacity) {
+        uint32_t capacity = block->free_range_capacity ? block->free_range_capacity * 2 : 16;
+        capacity = capacity < count ? count : capacity;
+        free_range *ranges = realloc(block->free_ranges, sizeof(free_range) * capacity);
+        if(!ranges) {
+            return false;
+        }
+
+        block->free_ranges = ranges;
+        block->free_range_capacity = capacity;
+    }
+
+    return true;
+}
+
+static bool push_free_range(memory_block *block, uint32_t index, VkDeviceSize offset, VkDeviceSize size) {
+    if(!reserve_free_ranges(block, block->free_range_count + 1)) {
+        return false;
+    }
+
+    memmove(&block->free_ranges[index + 1], &block->free_ranges[index], sizeof(free_range) * (block->free_range_count - index));
+    block->free_ranges[index] = (free_range){ offset, size };
+    block->free_range_count++;
+    return true;
+}
+
+static void remove_free_range(memory_block *block, uint32_t index) {
+    memmove(&block->free_ranges[index], &block->free_ranges[index + 1], sizeof(free_range) * (block->free_range_count - index - 1));
+    block->free_range_count--;
+}
+
+static bool create_block(allocator *allocator, uint32_t memory_type, VkDeviceSize size, resource_kind kind, allocation_strategy strategy, uint32_t *block_index) {
+    if(allocator->block_count == allocator->block_capacity) {
+        uint32_t capacity = allocator->block_capacity ? allocator->block_capacity * 2 : 8;
+        memory_block *blocks = realloc(allocator->blocks, sizeof(memory_block) * capacity);
+        if(!blocks) {
+            return false;
+        }
+
+        allocator->blocks = blocks;
+        allocator->block_capacity = capacity;
+    }
+
+    const VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type,
+    };
+
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(allocator->device, &alloc_info, NULL, &memory);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate %llu byte memory block: %s\n", (unsigned long long)size, string_VkResult(result));
+        return false;
+    }
+
+    memory_block block = {
+        .memory = memory,
+        .size = size,
+        .memory_type = memory_type,
+        .kind = kind,
+        .strategy = strategy,
+    };
+
+    // Host visible blocks stay mapped for their whole lifetime, mapping is not free and may only happen once per VkDeviceMemory.
+    if(allocator->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(allocator->device, memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+        if(result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to map memory block: %s\n", string_VkResult(result));
+            vkFreeMemory(allocator->device, memory, NULL);
+            return false;
+        }
+    }
+
+    if(strategy == ALLOCATION_STRATEGY_FREE_LIST && !push_free_range(&block, 0, 0, size)) {
+        if(block.mapped) {
+            vkUnmapMemory(allocator->device, memory);
+        }
+        vkFreeMemory(allocator->device, memory, NULL);
+        return false;
+    }
+
+    allocator->blocks[allocator->block_count] = block;
+    *block_index = allocator->block_count++;
+    allocator->stats.device_allocations++;
+    return true;
+}
+
+static bool block_allocate(memory_block *block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset) {
+    if(block->strategy == ALLOCATION_STRATEGY_LINEAR) {
+        VkDeviceSize aligned = align_up(block->linear_offset, alignment);
+        if(aligned + size > block->size) {
+            return false;
+        }
+
+        *offset = aligned;
+        block->linear_offset = aligned + size;
+        return true;
+    }
+
+    // First fit. The range is split into an alignment padding range, the allocation, and the remainder.
+    for(uint32_t i = 0; i < block->free_range_count; i++) {
+        free_range range = block->free_ranges[i];
+        VkDeviceSize aligned = align_up(range.offset, alignment);
+        if(aligned + size > range.offset + range.size) {
+            continue;
+        }
+
+        VkDeviceSize padding = aligned - range.offset;
+        VkDeviceSize remainder = range.offset + range.size - (aligned + size);
+
+        // The range is replaced by up to two, so make room first. Failing halfway would lose the range.
+        if(!reserve_free_ranges(block, block->free_range_count + 1)) {
+            return false;
+        }
+
+        remove_free_range(block, i);
+        if(remainder > 0) {
+            push_free_range(block, i, aligned + size, remainder);
+        }
+        if(padding > 0) {
+            push_free_range(block, i, range.offset, padding);
+        }
+
+        *offset = aligned;
+        return true;
+    }
+
+    return false;
+}
+
+static void block_free(memory_block *block, VkDeviceSize offset, VkDeviceSize size) {
+    uint32_t index = 0;
+    while(index < block->free_range_count && block->free_ranges[index].offset < offset) {
+        index++;
+    }
+
+    // Coalesce with the neighbouring ranges where they touch.
+    bool merge_prev = index > 0 && block->free_ranges[index - 1].offset + block->free_ranges[index - 1].size == offset;
+    bool merge_next = index < block->free_range_count && offset + size == block->free_ranges[index].offset;
+
+    if(merge_prev && merge_next) {
+        block->free_ranges[index - 1].size += size + block->free_ranges[index].size;
+        remove_free_range(block, index);
+    }
+    else if(merge_prev) {
+        block->free_ranges[index - 1].size += size;
+    }
+    else if(merge_next) {
+        block->free_ranges[index].offset = offset;
+        block->free_ranges[index].size += size;
+    }
+    else if(!push_free_range(block, index, offset, size)) {
+        // Leaking the range is the only option left, the block is still released on destroy.
+        fprintf(stderr, "Allocator: out of host memory, leaking %llu bytes\n", (unsigned long long)size);
+    }
+}
+
+bool allocator_allocate(allocator *allocator, const VkMemoryRequirements *requirements,
+    VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+    resource_kind kind, allocation_strategy strategy, allocation *out) {
+
+    uint32_t memory_type = allocator_find_memory_type(allocator, requirements->memoryTypeBits, required, preferred);
+    if(memory_type == UINT32_MAX) {
+        fprintf(stderr, "Failed to find suitable memory type\n");
+        return false;
+    }
+
+    uint32_t block_index = UINT32_MAX;
+    VkDeviceSize offset = 0;
+    for(uint32_t i = 0; i < allocator->block_count; i++) {
+        memory_block *block = &allocator->blocks[i];
+        if(block->memory_type != memory_type || block->kind != kind || block->strategy != strategy) {
+            continue;
+        }
+
+        if(block_allocate(block, requirements->size, requirements->alignment, &offset)) {
+            block_index = i;
+            break;
+        }
+    }
+
+    if(block_index == UINT32_MAX) {
+        // Small heaps get smaller blocks so a single block never claims a large share of the heap.
+        // Resources larger than a block get a dedicated block of their own.
+        uint32_t heap_index = allocator->memory_properties.memoryTypes[memory_type].heapIndex;
+        VkDeviceSize heap_size = allocator->memory_properties.memoryHeaps[heap_index].size;
+        VkDeviceSize block_size = allocator->block_size;
+        if(block_size > heap_size / 8) {
+            block_size = heap_size / 8;
+        }
+        if(requirements->size > block_size) {
+            block_size = requirements->size;
+        }
+
+        if(!create_block(allocator, memory_type, block_size, kind, strategy, &block_index)) {
+            return false;
+        }
+
+        if(!block_allocate(&allocator->blocks[block_index], requirements->size, requirements->alignment, &offset)) {
+            return false;
+        }
+    }
+
+    memory_block *block = &allocator->blocks[block_index];
+    block->allocation_count++;
+    block->used += requirements->size;
+
+    allocator->stats.sub_allocations++;
+
+    VkDeviceSize used = 0;
+    for(uint32_t i = 0; i < allocator->block_count; i++) {
+        used += allocator->blocks[i].used;
+    }
+    if(used > allocator->stats.peak_used) {
+        allocator->stats.peak_used = used;
+    }
+
+    *out = (allocation){
+        .memory = block->memory,
+        .offset = offset,
+        .size = requirements->size,
+        .memory_type = memory_type,
+        .block_index = block_index,
+        .mapped = block->mapped ? (uint8_t*)block->mapped + offset : NULL,
+    };
+
+    return true;
+}
+
+void allocator_free(allocator *allocator, allocation *allocation) {
+    if(!allocation->memory) {
+        return;
+    }
+
+    memory_block *block = &allocator->blocks[allocation->block_index];
+    block->allocation_count--;
+    block->used -= allocation->size;
+
+    if(block->strategy == ALLOCATION_STRATEGY_FREE_LIST) {
+        block_free(block, allocation->offset, allocation->size);
+    }
+    else if(block->allocation_count == 0) {
+        block->linear_offset = 0;
+    }
+
+    memset(allocation, 0, sizeof(*allocation));
+}
+
+bool allocator_bind_image(allocator *allocator, VkImage image, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, allocation_strategy strategy, allocation *out) {
+    VkMemoryRequirements memory_requirements;
+    vkGetImageMemoryRequirements(allocator->device, image, &memory_requirements);
+
+    // Every image in this renderer uses VK_IMAGE_TILING_OPTIMAL.
+    if(!allocator_allocate(allocator, &memory_requirements, required, preferred, RESOURCE_KIND_OPTIMAL, strategy, out)) {
+        return false;
+    }
+
+    VkResult result = vkBindImageMemory(allocator->device, image, out->memory, out->offset);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to bind image memory: %s\n", string_VkResult(result));
+        allocator_free(allocator, out);
+        return false;
+    }
+
+    return true;
+}
+
+bool allocator_bind_buffer(allocator *allocator, VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, allocation_strategy strategy, allocation *out) {
+    VkMemoryRequirements memory_requirements;
+    vkGetBufferMemoryRequirements(allocator->device, buffer, &memory_requirements);
+
+    if(!allocator_allocate(allocator, &memory_requirements, required, preferred, RESOURCE_KIND_LINEAR, strategy, out)) {
+        return false;
+    }
+
+    VkResult result = vkBindBufferMemory(allocator->device, buffer, out->memory, out->offset);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to bind buffer memory: %s\n", string_VkResult(result));
+        allocator_free(allocator, out);
+        return false;
+    }
+
+    return true;
+}
+
+static VkMappedMemoryRange mapped_range(const allocator *allocator, const allocation *allocation, VkDeviceSize offset, VkDeviceSize size) {
+    // Ranges must be aligned to nonCoherentAtomSize, clamped to the end of the block.
+    const memory_block *block = &allocator->blocks[allocation->block_index];
+    VkDeviceSize atom = allocator->non_coherent_atom_size;
+    if(size == VK_WHOLE_SIZE) {
+        size = allocation->size - offset;
+    }
+
+    VkDeviceSize begin = align_down(allocation->offset + offset, atom);
+    VkDeviceSize end = align_up(allocation->offset + offset + size, atom);
+    if(end > block->size) {
+        end = block->size;
+    }
+
+    return (VkMappedMemoryRange){
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = allocation->memory,
+        .offset = begin,
+        .size = end - begin,
+    };
+}
+
+void allocator_invalidate(const allocator *allocator, const allocation *allocation) {
+    if(allocator->memory_properties.memoryTypes[allocation->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+
+    const VkMappedMemoryRange range = mapped_range(allocator, allocation, 0, allocation->size);
+    vkInvalidateMappedMemoryRanges(allocator->device, 1, &range);
+}
+
+void allocator_flush(const allocator *allocator, const allocation *allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if(allocator->memory_properties.memoryTypes[allocation->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+
+    const VkMappedMemoryRange range = mapped_range(allocator, allocation, offset, size);
+    vkFlushMappedMemoryRanges(allocator->device, 1, &range);
+}
+
+void allocator_print_stats(const allocator *allocator) {
+    VkDeviceSize reserved = 0;
+    VkDeviceSize used = 0;
+    uint32_t live = 0;
+    for(uint32_t i = 0; i < allocator->block_count; i++) {
+        reserved += allocator->blocks[i].size;
+        used += allocator->blocks[i].used;
+        live += allocator->blocks[i].allocation_count;
+    }
+
+    printf("Allocator: %u blocks, %.2f MiB reserved, %.2f MiB used (peak %.2f MiB), %u live allocations\n",
+        allocator->block_count, reserved / (1024.0 * 1024.0), used / (1024.0 * 1024.0),
+        allocator->stats.peak_used / (1024.0 * 1024.0), live);
+    printf("Allocator: %llu vkAllocateMemory calls for %llu sub-allocations\n",
+        (unsigned long long)allocator->stats.device_allocations,
+        (unsigned long long)allocator->stats.sub_allocations);
+
+    for(uint32_t i = 0; i < allocator->block_count; i++) {
+        const memory_block *block = &allocator->blocks[i];
+        printf("  block %u: type %u, %s resources, %s, %.2f / %.2f MiB used, %u allocations\n",
+            i, block->memory_type,
+            block->kind == RESOURCE_KIND_OPTIMAL ? "optimal" : "linear",
+            block->strategy == ALLOCATION_STRATEGY_LINEAR ? "arena" : "free list",
+            block->used / (1024.0 * 1024.0), block->size / (1024.0 * 1024.0),
+            block->allocation_count);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+// Buffers and linear images must not share a bufferImageGranularity page with optimal images.
+// Blocks only ever hold one kind of resource, so the granularity can never be violated.
+typedef enum resource_kind {
+    RESOURCE_KIND_LINEAR,
+    RESOURCE_KIND_OPTIMAL,
+} resource_kind;
+
+typedef enum allocation_strategy {
+    // Individually freed allocations, recycled through a coalescing free list.
+    ALLOCATION_STRATEGY_FREE_LIST,
+    // Bump allocations, a block is only reclaimed once all of its allocations are freed. Meant for transient uploads.
+    ALLOCATION_STRATEGY_LINEAR,
+} allocation_strategy;
+
+typedef struct allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    uint32_t block_index;
+
+    // Points at offset inside the persistently mapped block, NULL for memory that is not host visible.
+    void *mapped;
+} allocation;
+
+typedef struct free_range {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} free_range;
+
+typedef struct memory_block {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    resource_kind kind;
+    allocation_strategy strategy;
+    void *mapped;
+
+    uint32_t allocation_count;
+    VkDeviceSize used;
+
+    // ALLOCATION_STRATEGY_LINEAR
+    VkDeviceSize linear_offset;
+
+    // ALLOCATION_STRATEGY_FREE_LIST, sorted by offset.
+    free_range *free_ranges;
+    uint32_t free_range_count;
+    uint32_t free_range_capacity;
+} memory_block;
+
+typedef struct allocator_stats {
+    uint64_t device_allocations;
+    uint64_t sub_allocations;
+    VkDeviceSize peak_used;
+} allocator_stats;
+
+typedef struct allocator {
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize non_coherent_atom_size;
+    VkDeviceSize block_size;
+
+    memory_block *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+
+    allocator_stats stats;
+} allocator;
+
+bool allocator_init(allocator *allocator, VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size);
+void allocator_destroy(allocator *allocator);
+
+// Returns UINT32_MAX when no memory type has the required flags. Preferred flags are honoured when possible.
+uint32_t allocator_find_memory_type(const allocator *allocator, uint32_t type_filter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+
+bool allocator_allocate(allocator *allocator, const VkMemoryRequirements *requirements,
+    VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+    resource_kind kind, allocation_strategy strategy, allocation *out);
+void allocator_free(allocator *allocator, allocation *allocation);
+
+// Allocate and bind in one call, the allocation is released again if binding fails.
+bool allocator_bind_image(allocator *allocator, VkImage image, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, allocation_strategy strategy, allocation *out);
+bool allocator_bind_buffer(allocator *allocator, VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, allocation_strategy strategy, allocation *out);
+
+// Makes device writes visible to the host. A no-op for HOST_COHERENT memory.
+void allocator_invalidate(const allocator *allocator, const allocation *allocation);
+// Makes host writes visible to the device. A no-op for HOST_COHERENT memory. VK_WHOLE_SIZE flushes the rest of
+// the allocation.
+void allocator_flush(const allocator *allocator, const allocation *allocation, VkDeviceSize offset, VkDeviceSize size);
+
+void allocator_print_stats(const allocator *allocator);
+
+#endif // ALLOCATOR_H
\ No newline at end of file
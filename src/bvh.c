@@ -0,0 +1,467 @@
+#include "bvh.h"
+#include "parallel.h"
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Bins per axis the SAH split candidates are taken from.
+#define BVH_BIN_COUNT 16
+// Threads are only worth it for subtrees of at least this many items.
+#define PARALLEL_SUBTREE_MIN_ITEMS 4096
+
+void bvh_bounds_empty(bvh_bounds *bounds) {
+    for(int i = 0; i < 3; i++) {
+        bounds->min[i] = FLT_MAX;
+        bounds->max[i] = -FLT_MAX;
+    }
+}
+
+void bvh_bounds_grow(bvh_bounds *bounds, const bvh_bounds *other) {
+    for(int i = 0; i < 3; i++) {
+        bounds->min[i] = other->min[i] < bounds->min[i] ? other->min[i] : bounds->min[i];
+        bounds->max[i] = other->max[i] > bounds->max[i] ? other->max[i] : bounds->max[i];
+    }
+}
+
+void bvh_bounds_grow_point(bvh_bounds *bounds, const float point[3]) {
+    for(int i = 0; i < 3; i++) {
+        bounds->min[i] = point[i] < bounds->min[i] ? point[i] : bounds->min[i];
+        bounds->max[i] = point[i] > bounds->max[i] ? point[i] : bounds->max[i];
+    }
+}
+
+static float get_centroid(const bvh_bounds *bounds, int axis) {
+    return (bounds->min[axis] + bounds->max[axis]) * 0.5f;
+}
+
+// Quickselect: afterwards order[middle] has the median centroid, with smaller ones before and larger ones after.
+static void select_median(uint32_t *order, const bvh_bounds *item_bounds, uint32_t begin, uint32_t end, uint32_t middle, int axis) {
+    while(end - begin > 1) {
+        float pivot = get_centroid(&item_bounds[order[(begin + end) / 2]], axis);
+
+        // Three-way partition, so runs of equal centroids cannot stall the loop.
+        uint32_t less = begin, i = begin, greater = end;
+        while(i < greater) {
+            float centroid = get_centroid(&item_bounds[order[i]], axis);
+            uint32_t item = order[i];
+            if(centroid < pivot) {
+                order[i++] = order[less];
+                order[less++] = item;
+            } else if(centroid > pivot) {
+                order[i] = order[--greater];
+                order[greater] = item;
+            } else {
+                i++;
+            }
+        }
+
+        if(middle < less) {
+            end = less;
+        } else if(middle >= greater) {
+            begin = greater;
+        } else {
+            return;
+        }
+    }
+}
+
+static void set_node_bounds(bvh_node *node, const bvh_bounds *bounds) {
+    for(int i = 0; i < 3; i++) {
+        node->min[i] = bounds->min[i];
+        node->max[i] = bounds->max[i];
+    }
+}
+
+static void get_node_bounds(const bvh_node *node, bvh_bounds *out) {
+    for(int i = 0; i < 3; i++) {
+        out->min[i] = node->min[i];
+        out->max[i] = node->max[i];
+    }
+}
+
+static float get_half_area(const bvh_bounds *bounds) {
+    float x = bounds->max[0] - bounds->min[0];
+    float y = bounds->max[1] - bounds->min[1];
+    float z = bounds->max[2] - bounds->min[2];
+    return x * y + y * z + z * x;
+}
+
+typedef struct sah_bin {
+    bvh_bounds bounds;
+    uint32_t count;
+} sah_bin;
+
+static int get_bin(float centroid, float min, float scale) {
+    int bin = (int)((centroid - min) * scale);
+    return bin < 0 ? 0 : bin >= BVH_BIN_COUNT ? BVH_BIN_COUNT - 1 : bin;
+}
+
+// Bins the centroids along every axis and finds the plane between two bins with the lowest sum of area times items
+// on both sides. Fails when all centroids are the same point.
+static bool find_sah_split(const bvh_bounds *item_bounds, const uint32_t *order, uint32_t begin, uint32_t end,
+                           const bvh_bounds *centroid_bounds, int *best_axis, int *best_bin, float *best_cost) {
+    sah_bin bins[3][BVH_BIN_COUNT];
+    float scales[3];
+    for(int axis = 0; axis < 3; axis++) {
+        // Flat axes get no bins, everything would land in the first one.
+        float extent = centroid_bounds->max[axis] - centroid_bounds->min[axis];
+        scales[axis] = extent > 0.0f ? BVH_BIN_COUNT / extent : 0.0f;
+        for(int i = 0; i < BVH_BIN_COUNT; i++) {
+            bvh_bounds_empty(&bins[axis][i].bounds);
+            bins[axis][i].count = 0;
+        }
+    }
+
+    // All three axes in one pass, the items are only read once.
+    for(uint32_t i = begin; i < end; i++) {
+        const bvh_bounds *item = &item_bounds[order[i]];
+        for(int axis = 0; axis < 3; axis++) {
+            sah_bin *bin = &bins[axis][get_bin(get_centroid(item, axis), centroid_bounds->min[axis], scales[axis])];
+            bvh_bounds_grow(&bin->bounds, item);
+            bin->count++;
+        }
+    }
+
+    bool found = false;
+    *best_cost = FLT_MAX;
+    for(int axis = 0; axis < 3; axis++) {
+        if(scales[axis] == 0.0f) {
+            continue;
+        }
+
+        // Sweep once from the right for the costs of every right side, then from the left to combine them.
+        float right_costs[BVH_BIN_COUNT];
+        uint32_t right_counts[BVH_BIN_COUNT];
+        bvh_bounds side;
+        uint32_t count = 0;
+        bvh_bounds_empty(&side);
+        for(int i = BVH_BIN_COUNT - 1; i > 0; i--) {
+            bvh_bounds_grow(&side, &bins[axis][i].bounds);
+            count += bins[axis][i].count;
+            right_counts[i] = count;
+            right_costs[i] = count > 0 ? get_half_area(&side) * count : 0.0f;
+        }
+
+        count = 0;
+        bvh_bounds_empty(&side);
+        for(int i = 0; i < BVH_BIN_COUNT - 1; i++) {
+            bvh_bounds_grow(&side, &bins[axis][i].bounds);
+            count += bins[axis][i].count;
+            if(count == 0 || right_counts[i + 1] == 0) {
+                continue;
+            }
+
+            float cost = get_half_area(&side) * count + right_costs[i + 1];
+            if(cost < *best_cost) {
+                *best_cost = cost;
+                *best_axis = axis;
+                *best_bin = i;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+typedef struct build_task {
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t depth;
+} build_task;
+
+typedef struct build_context {
+    const bvh_bounds *item_bounds;
+    bvh_split split;
+    uint32_t *order;
+    bvh_node *nodes;
+    // Children are allocated in pairs from here, by every thread.
+    atomic_uint node_count;
+    // Tasks with fewer items are set aside while the top of the tree is split, then built in parallel.
+    uint32_t defer_below;
+    build_task *deferred;
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
+} build_context;
+
+// Orders the items of a task into the two children, which split at middle. Returns false when the node should stay
+// a leaf instead.
+static bool partition_items(build_context *context, const build_task *task, const bvh_bounds *bounds,
+                            const bvh_bounds *centroid_bounds, uint32_t *middle) {
+    const bvh_bounds *item_bounds = context->item_bounds;
+    uint32_t *order = context->order;
+    uint32_t count = task->end - task->begin;
+    *middle = task->begin + count / 2;
+
+    int axis, bin;
+    float cost;
+    if(context->split == BVH_SPLIT_SAH && find_sah_split(item_bounds, order, task->begin, task->end, centroid_bounds, &axis, &bin, &cost)) {
+        // Small nodes stay leaves when testing their items is cheaper than any split.
+        cost = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * cost / fmaxf(get_half_area(bounds), FLT_MIN);
+        if(count <= BVH_MAX_LEAF_SIZE && count * BVH_INTERSECTION_COST <= cost) {
+            return false;
+        }
+
+        float min = centroid_bounds->min[axis];
+        float scale = BVH_BIN_COUNT / (centroid_bounds->max[axis] - min);
+        uint32_t i = task->begin, j = task->end;
+        while(i < j) {
+            if(get_bin(get_centroid(&item_bounds[order[i]], axis), min, scale) <= bin) {
+                i++;
+            } else {
+                uint32_t item = order[i];
+                order[i] = order[--j];
+                order[j] = item;
+            }
+        }
+
+        *middle = i;
+        return true;
+    }
+
+    if(count <= BVH_MAX_LEAF_SIZE) {
+        return false;
+    }
+
+    if(context->split == BVH_SPLIT_MEDIAN) {
+        axis = 0;
+        for(int i = 1; i < 3; i++) {
+            if(centroid_bounds->max[i] - centroid_bounds->min[i] > centroid_bounds->max[axis] - centroid_bounds->min[axis]) {
+                axis = i;
+            }
+        }
+
+        select_median(order, item_bounds, task->begin, task->end, *middle, axis);
+    }
+
+    // Without an SAH split all centroids coincide, and any split of the range is as good as another.
+    return true;
+}
+
+// Sets the bounds of the task's node, then either makes it a leaf or returns the two child tasks. Returns false for
+// leaves.
+static bool split_node(build_context *context, const build_task *task, build_task children[2]) {
+    bvh_node *node = &context->nodes[task->node];
+
+    bvh_bounds bounds, centroid_bounds;
+    bvh_bounds_empty(&bounds);
+    bvh_bounds_empty(&centroid_bounds);
+    for(uint32_t i = task->begin; i < task->end; i++) {
+        const bvh_bounds *item = &context->item_bounds[context->order[i]];
+        float centroid[3] = { get_centroid(item, 0), get_centroid(item, 1), get_centroid(item, 2) };
+        bvh_bounds_grow(&bounds, item);
+        bvh_bounds_grow_point(&centroid_bounds, centroid);
+    }
+
+    set_node_bounds(node, &bounds);
+
+    uint32_t count = task->end - task->begin;
+    uint32_t middle;
+    if(count == 1 || task->depth + 1 >= BVH_MAX_DEPTH || !partition_items(context, task, &bounds, &centroid_bounds, &middle)) {
+        node->first = task->begin;
+        node->count = count;
+        return false;
+    }
+
+    uint32_t left = atomic_fetch_add(&context->node_count, 2u);
+    node->first = left;
+    node->count = 0;
+
+    children[0] = (build_task){ .node = left, .begin = task->begin, .end = middle, .depth = task->depth + 1 };
+    children[1] = (build_task){ .node = left + 1, .begin = middle, .end = task->end, .depth = task->depth + 1 };
+    return true;
+}
+
+// Depth first, the right half waits on the stack while the left one is split. That keeps the stack at most one task
+// per level. With defer set, small tasks are set aside instead.
+static bool build_subtree(build_context *context, build_task root, bool defer) {
+    build_task tasks[2 * BVH_MAX_DEPTH];
+    uint32_t task_count = 0;
+    tasks[task_count++] = root;
+
+    while(task_count > 0) {
+        build_task task = tasks[--task_count];
+        if(defer && task.end - task.begin < context->defer_below) {
+            if(context->deferred_count == context->deferred_capacity) {
+                uint32_t capacity = context->deferred_capacity ? context->deferred_capacity * 2 : 64;
+                build_task *deferred = realloc(context->deferred, sizeof(build_task) * capacity);
+                if(!deferred) {
+                    return false;
+                }
+
+                context->deferred = deferred;
+                context->deferred_capacity = capacity;
+            }
+
+            context->deferred[context->deferred_count++] = task;
+            continue;
+        }
+
+        build_task children[2];
+        if(split_node(context, &task, children)) {
+            tasks[task_count++] = children[1];
+            tasks[task_count++] = children[0];
+        }
+    }
+
+    return true;
+}
+
+static void build_deferred(void *context, uint32_t index) {
+    build_context *build = context;
+    build_subtree(build, build->deferred[index], false);
+}
+
+// Renumbers the nodes in the order a build on one thread would have allocated them, so the layout does not depend
+// on how the threads raced for nodes.
+static bool compact_nodes(bvh *out) {
+    bvh_node *nodes = calloc(2 * out->item_count - 1, sizeof(bvh_node));
+    if(!nodes) {
+        return false;
+    }
+
+    // Pairs of old and new index.
+    uint32_t stack[4 * BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+    uint32_t node_count = 1;
+    nodes[0] = out->nodes[0];
+    stack[stack_size++] = 0;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0) {
+        uint32_t new_index = stack[--stack_size];
+        uint32_t old_index = stack[--stack_size];
+        bvh_node *node = &nodes[new_index];
+        if(node->count > 0) {
+            continue;
+        }
+
+        uint32_t old_left = out->nodes[old_index].first;
+        uint32_t left = node_count;
+        node_count += 2;
+        node->first = left;
+        nodes[left] = out->nodes[old_left];
+        nodes[left + 1] = out->nodes[old_left + 1];
+
+        stack[stack_size++] = old_left + 1;
+        stack[stack_size++] = left + 1;
+        stack[stack_size++] = old_left;
+        stack[stack_size++] = left;
+    }
+
+    free(out->nodes);
+    out->nodes = nodes;
+    out->node_count = node_count;
+    return true;
+}
+
+bool bvh_build(const bvh_bounds *item_bounds, uint32_t item_count, bvh_split split, uint32_t thread_count, bvh *out) {
+    *out = (bvh){0};
+    if(item_count == 0) {
+        fprintf(stderr, "Cannot build a BVH without items\n");
+        return false;
+    }
+
+    // A binary tree with at least one item per leaf never has more nodes than this.
+    out->nodes = calloc(2 * item_count - 1, sizeof(bvh_node));
+    out->order = malloc(sizeof(uint32_t) * item_count);
+    if(!out->nodes || !out->order) {
+        bvh_free(out);
+        return false;
+    }
+
+    out->item_count = item_count;
+    for(uint32_t i = 0; i < item_count; i++) {
+        out->order[i] = i;
+    }
+
+    thread_count = thread_count ? thread_count : parallel_thread_count();
+
+    // A few subtrees per thread balance well. The top of the tree is split on the calling thread, but those splits
+    // only ever touch the largest ranges of items once per level.
+    uint32_t defer_below = 0;
+    if(thread_count > 1) {
+        defer_below = item_count / (thread_count * 4);
+        defer_below = defer_below > PARALLEL_SUBTREE_MIN_ITEMS ? defer_below : PARALLEL_SUBTREE_MIN_ITEMS;
+    }
+
+    build_context context = {
+        .item_bounds = item_bounds,
+        .split = split,
+        .order = out->order,
+        .nodes = out->nodes,
+        .defer_below = defer_below,
+    };
+
+    atomic_init(&context.node_count, 1u);
+
+    bool success = build_subtree(&context, (build_task){ .node = 0, .begin = 0, .end = item_count, .depth = 0 }, true);
+    if(success && context.deferred_count > 0) {
+        parallel_for(context.deferred_count, thread_count, build_deferred, &context);
+    }
+
+    out->node_count = atomic_load(&context.node_count);
+    if(success && context.deferred_count > 0) {
+        success = compact_nodes(out);
+    }
+
+    free(context.deferred);
+    if(!success) {
+        bvh_free(out);
+        return false;
+    }
+
+    out->build_cost = bvh_sah_cost(out);
+    return true;
+}
+
+void bvh_refit(bvh *bvh, const bvh_bounds *item_bounds) {
+    // Children are always stored after their parent, so walking backwards visits them first.
+    for(uint32_t i = bvh->node_count; i-- > 0;) {
+        bvh_node *node = &bvh->nodes[i];
+        bvh_bounds bounds;
+        if(node->count > 0) {
+            bvh_bounds_empty(&bounds);
+            for(uint32_t j = node->first; j < node->first + node->count; j++) {
+                bvh_bounds_grow(&bounds, &item_bounds[bvh->order[j]]);
+            }
+        } else {
+            bvh_bounds right;
+            get_node_bounds(&bvh->nodes[node->first], &bounds);
+            get_node_bounds(&bvh->nodes[node->first + 1], &right);
+            bvh_bounds_grow(&bounds, &right);
+        }
+
+        set_node_bounds(node, &bounds);
+    }
+}
+
+float bvh_sah_cost(const bvh *bvh) {
+    // Only ratios of areas matter, half of them do as well.
+    bvh_bounds bounds;
+    get_node_bounds(&bvh->nodes[0], &bounds);
+    float root_area = get_half_area(&bounds);
+    if(!(root_area > 0.0f)) {
+        return 0.0f;
+    }
+
+    // Summed in double, trees with millions of nodes would lose the small ones otherwise.
+    double cost = 0.0;
+    for(uint32_t i = 0; i < bvh->node_count; i++) {
+        const bvh_node *node = &bvh->nodes[i];
+        float node_cost = node->count > 0 ? node->count * BVH_INTERSECTION_COST : BVH_TRAVERSAL_COST;
+        get_node_bounds(node, &bounds);
+        cost += get_half_area(&bounds) * node_cost;
+    }
+
+    return (float)(cost / root_area);
+}
+
+void bvh_free(bvh *bvh) {
+    free(bvh->order);
+    free(bvh->nodes);
+    *bvh = (struct bvh){0};
+}
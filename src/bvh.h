@@ -0,0 +1,66 @@
+#ifndef BVH_H
+#define BVH_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Levels below the root, matches BVH_STACK_SIZE in pathtracer.comp. Deeper subtrees are collapsed into one leaf,
+// so traversal never needs a larger stack.
+#define BVH_MAX_DEPTH 32
+#define BVH_MAX_LEAF_SIZE 4
+
+// Relative costs of visiting a node and of testing an item, for the surface area heuristic.
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECTION_COST 1.0f
+
+typedef struct bvh_bounds {
+    float min[3];
+    float max[3];
+} bvh_bounds;
+
+// std430 layout of struct bvh_node in pathtracer.comp. Interior nodes have a count of zero and their two children
+// at first and first + 1, leaves hold the items [first, first + count) of the build order.
+typedef struct bvh_node {
+    float min[3];
+    uint32_t first;
+    float max[3];
+    uint32_t count;
+} bvh_node;
+
+typedef struct bvh {
+    // The root is nodes[0].
+    bvh_node *nodes;
+    uint32_t node_count;
+    // Leaf ranges index into this permutation of the items.
+    uint32_t *order;
+    uint32_t item_count;
+    // bvh_sah_cost() right after the build, what refits are measured against.
+    float build_cost;
+} bvh;
+
+typedef enum bvh_split {
+    // The cheapest of the planes between 16 bins per axis under the surface area heuristic. Nodes of up to
+    // BVH_MAX_LEAF_SIZE items stay leaves when that is cheaper.
+    BVH_SPLIT_SAH = 0,
+    // The median centroid along the longest axis of the centroid bounds. Faster to build, slower to trace.
+    BVH_SPLIT_MEDIAN = 1,
+} bvh_split;
+
+// Needs at least one item. Room is allocated for the 2 * item_count - 1 nodes a tree can have at most, the unused ones
+// are zeroed. Below the top splits the subtrees are built on up to thread_count threads, zero meaning one per core.
+// The result is the same for any number of threads.
+bool bvh_build(const bvh_bounds *item_bounds, uint32_t item_count, bvh_split split, uint32_t thread_count, bvh *out);
+void bvh_free(bvh *bvh);
+
+// Recomputes the node bounds for items that have moved, keeping the tree as it is. Far cheaper than a rebuild, but
+// the tree gets worse as items drift away from where they were when it was built.
+void bvh_refit(bvh *bvh, const bvh_bounds *item_bounds);
+
+// Expected cost of tracing a ray through the tree under the surface area heuristic: every node costs its surface
+// area relative to the root's, times the cost of visiting it or of testing its items.
+float bvh_sah_cost(const bvh *bvh);
+
+void bvh_bounds_empty(bvh_bounds *bounds);
+void bvh_bounds_grow(bvh_bounds *bounds, const bvh_bounds *other);
+void bvh_bounds_grow_point(bvh_bounds *bounds, const float point[3]);
+
+#endif // BVH_H
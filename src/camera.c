@@ -0,0 +1,179 @@
+#include "camera.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+camera camera_default(void) {
+    // The image plane used to sit at z = -1 with a half height of 0.5.
+    return (camera){
+        .position = { 0.0f, 0.0f, 0.0f },
+        .target = { 0.0f, 0.0f, -1.0f },
+        .up = { 0.0f, 1.0f, 0.0f },
+        .fov = 2.0f * atanf(0.5f) * 180.0f / 3.14159265358979f,
+    };
+}
+
+bool camera_parse(const char *text, camera *out) {
+    camera parsed = camera_default();
+    int count = sscanf(text, "%f,%f,%f,%f,%f,%f,%f",
+        &parsed.position[0], &parsed.position[1], &parsed.position[2],
+        &parsed.target[0], &parsed.target[1], &parsed.target[2],
+        &parsed.fov);
+
+    if(count != 6 && count != 7) {
+        fprintf(stderr, "Expected a camera as px,py,pz,tx,ty,tz[,fov]: %s\n", text);
+        return false;
+    }
+
+    *out = parsed;
+    return true;
+}
+
+static void cross(const float a[3], const float b[3], float out[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static bool normalize(float v[3]) {
+    float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if(length < 1e-6f) {
+        return false;
+    }
+
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+    return true;
+}
+
+bool camera_basis(const camera *camera, float right[3], float up[3], float forward[3]) {
+    if(!(camera->fov > 0.0f && camera->fov < 180.0f)) {
+        return false;
+    }
+
+    for(int i = 0; i < 3; i++) {
+        forward[i] = camera->target[i] - camera->position[i];
+    }
+
+    if(!normalize(forward)) {
+        return false;
+    }
+
+    // Fails when looking straight along the up vector.
+    cross(forward, camera->up, right);
+    if(!normalize(right)) {
+        return false;
+    }
+
+    cross(right, forward, up);
+    return true;
+}
+
+bool camera_path_load(const char *filename, camera_path *out) {
+    FILE *file = fopen(filename, "r");
+    if(!file) {
+        perror(filename);
+        return false;
+    }
+
+    out->keyframes = NULL;
+    out->keyframe_count = 0;
+    uint32_t capacity = 0;
+
+    char line[512];
+    uint32_t line_number = 0;
+    while(fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        const char *start = line + strspn(line, " \t\r\n");
+        if(*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        camera_keyframe keyframe = { .camera = camera_default() };
+        camera *c = &keyframe.camera;
+        int count = sscanf(start, "%f %f %f %f %f %f %f %f", &keyframe.time,
+            &c->position[0], &c->position[1], &c->position[2],
+            &c->target[0], &c->target[1], &c->target[2], &c->fov);
+
+        if(count != 8 || (out->keyframe_count > 0 && keyframe.time < out->keyframes[out->keyframe_count - 1].time)) {
+            fprintf(stderr, "%s:%u: expected \"time px py pz tx ty tz fov\" with increasing times\n", filename, line_number);
+            camera_path_free(out);
+            fclose(file);
+            return false;
+        }
+
+        if(out->keyframe_count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            camera_keyframe *grown = realloc(out->keyframes, capacity * sizeof(camera_keyframe));
+            if(!grown) {
+                camera_path_free(out);
+                fclose(file);
+                return false;
+            }
+
+            out->keyframes = grown;
+        }
+
+        out->keyframes[out->keyframe_count++] = keyframe;
+    }
+
+    fclose(file);
+
+    if(out->keyframe_count == 0) {
+        fprintf(stderr, "%s: no keyframes\n", filename);
+        return false;
+    }
+
+    return true;
+}
+
+void camera_path_free(camera_path *path) {
+    free(path->keyframes);
+    path->keyframes = NULL;
+    path->keyframe_count = 0;
+}
+
+static float catmull_rom(float p0, float p1, float p2, float p3, float t) {
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * ((2.0f * p1) + (-p0 + p2) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
+}
+
+camera camera_path_evaluate(const camera_path *path, float time) {
+    const camera_keyframe *keyframes = path->keyframes;
+    uint32_t last = path->keyframe_count - 1;
+
+    if(time <= keyframes[0].time) {
+        return keyframes[0].camera;
+    }
+
+    if(time >= keyframes[last].time) {
+        return keyframes[last].camera;
+    }
+
+    uint32_t segment = 0;
+    while(keyframes[segment + 1].time < time) {
+        segment++;
+    }
+
+    // The end keyframes are repeated as their own neighbours.
+    const camera *c0 = &keyframes[segment > 0 ? segment - 1 : 0].camera;
+    const camera *c1 = &keyframes[segment].camera;
+    const camera *c2 = &keyframes[segment + 1].camera;
+    const camera *c3 = &keyframes[segment + 2 <= last ? segment + 2 : last].camera;
+
+    float duration = keyframes[segment + 1].time - keyframes[segment].time;
+    float t = duration > 0.0f ? (time - keyframes[segment].time) / duration : 0.0f;
+
+    camera result = *c1;
+    for(int i = 0; i < 3; i++) {
+        result.position[i] = catmull_rom(c0->position[i], c1->position[i], c2->position[i], c3->position[i], t);
+        result.target[i] = catmull_rom(c0->target[i], c1->target[i], c2->target[i], c3->target[i], t);
+    }
+
+    result.fov = c1->fov + (c2->fov - c1->fov) * t;
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct camera {
+    float position[3];
+    float target[3];
+    float up[3];
+    // Vertical field of view in degrees.
+    float fov;
+} camera;
+
+// Looks down -z from the origin, with the field of view the trace shader used before the camera was configurable.
+camera camera_default(void);
+
+// Parses "px,py,pz,tx,ty,tz" with an optional ",fov". The up vector is always +y.
+bool camera_parse(const char *text, camera *out);
+
+// Orthonormal basis with forward pointing from the position to the target. Fails for degenerate cameras.
+bool camera_basis(const camera *camera, float right[3], float up[3], float forward[3]);
+
+typedef struct camera_keyframe {
+    float time;
+    camera camera;
+} camera_keyframe;
+
+typedef struct camera_path {
+    camera_keyframe *keyframes;
+    uint32_t keyframe_count;
+} camera_path;
+
+// One keyframe per line as "time px py pz tx ty tz fov", sorted by time. Empty lines and lines starting with # are skipped.
+bool camera_path_load(const char *filename, camera_path *out);
+void camera_path_free(camera_path *path);
+
+// Catmull-Rom spline through the keyframe positions and targets, the field of view is interpolated linearly.
+// Times outside the path are clamped to its ends.
+camera camera_path_evaluate(const camera_path *path, float time);
+
+#endif // CAMERA_H
\ No newline at end of file
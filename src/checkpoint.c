@@ -0,0 +1,233 @@
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool checkpoint_alloc(checkpoint *checkpoint, uint32_t width, uint32_t height) {
+    size_t pixel_count = (size_t)width * height;
+
+    memset(checkpoint, 0, sizeof(*checkpoint));
+    checkpoint->header.width = width;
+    checkpoint->header.height = height;
+    checkpoint->accumulation = malloc(pixel_count * 4 * sizeof(float));
+    checkpoint->albedo = malloc(pixel_count * 4 * sizeof(float));
+    checkpoint->normal_depth = malloc(pixel_count * 4 * sizeof(float));
+
+    if(!checkpoint->accumulation || !checkpoint->albedo || !checkpoint->normal_depth) {
+        fprintf(stderr, "Failed to allocate checkpoint memory\n");
+        checkpoint_free(checkpoint);
+        return false;
+    }
+
+    return true;
+}
+
+void checkpoint_free(checkpoint *checkpoint) {
+    free(checkpoint->normal_depth);
+    free(checkpoint->albedo);
+    free(checkpoint->accumulation);
+    checkpoint->normal_depth = NULL;
+    checkpoint->albedo = NULL;
+    checkpoint->accumulation = NULL;
+}
+
+static bool write_channels(FILE *file, const float *rgba, size_t pixel_count, size_t channels) {
+    if(channels == 4) {
+        return fwrite(rgba, sizeof(float) * 4, pixel_count, file) == pixel_count;
+    }
+
+    for(size_t i = 0; i < pixel_count; i++) {
+        if(fwrite(&rgba[i * 4], sizeof(float), channels, file) != channels) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool read_channels(FILE *file, float *rgba, size_t pixel_count, size_t channels) {
+    if(channels == 4) {
+        return fread(rgba, sizeof(float) * 4, pixel_count, file) == pixel_count;
+    }
+
+    for(size_t i = 0; i < pixel_count; i++) {
+        if(fread(&rgba[i * 4], sizeof(float), channels, file) != channels) {
+            return false;
+        }
+
+        rgba[i * 4 + 3] = 1.0f;
+    }
+
+    return true;
+}
+
+bool checkpoint_read(const char *filename, checkpoint *out) {
+    FILE *file = fopen(filename, "rb");
+    if(!file) {
+        perror(filename);
+        return false;
+    }
+
+    checkpoint_header header;
+    if(fread(&header, sizeof(header), 1, file) != 1) {
+        fprintf(stderr, "%s: truncated checkpoint header\n", filename);
+        fclose(file);
+        return false;
+    }
+
+    if(header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "%s: not a version %u checkpoint\n", filename, CHECKPOINT_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    if(!checkpoint_alloc(out, header.width, header.height)) {
+        fclose(file);
+        return false;
+    }
+
+    out->header = header;
+
+    size_t pixel_count = (size_t)header.width * header.height;
+    bool complete =
+        read_channels(file, out->accumulation, pixel_count, 3) &&
+        read_channels(file, out->albedo, pixel_count, 3) &&
+        read_channels(file, out->normal_depth, pixel_count, 4);
+
+    fclose(file);
+
+    if(!complete) {
+        fprintf(stderr, "%s: truncated checkpoint data\n", filename);
+        checkpoint_free(out);
+        return false;
+    }
+
+    return true;
+}
+
+bool checkpoint_write(const char *filename, const checkpoint *checkpoint) {
+    char temp_filename[4096];
+    if(snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename) >= (int)sizeof(temp_filename)) {
+        fprintf(stderr, "Checkpoint path is too long: %s\n", filename);
+        return false;
+    }
+
+    FILE *file = fopen(temp_filename, "wb");
+    if(!file) {
+        perror(temp_filename);
+        return false;
+    }
+
+    size_t pixel_count = (size_t)checkpoint->header.width * checkpoint->header.height;
+    bool written =
+        fwrite(&checkpoint->header, sizeof(checkpoint->header), 1, file) == 1 &&
+        write_channels(file, checkpoint->accumulation, pixel_count, 3) &&
+        write_channels(file, checkpoint->albedo, pixel_count, 3) &&
+        write_channels(file, checkpoint->normal_depth, pixel_count, 4);
+
+    if(fclose(file) != 0) {
+        written = false;
+    }
+
+    if(!written) {
+        perror(temp_filename);
+        remove(temp_filename);
+        return false;
+    }
+
+    // rename() does not replace existing files on Windows.
+    if(rename(temp_filename, filename) != 0) {
+        remove(filename);
+        if(rename(temp_filename, filename) != 0) {
+            perror(filename);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int writer_thread(void *arg) {
+    checkpoint_writer *writer = arg;
+
+    mtx_lock(&writer->mutex);
+    for(;;) {
+        while(!writer->pending && !writer->quit) {
+            cnd_wait(&writer->condition, &writer->mutex);
+        }
+
+        if(!writer->pending) {
+            break;
+        }
+
+        // The snapshot is not touched by the render thread until pending is cleared again.
+        mtx_unlock(&writer->mutex);
+        checkpoint_write(writer->filename, &writer->snapshot);
+        mtx_lock(&writer->mutex);
+
+        writer->pending = false;
+    }
+    mtx_unlock(&writer->mutex);
+
+    return 0;
+}
+
+bool checkpoint_writer_start(checkpoint_writer *writer, const char *filename, uint32_t width, uint32_t height) {
+    if(!checkpoint_alloc(&writer->snapshot, width, height)) {
+        return false;
+    }
+
+    writer->filename = filename;
+    writer->pending = false;
+    writer->quit = false;
+
+    if(mtx_init(&writer->mutex, mtx_plain) != thrd_success) {
+        fprintf(stderr, "Failed to create checkpoint writer mutex\n");
+        checkpoint_free(&writer->snapshot);
+        return false;
+    }
+
+    if(cnd_init(&writer->condition) != thrd_success) {
+        fprintf(stderr, "Failed to create checkpoint writer condition variable\n");
+        mtx_destroy(&writer->mutex);
+        checkpoint_free(&writer->snapshot);
+        return false;
+    }
+
+    if(thrd_create(&writer->thread, writer_thread, writer) != thrd_success) {
+        fprintf(stderr, "Failed to create checkpoint writer thread\n");
+        cnd_destroy(&writer->condition);
+        mtx_destroy(&writer->mutex);
+        checkpoint_free(&writer->snapshot);
+        return false;
+    }
+
+    return true;
+}
+
+checkpoint *checkpoint_writer_acquire(checkpoint_writer *writer) {
+    mtx_lock(&writer->mutex);
+    bool busy = writer->pending;
+    mtx_unlock(&writer->mutex);
+
+    return busy ? NULL : &writer->snapshot;
+}
+
+void checkpoint_writer_submit(checkpoint_writer *writer) {
+    mtx_lock(&writer->mutex);
+    writer->pending = true;
+    cnd_signal(&writer->condition);
+    mtx_unlock(&writer->mutex);
+}
+
+void checkpoint_writer_stop(checkpoint_writer *writer) {
+    mtx_lock(&writer->mutex);
+    writer->quit = true;
+    cnd_signal(&writer->condition);
+    mtx_unlock(&writer->mutex);
+
+    thrd_join(writer->thread, NULL);
+    cnd_destroy(&writer->condition);
+    mtx_destroy(&writer->mutex);
+    checkpoint_free(&writer->snapshot);
+}
\ No newline at end of file
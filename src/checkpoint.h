@@ -0,0 +1,63 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+#define CHECKPOINT_MAGIC 0x4b435450u // "PTCK"
+#define CHECKPOINT_VERSION 1u
+
+// Followed on disk by the accumulated radiance (RGB), first hit albedo (RGB) and normal/depth (RGBA) sums,
+// all as 32-bit floats in row-major order. The unused alpha channels are not stored.
+typedef struct checkpoint_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samples_completed;
+    uint32_t samples_per_pass;
+    // Index of the next sample pass, the trace shader seeds its RNG with it.
+    uint32_t pass_index;
+    uint32_t reserved;
+    // Hash of everything that determines the image: scene, camera, resolution.
+    uint64_t scene_hash;
+} checkpoint_header;
+
+// In memory every image keeps the RGBA layout of the storage images so it can be copied straight from or to staging memory.
+typedef struct checkpoint {
+    checkpoint_header header;
+    float *accumulation;
+    float *albedo;
+    float *normal_depth;
+} checkpoint;
+
+bool checkpoint_alloc(checkpoint *checkpoint, uint32_t width, uint32_t height);
+void checkpoint_free(checkpoint *checkpoint);
+
+bool checkpoint_read(const char *filename, checkpoint *out);
+// Writes to a temporary file first and renames it over the old checkpoint, so a crash never leaves a torn file behind.
+bool checkpoint_write(const char *filename, const checkpoint *checkpoint);
+
+// Writes checkpoints on a background thread so the GPU can keep rendering while the file is written.
+typedef struct checkpoint_writer {
+    const char *filename;
+    checkpoint snapshot;
+
+    thrd_t thread;
+    mtx_t mutex;
+    cnd_t condition;
+    bool pending;
+    bool quit;
+} checkpoint_writer;
+
+bool checkpoint_writer_start(checkpoint_writer *writer, const char *filename, uint32_t width, uint32_t height);
+
+// Returns the snapshot to fill, or NULL while the previous checkpoint is still being written.
+checkpoint *checkpoint_writer_acquire(checkpoint_writer *writer);
+// Hands the snapshot returned by checkpoint_writer_acquire() to the writer thread.
+void checkpoint_writer_submit(checkpoint_writer *writer);
+
+// Finishes a pending write and joins the writer thread.
+void checkpoint_writer_stop(checkpoint_writer *writer);
+
+#endif // CHECKPOINT_H
\ No newline at end of file
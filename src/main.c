@@ -1,736 +1,1283 @@
+#include "camera.h"
+#include "checkpoint.h"
+#include "renderer.h"
+#include "server.h"
+#include "timeline.h"
 #include "utils.h"
+#include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#include <vulkan/vulkan.h>
-#include <vulkan/vk_enum_string_helper.h>
+#include <string.h>
 
 #include <stb_image_write.h>
 
 #define ARRAY_LENGTH(x) (sizeof(x) / sizeof((x)[0]))
+// Enough for the zones of a long camera path, the BVH builds add one event per parallel item.
+#define TIMELINE_MAX_EVENTS (1u << 20)
+
+static double compute_psnr(const uint8_t *image, const uint8_t *reference, size_t pixel_count) {
+    double squared_error = 0.0;
+    for(size_t i = 0; i < pixel_count; i++) {
+        // Alpha is always opaque, only the color channels count.
+        for(size_t c = 0; c < 3; c++) {
+            double difference = (double)image[i * 4 + c] - (double)reference[i * 4 + c];
+            squared_error += difference * difference;
+        }
+    }
 
-static const char *VALIDATION_LAYERS[] = {
-    "VK_LAYER_KHRONOS_validation",
-};
-
-static const char *EXTENSIONS[] = {
-    VK_EXT_DEBUG_UTILS_EXTENSION_NAME
-};
-
-static const uint32_t IMAGE_WIDTH = 1920;
-static const uint32_t IMAGE_HEIGHT = 1080;
-
-static VKAPI_ATTR VkBool32 debug_callback(
-    VkDebugUtilsMessageSeverityFlagBitsEXT           messageSeverity,
-    VkDebugUtilsMessageTypeFlagsEXT                  messageTypes,
-    const VkDebugUtilsMessengerCallbackDataEXT*      pCallbackData,
-    void*                                            pUserData) {
-
-    // pMessage is NULL if messageTypes is equal to VK_DEBUG_UTILS_MESSAGE_TYPE_DEVICE_ADDRESS_BINDING_BIT_EXT.
-    if(!pCallbackData->pMessage) {
-        return VK_FALSE;
-    }
-
-    switch (messageSeverity) {
-    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
-        fprintf(stderr, "%s\n", pCallbackData->pMessage);
-        break;
-    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
-        fprintf(stderr, "%s\n", pCallbackData->pMessage);
-        break;
-    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
-        fprintf(stderr, "%s\n", pCallbackData->pMessage);
-        break;
-    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
-        fprintf(stderr, "%s\n", pCallbackData->pMessage);
-        break;
-    default:
-        break;
-    }
-
-    return VK_FALSE;
+    double mse = squared_error / (double)(pixel_count * 3);
+    if(mse == 0.0) {
+        return INFINITY;
+    }
+
+    return 10.0 * log10(255.0 * 255.0 / mse);
 }
 
-static VkInstance create_instance(const VkDebugUtilsMessengerCreateInfoEXT *debug_info) {
-    const VkApplicationInfo app_info = {
-        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-        .apiVersion = VK_API_VERSION_1_0,
-        .applicationVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
-        .pApplicationName = NULL,
-        .engineVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
-        .pEngineName = NULL,
-    };
+// Renders a reference at the requested sample count, then compares low sample counts with and without denoising against it.
+static bool benchmark_denoiser(renderer *r, const render_settings *settings) {
+    const uint32_t sample_counts[] = { 16, 32, 64 };
+    size_t pixel_count = (size_t)renderer_width(r) * renderer_height(r);
+
+    uint8_t *reference = malloc(pixel_count * 4);
+    uint8_t *pixels = malloc(pixel_count * 4);
+    if(!reference || !pixels) {
+        fprintf(stderr, "Failed to allocate the benchmark images\n");
+        free(reference);
+        free(pixels);
+        return false;
+    }
 
-    const VkInstanceCreateInfo instance_info = {
-        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-        .pNext = debug_info,
-        .pApplicationInfo = &app_info,
-        .ppEnabledLayerNames = VALIDATION_LAYERS,
-        .enabledLayerCount = ARRAY_LENGTH(VALIDATION_LAYERS),
-        .ppEnabledExtensionNames = EXTENSIONS,
-        .enabledExtensionCount = ARRAY_LENGTH(EXTENSIONS),
-    };
+    render_settings reference_settings = *settings;
+    reference_settings.denoise = false;
 
-    VkInstance instance;
-    VkResult result = vkCreateInstance(&instance_info, NULL, &instance);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create instance: %s\n", string_VkResult(result));
-        return NULL;
+    render_stats reference_stats;
+    if(renderer_render(r, &reference_settings, NULL, &reference_stats) != RENDERER_SUCCESS) {
+        free(reference);
+        free(pixels);
+        return false;
     }
 
-    return instance;
-}
-
-static VkDebugUtilsMessengerEXT create_messenger(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT *debug_info) {
-    VkDebugUtilsMessengerEXT messenger;
-    VkResult result = vkCreateDebugUtilsMessengerEXT(instance, debug_info, NULL, &messenger);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create debug utils messenger: %s\n", string_VkResult(result));
-        return NULL;
+    renderer_readback(r, reference);
+    printf("Reference: %u spp in %.1f ms\n", settings->samples_per_pixel, reference_stats.time * 1000.0);
+    printf("%6s %10s %12s %10s\n", "spp", "denoised", "time (ms)", "PSNR (dB)");
+
+    for(uint32_t i = 0; i < ARRAY_LENGTH(sample_counts); i++) {
+        for(int denoise = 0; denoise <= 1; denoise++) {
+            render_settings benchmark_settings = *settings;
+            benchmark_settings.samples_per_pixel = sample_counts[i];
+            benchmark_settings.denoise = denoise;
+
+            render_stats stats;
+            if(renderer_render(r, &benchmark_settings, NULL, &stats) != RENDERER_SUCCESS) {
+                free(reference);
+                free(pixels);
+                return false;
+            }
+
+            renderer_readback(r, pixels);
+            printf("%6u %10s %12.1f %10.2f\n", sample_counts[i], denoise ? "yes" : "no", stats.time * 1000.0, compute_psnr(pixels, reference, pixel_count));
+        }
     }
 
-    return messenger;
+    free(reference);
+    free(pixels);
+    return true;
 }
 
-static int rate_physical_device(VkPhysicalDevice physical_device) {
-    VkPhysicalDeviceProperties properties;
-    vkGetPhysicalDeviceProperties(physical_device, &properties);
+// Renders the same image with full and half precision images and compares their memory, traffic, time and PSNR.
+static bool benchmark_precision(const renderer_create_info *create_info, const render_settings *settings) {
+    const render_precision precisions[] = { RENDER_PRECISION_FULL, RENDER_PRECISION_HALF };
+    const char *names[] = { "rgba32f", "rgba16f" };
+
+    uint8_t *reference = NULL;
+    uint8_t *pixels = NULL;
+    bool success = true;
+
+    printf("%10s %12s %16s %12s %10s\n", "format", "images (MiB)", "per pass (MiB)", "time (ms)", "PSNR (dB)");
+    for(uint32_t i = 0; i < ARRAY_LENGTH(precisions) && success; i++) {
+        renderer_create_info info = *create_info;
+        info.precision = precisions[i];
+
+        renderer *r;
+        renderer_result result = renderer_create(&info, &r);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Cannot create a %s renderer: %s\n", names[i], renderer_result_string(result));
+            success = false;
+            break;
+        }
 
-    int score = 0;
+        size_t pixel_count = (size_t)renderer_width(r) * renderer_height(r);
+        if(!reference) {
+            reference = malloc(pixel_count * 4);
+            pixels = malloc(pixel_count * 4);
+            if(!reference || !pixels) {
+                fprintf(stderr, "Failed to allocate the benchmark images\n");
+                renderer_destroy(r);
+                success = false;
+                break;
+            }
+        }
 
-    if(properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-        score += 100;
+        render_stats stats;
+        result = renderer_render(r, settings, NULL, &stats);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Rendering failed: %s\n", renderer_result_string(result));
+            renderer_destroy(r);
+            success = false;
+            break;
+        }
+
+        // Full precision comes first and serves as the reference.
+        renderer_readback(r, i == 0 ? reference : pixels);
+
+        renderer_memory_info memory;
+        renderer_get_memory_info(r, &memory);
+        double psnr = i == 0 ? INFINITY : compute_psnr(pixels, reference, pixel_count);
+        printf("%10s %12.1f %16.1f %12.1f %10.2f\n", names[i],
+            memory.image_bytes / (1024.0 * 1024.0), memory.trace_pass_bytes / (1024.0 * 1024.0), stats.time * 1000.0, psnr);
+
+        renderer_destroy(r);
     }
 
-    return score;
+    free(reference);
+    free(pixels);
+    return success;
 }
 
-static VkPhysicalDevice find_physical_device(VkInstance instance) {
-    uint32_t physical_device_count;
-    vkEnumeratePhysicalDevices(instance, &physical_device_count, NULL);
+// Builds the scene's BVHs with each builder and renders the same image with them. The SAH cost predicts what the
+// trace time then shows, the host builders spend build time on lower costs, the GPU builder the other way around.
+static bool benchmark_bvh_builders(const renderer_create_info *create_info, const render_settings *settings) {
+    const blas_builder builders[] = { BLAS_BUILDER_MEDIAN, BLAS_BUILDER_SAH, BLAS_BUILDER_SAH, BLAS_BUILDER_GPU };
+    const uint32_t thread_counts[] = { 0, 1, 0, 0 };
+    const char *names[] = { "median", "sah 1 thread", "sah threaded", "gpu lbvh" };
+
+    printf("%14s %12s %10s %10s %12s %10s %18s\n", "builder", "build (ms)", "BLAS SAH", "TLAS SAH", "time (ms)", "Mrays/s", "prim tests/ray");
+    for(uint32_t i = 0; i < ARRAY_LENGTH(builders); i++) {
+        renderer_create_info info = *create_info;
+        info.blas_builder = builders[i];
+        info.bvh_thread_count = thread_counts[i];
+
+        renderer *r;
+        renderer_result result = renderer_create(&info, &r);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Cannot create a renderer with the %s builder: %s\n", names[i], renderer_result_string(result));
+            return false;
+        }
 
-    VkPhysicalDevice *physical_devices = malloc(sizeof(VkPhysicalDevice) * physical_device_count);
-    vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices);
+        render_stats stats;
+        result = renderer_render(r, settings, NULL, &stats);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Rendering failed: %s\n", renderer_result_string(result));
+            renderer_destroy(r);
+            return false;
+        }
 
-    int highest_score = INT_MIN;
-    VkPhysicalDevice best_physical_device = NULL;
-    for(uint32_t i = 0; i < physical_device_count; i++) {
-        VkPhysicalDevice physical_device = physical_devices[i];
-        int score = rate_physical_device(physical_device);
-        if(score > highest_score) {
-            highest_score = score;
-            best_physical_device = physical_device;
+        renderer_build_info build;
+        result = renderer_get_build_info(r, &build);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Reading the BVHs back failed: %s\n", renderer_result_string(result));
+            renderer_destroy(r);
+            return false;
         }
+
+        double rays = (double)stats.rays;
+        printf("%14s %12.1f %10.2f %10.2f %12.1f %10.1f %18.2f\n", names[i], build.time * 1000.0, build.blas_sah_cost, build.tlas_sah_cost,
+            stats.time * 1000.0, stats.time > 0.0 ? rays / stats.time * 1e-6 : 0.0, rays > 0.0 ? stats.primitive_tests / rays : 0.0);
+
+        renderer_destroy(r);
+    }
+
+    return true;
+}
+
+// Renders the same image in each pixel order. The cache hit rates themselves need a vendor profiler, the ray
+// throughput is what they show up as here.
+static bool benchmark_pixel_order(renderer *r, const render_settings *settings) {
+    const pixel_order orders[] = { PIXEL_ORDER_LINEAR, PIXEL_ORDER_MORTON, PIXEL_ORDER_HILBERT };
+    const char *names[] = { "linear", "morton", "hilbert" };
+
+    printf("%8s %12s %10s %18s\n", "order", "time (ms)", "Mrays/s", "prim tests/ray");
+    for(uint32_t i = 0; i < ARRAY_LENGTH(orders); i++) {
+        render_settings benchmark_settings = *settings;
+        benchmark_settings.pixel_order = orders[i];
+
+        render_stats stats;
+        renderer_result result = renderer_render(r, &benchmark_settings, NULL, &stats);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Rendering failed: %s\n", renderer_result_string(result));
+            return false;
+        }
+
+        double rays = (double)stats.rays;
+        printf("%8s %12.1f %10.1f %18.2f\n", names[i], stats.time * 1000.0,
+            stats.time > 0.0 ? rays / stats.time * 1e-6 : 0.0, rays > 0.0 ? stats.primitive_tests / rays : 0.0);
     }
 
-    free(physical_devices);
-    return best_physical_device;
+    return true;
 }
 
-static uint32_t find_compute_family(VkPhysicalDevice physical_device) {
-    uint32_t property_count;
-    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &property_count, NULL);
+// Renders the same image with the unsorted and sorted wavefront and with the megakernel, for the scene from the command
+// line and then for instance grids of growing size. Sorting pays off once the time saved by coherent rays exceeds the
+// count, scan and scatter dispatches added to every bounce, which takes a scene large enough for incoherent rays to
+// miss the caches. The last column is the unsorted wavefront's time over each mode's.
+static bool benchmark_ray_sorting(const renderer_create_info *create_info, const char *scene_name, const render_settings *settings) {
+    const uint32_t grid_sides[] = { 8, 32, 128 };
+    const trace_mode modes[] = { TRACE_MODE_WAVEFRONT, TRACE_MODE_WAVEFRONT_SORTED, TRACE_MODE_MEGAKERNEL };
+    const char *names[] = { "wavefront", "sorted", "megakernel" };
+
+    printf("%18s %10s %12s %12s %10s %18s %10s\n", "scene", "instances", "mode", "time (ms)", "Mrays/s", "prim tests/ray", "speedup");
+    for(uint32_t i = 0; i <= ARRAY_LENGTH(grid_sides); i++) {
+        renderer_create_info info = *create_info;
+        scene grid = {0};
+        char label[64];
+        if(i == 0) {
+            snprintf(label, sizeof(label), "%s", scene_name);
+        } else {
+            if(!scene_create_instance_grid(grid_sides[i - 1], 0.0f, &grid)) {
+                fprintf(stderr, "Failed to create a grid of %u x %u instances\n", grid_sides[i - 1], grid_sides[i - 1]);
+                return false;
+            }
+
+            snprintf(label, sizeof(label), "grid %ux%u", grid_sides[i - 1], grid_sides[i - 1]);
+            info.scene = &grid;
+            info.scene_file = NULL;
+        }
+
+        uint32_t instance_count = info.scene_file ? info.scene_file->scene.instance_count : info.scene->instance_count;
 
-    VkQueueFamilyProperties *properties = malloc(sizeof(VkQueueFamilyProperties) * property_count);
-    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &property_count, properties);
+        renderer *r;
+        renderer_result result = renderer_create(&info, &r);
+        scene_free(&grid);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Cannot create a renderer for %s: %s\n", label, renderer_result_string(result));
+            return false;
+        }
 
-    for(uint32_t i = 0; i < property_count; i++) {
-        VkQueueFamilyProperties queue = properties[i];
-        if(queue.queueFlags & VK_QUEUE_COMPUTE_BIT) {
-            free(properties);
-            return i;
+        double wavefront_time = 0.0;
+        for(uint32_t j = 0; j < ARRAY_LENGTH(modes); j++) {
+            render_settings benchmark_settings = *settings;
+            benchmark_settings.trace_mode = modes[j];
+
+            render_stats stats;
+            result = renderer_render(r, &benchmark_settings, NULL, &stats);
+            if(result != RENDERER_SUCCESS) {
+                fprintf(stderr, "Rendering failed: %s\n", renderer_result_string(result));
+                renderer_destroy(r);
+                return false;
+            }
+
+            if(j == 0) {
+                wavefront_time = stats.time;
+            }
+
+            double rays = (double)stats.rays;
+            printf("%18s %10u %12s %12.1f %10.1f %18.2f %10.2f\n", label, instance_count, names[j], stats.time * 1000.0,
+                stats.time > 0.0 ? rays / stats.time * 1e-6 : 0.0, rays > 0.0 ? stats.primitive_tests / rays : 0.0,
+                stats.time > 0.0 ? wavefront_time / stats.time : 0.0);
         }
+
+        renderer_destroy(r);
     }
 
-    // All Vulkan implementations are required to support compute, so this code should be unreachable.
-    free(properties);
-    fprintf(stderr, "Error: No compute queue family found!\n");
-    exit(EXIT_FAILURE);
+    return true;
 }
 
-static VkDevice create_device(VkPhysicalDevice physical_device, uint32_t compute_queue) {
-    const float queue_priorities = 1.0f;
-    const VkDeviceQueueCreateInfo queue_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueCount = 1,
-        .queueFamilyIndex = compute_queue,
-        .pQueuePriorities = &queue_priorities,
-    };
+static bool write_aovs(renderer *r) {
+    uint32_t width = renderer_width(r);
+    uint32_t height = renderer_height(r);
+    size_t pixel_count = (size_t)width * height;
+
+    float *albedo = malloc(pixel_count * 3 * sizeof(float));
+    float *normal = malloc(pixel_count * 3 * sizeof(float));
+    float *depth = malloc(pixel_count * sizeof(float));
+    float *hit_id = malloc(pixel_count * sizeof(float));
+
+    bool written =
+        renderer_readback_aovs(r, albedo, normal, depth, hit_id) == RENDERER_SUCCESS &&
+        write_pfm("albedo.pfm", width, height, 3, albedo) &&
+        write_pfm("normal.pfm", width, height, 3, normal) &&
+        write_pfm("depth.pfm", width, height, 1, depth) &&
+        write_pfm("hit_id.pfm", width, height, 1, hit_id);
+
+    free(hit_id);
+    free(depth);
+    free(normal);
+    free(albedo);
+    return written;
+}
 
-    const VkDeviceCreateInfo device_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .ppEnabledLayerNames = VALIDATION_LAYERS,
-        .enabledLayerCount = ARRAY_LENGTH(VALIDATION_LAYERS),
-        .pQueueCreateInfos = &queue_create_info,
-        .queueCreateInfoCount = 1,
-    };
-    
-    VkDevice device;
-    VkResult result = vkCreateDevice(physical_device, &device_info, NULL, &device);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create device : %s\n", string_VkResult(result));
-        return NULL;
-    }
+// The costs per sample in the channels of one PFM: rays, BVH tests and shader clock cycles.
+static bool write_costs(renderer *r) {
+    uint32_t width = renderer_width(r);
+    uint32_t height = renderer_height(r);
+
+    float *costs = malloc((size_t)width * height * 3 * sizeof(float));
+    bool written =
+        costs &&
+        renderer_readback_costs(r, costs) == RENDERER_SUCCESS &&
+        write_pfm("costs.pfm", width, height, 3, costs);
 
-    return device;
+    free(costs);
+    return written;
 }
 
-static uint32_t find_memory_type(VkPhysicalDevice physical_device, uint32_t type_filter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memory_properties;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+typedef struct png_buffer {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+} png_buffer;
 
-    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
-        if ((type_filter & (1 << i)) && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
+static void append_png(void *context, void *data, int size) {
+    png_buffer *buffer = context;
+
+    // A failed allocation leaves data NULL with a non-zero capacity, the remaining chunks are dropped.
+    if(!buffer->data && buffer->capacity > 0) {
+        return;
     }
 
-    fprintf(stderr, "Failed to find suitable memory type\n");
-    exit(EXIT_FAILURE);
-}
+    if(buffer->len + (size_t)size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 1 << 20;
+        while(capacity < buffer->len + (size_t)size) {
+            capacity *= 2;
+        }
 
-static VkImage create_image(VkDevice device) {
-    const VkImageCreateInfo image_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .format = VK_FORMAT_R8G8B8A8_UNORM,
-        .extent.width = IMAGE_WIDTH,
-        .extent.height = IMAGE_HEIGHT,
-        .extent.depth = 1,
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-    };
+        uint8_t *grown = realloc(buffer->data, capacity);
+        if(!grown) {
+            free(buffer->data);
+            buffer->data = NULL;
+            return;
+        }
 
-    VkImage image;
-    VkResult result = vkCreateImage(device, &image_info, NULL, &image);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create image: %s\n", string_VkResult(result));
-        return NULL;
+        buffer->data = grown;
+        buffer->capacity = capacity;
     }
 
-    return image;
+    memcpy(buffer->data + buffer->len, data, (size_t)size);
+    buffer->len += (size_t)size;
 }
 
-static VkImageView create_image_view(VkDevice device, VkImage image) {
-    const VkImageViewCreateInfo image_view_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = image,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = VK_FORMAT_R8G8B8A8_UNORM,
-        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .subresourceRange.baseMipLevel = 0,
-        .subresourceRange.levelCount = 1,
-        .subresourceRange.baseArrayLayer = 0,
-        .subresourceRange.layerCount = 1,
-    };
+static const char *timeline_path = NULL;
 
-    VkImageView image_view;
-    VkResult result = vkCreateImageView(device, &image_view_info, NULL, &image_view);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create image view: %s\n", string_VkResult(result));
-        return NULL;
+// Runs at exit, so the early returns of main still write the timeline up to the failure.
+static void finish_timeline(void) {
+    if(timeline_finish()) {
+        printf("Timeline saved as %s\n", timeline_path);
     }
-    
-    return image_view;
 }
 
-static VkDeviceMemory allocate_image(VkPhysicalDevice physical_device, VkDevice device, VkImage image) {
-    VkMemoryRequirements memory_requirements;
-    vkGetImageMemoryRequirements(device, image, &memory_requirements);
+// Writes the 8-bit output and records how it was rendered in tEXt chunks.
+static bool write_output_png(const char *filename, uint32_t width, uint32_t height, const uint8_t *pixels, const render_stats *stats) {
+    png_buffer png = {0};
+    if(!stbi_write_png_to_func(append_png, &png, width, height, 4, pixels, width * 4) || !png.data) {
+        free(png.data);
+        return false;
+    }
+
+    // The achieved sample count is only known after rendering when a time budget is set.
+    char samples_text[16];
+    char time_text[32];
+    snprintf(samples_text, sizeof(samples_text), "%u", stats->samples_per_pixel);
+    snprintf(time_text, sizeof(time_text), "%.3f", stats->time);
 
-    const VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memory_requirements.size,
-        .memoryTypeIndex = find_memory_type(physical_device, memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    const png_text metadata[] = {
+        { "SamplesPerPixel", samples_text },
+        { "RenderTime", time_text },
     };
 
-    VkDeviceMemory image_memory;
-    VkResult result = vkAllocateMemory(device, &alloc_info, NULL, &image_memory);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to allocate memory for image: %s\n", string_VkResult(result));
-        return NULL;
+    bool written = png_write_with_text(filename, png.data, png.len, metadata, ARRAY_LENGTH(metadata));
+    free(png.data);
+    return written;
+}
+
+// Builds the BVHs of a builtin scene on the host and writes them with it, for --scene-file to load without building.
+static bool write_scene_file(const char *scene_name, blas_builder builder, uint32_t thread_count, const char *filename) {
+    if(builder == BLAS_BUILDER_GPU) {
+        fprintf(stderr, "Scene files need BVHs built on the host, use --bvh-builder sah or median\n");
+        return false;
     }
 
-    VkResult bind_result = vkBindImageMemory(device, image, image_memory, 0);
-    if(bind_result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to bind image memory: %s\n", string_VkResult(bind_result));
-        return NULL;
+    scene s;
+    if(!scene_create_builtin(scene_name, 0.0f, &s)) {
+        return false;
     }
 
-    return image_memory;
-}
+    scene_tables tables;
+    double start = get_time();
+    bool written = scene_build_tables(&s, builder, thread_count, &tables);
+    double build_time = get_time() - start;
+    if(written) {
+        written = scene_file_write(filename, &s, &tables);
+        scene_tables_free(&tables);
+    }
 
-static VkDescriptorSetLayout create_descriptor_set_layout(VkDevice device) {
-    const VkDescriptorSetLayoutBinding image_layout_binding = {
-        .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .descriptorCount = 1,
-        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-    };
+    if(written) {
+        printf("Wrote %s to %s, BVHs built in %.2f ms\n", scene_name, filename, build_time * 1000.0);
+    }
 
-    const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = 1,
-        .pBindings = &image_layout_binding
-    };
+    scene_free(&s);
+    return written;
+}
 
-    VkDescriptorSetLayout descriptor_set_layout;
-    VkResult result = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_info, NULL, &descriptor_set_layout);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create descriptor set layout: %s\n", string_VkResult(result));
-        return NULL;
+static void print_usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --spp <n>                 Samples per pixel (default 1000)\n");
+    printf("  --samples-per-pass <n>    Samples traced per dispatch (default 50)\n");
+    printf("  --exposure <stops>        Exposure adjustment applied before tonemapping (default 0)\n");
+    printf("  --tonemap <name>          aces, reinhard or none (default aces)\n");
+    printf("  --denoise                 Run the edge-avoiding a-trous denoiser before resolving\n");
+    printf("  --denoise-iterations <n>  Number of a-trous iterations (default 5)\n");
+    printf("  --benchmark-denoise       Compare time and PSNR of 16-64 spp renders with and without denoising\n");
+    printf("  --precision <name>        full (rgba32f) or half (rgba16f) accumulation and guide images (default full)\n");
+    printf("  --benchmark-precision     Compare memory, traffic, time and PSNR of full and half precision images\n");
+    printf("  --no-subgroups            Trace without subgroup operations, even where the device supports them\n");
+    printf("  --pixel-order <name>      linear, morton or hilbert order of pixels within and across tiles (default linear)\n");
+    printf("  --benchmark-pixel-order   Compare time and ray throughput of each pixel order\n");
+    printf("  --scene <name>            Builtin scene to render, spheres, shapes, instances or textures (default spheres)\n");
+    printf("  --scene-file <file>       Render a scene file, with the BVHs it was written with\n");
+    printf("  --write-scene-file <file> Write --scene with BVHs built by --bvh-builder to a scene file and exit\n");
+    printf("  --trace-mode <name>       megakernel, wavefront or sorted (wavefront with rays binned between bounces)\n");
+    printf("  --benchmark-ray-sorting   Compare time and ray throughput of the megakernel and the unsorted and sorted wavefront,\n");
+    printf("                            for the scene and for instance grids of growing size\n");
+    printf("  --aov                     Also write albedo, normal, depth and hit ID images as PFM files\n");
+    printf("  --cost-view <name>        Render a heatmap of the rays, BVH tests or clock cycles per pixel instead, bounces,\n");
+    printf("                            tests or cycles, and write the costs to costs.pfm unless rendering in bands\n");
+    printf("  --timeline <file>         Write host zones and GPU ranges to this file as Chrome trace JSON for Perfetto\n");
+    printf("  --checkpoint <file>       Periodically save the accumulated samples to this file\n");
+    printf("  --checkpoint-interval <n> Sample passes between checkpoints (default 4)\n");
+    printf("  --resume                  Continue from the file given to --checkpoint\n");
+    printf("  --time-budget <seconds>   Stop sampling at the last pass that fits in this time, --spp becomes a maximum\n");
+    printf("  --width <n>               Image width in pixels (default 1920)\n");
+    printf("  --height <n>              Image height in pixels (default 1080)\n");
+    printf("  --band-height <rows>      Render and write the image in bands of this many rows to bound memory use\n");
+    printf("  --camera <px,py,pz,tx,ty,tz[,fov]>  Camera position, target and vertical field of view in degrees\n");
+    printf("  --camera-path <file>      Keyframes of \"time px py pz tx ty tz fov\" to render as a sequence\n");
+    printf("  --frames <n>              Frames sampled evenly over the camera path (default 2 per keyframe)\n");
+    printf("  --animate                 Move the scene along the camera path's time, refitting its BVHs every frame\n");
+    printf("  --bvh-builder <name>      sah, median or gpu (linear BVHs built by compute passes) (default sah)\n");
+    printf("  --bvh-threads <n>         Host threads building BVHs (default one per core)\n");
+    printf("  --benchmark-bvh           Compare build time, SAH cost and trace time of each BVH builder\n");
+    printf("  --report-memory           Print the chosen memory types and the achieved readback bandwidth\n");
+    printf("  --serve <socket>          Keep the renderer warm and take jobs over a Unix domain socket\n");
+    printf("  --help                    Show this message\n");
+}
+
+static bool parse_tonemap(const char *name, tonemap_operator *tonemap) {
+    if(strcmp(name, "aces") == 0) {
+        *tonemap = TONEMAP_ACES;
+    }
+    else if(strcmp(name, "reinhard") == 0) {
+        *tonemap = TONEMAP_REINHARD;
+    }
+    else if(strcmp(name, "none") == 0) {
+        *tonemap = TONEMAP_NONE;
+    }
+    else {
+        return false;
     }
 
-    return descriptor_set_layout;
+    return true;
 }
 
-static VkPipelineLayout create_pipeline_layout(VkDevice device, VkDescriptorSetLayout descriptor_layout) {
-    const VkPipelineLayoutCreateInfo pipeline_layout_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &descriptor_layout,
-    };
+// Applies the overrides of a job on top of the settings given on the command line.
+static bool get_job_settings(const server_job *job, const char *scene_name, const render_settings *defaults, render_settings *settings, const char **error) {
+    *settings = *defaults;
 
-    VkPipelineLayout pipeline_layout;
-    VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_info, NULL, &pipeline_layout);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create pipeline layout: %s\n", string_VkResult(result));
-        return NULL;
+    // The scene is fixed when the renderer is created, jobs can only name it or "default".
+    if(job->scene[0] && strcmp(job->scene, "default") != 0 && strcmp(job->scene, scene_name) != 0) {
+        *error = "the scene is fixed when the server starts, name it or default";
+        return false;
     }
 
-    return pipeline_layout;
-}
+    if(job->camera[0] && strcmp(job->camera, "default") != 0 && !camera_parse(job->camera, &settings->camera)) {
+        *error = "expected camera=px,py,pz,tx,ty,tz[,fov]";
+        return false;
+    }
 
-static VkDescriptorPool create_descriptor_pool(VkDevice device) {
-    const VkDescriptorPoolSize pool_size = {
-        .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .descriptorCount = 1,
-    };
+    if(job->samples_per_pixel) {
+        settings->samples_per_pixel = job->samples_per_pixel;
+    }
 
-    const VkDescriptorPoolCreateInfo pool_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .poolSizeCount = 1,
-        .pPoolSizes = &pool_size,
-        .maxSets = 1
-    };
+    if(job->samples_per_pass) {
+        settings->samples_per_pass = job->samples_per_pass;
+    }
 
-    VkDescriptorPool descriptor_pool;
-    VkResult result = vkCreateDescriptorPool(device, &pool_info, NULL, &descriptor_pool);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create descriptor pool: %s\n", string_VkResult(result));
-        return NULL;
+    if(job->has_exposure) {
+        settings->exposure = job->exposure;
     }
 
-    return descriptor_pool;
-}
+    if(job->tonemap[0] && !parse_tonemap(job->tonemap, &settings->tonemap)) {
+        *error = "unknown tonemap operator";
+        return false;
+    }
 
-static VkDescriptorSet create_descriptor_set(VkDevice device, VkDescriptorPool descriptor_pool, VkDescriptorSetLayout layout) {
-    const VkDescriptorSetAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = descriptor_pool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &layout,
-    };
+    if(job->denoise >= 0) {
+        settings->denoise = job->denoise;
+    }
+
+    if(job->denoise_iterations) {
+        settings->denoise_iterations = job->denoise_iterations;
+    }
 
-    VkDescriptorSet descriptor_set;
-    VkResult result = vkAllocateDescriptorSets(device, &alloc_info, &descriptor_set);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create descriptor set: %s\n", string_VkResult(result));
-        return NULL;
+    if(job->time_budget > 0.0) {
+        settings->time_budget = job->time_budget;
     }
 
-    return descriptor_set;
+    return true;
 }
 
-static VkCommandPool create_command_pool(VkDevice device, uint32_t compute_queue_index) {
-    const VkCommandPoolCreateInfo command_pool_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .queueFamilyIndex = compute_queue_index,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-    };
+// Serves render jobs until a client asks for a shutdown. Everything but the images' contents stays alive between jobs.
+static bool run_server(renderer *r, const char *scene_name, const render_settings *defaults, const char *socket_path) {
+    uint32_t width = renderer_width(r);
+    uint32_t height = renderer_height(r);
+    uint8_t *pixels = malloc((size_t)width * height * 4);
+    if(!pixels) {
+        fprintf(stderr, "Failed to allocate the output pixels\n");
+        return false;
+    }
 
-    VkCommandPool command_pool;
-    VkResult result = vkCreateCommandPool(device, &command_pool_info, NULL, &command_pool);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create command pool: %s\n", string_VkResult(result));
-        return NULL;
+    server server;
+    if(!server_start(&server, socket_path)) {
+        free(pixels);
+        return false;
     }
 
-    return command_pool;
-}
+    printf("Listening on %s\n", socket_path);
 
-static VkCommandBuffer create_command_buffer(VkDevice device, VkCommandPool command_pool) {
-    const VkCommandBufferAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = command_pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    };
+    bool device_lost = false;
+
+    server_job *job;
+    while((job = server_wait_job(&server))) {
+        render_settings settings;
+        const char *error = NULL;
+        if(!get_job_settings(job, scene_name, defaults, &settings, &error)) {
+            server_reply_error(job, error);
+            continue;
+        }
+
+        // Jobs for the same view build on each other's samples, a time budget keeps refining the image.
+        settings.accumulate = true;
+
+        render_stats stats;
+        renderer_result result = renderer_render(r, &settings, NULL, &stats);
+        if(result == RENDERER_SUCCESS) {
+            result = renderer_readback(r, pixels);
+        }
+
+        if(result != RENDERER_SUCCESS) {
+            server_reply_error(job, renderer_result_string(result));
 
-    VkCommandBuffer buffer;
-    VkResult result = vkAllocateCommandBuffers(device, &alloc_info, &buffer);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create command buffer: %s\n", string_VkResult(result));
-        return NULL;
+            // Anything but a bad request leaves the device in an unknown state.
+            if(result != RENDERER_ERROR_INVALID_ARGUMENT) {
+                device_lost = true;
+                break;
+            }
+            continue;
+        }
+
+        if(job->output[0]) {
+            if(write_output_png(job->output, width, height, pixels, &stats)) {
+                server_reply_path(job, stats.samples_per_pixel, stats.time, job->output);
+            } else {
+                server_reply_error(job, "failed to write the image");
+            }
+            continue;
+        }
+
+        png_buffer png = {0};
+        if(!stbi_write_png_to_func(append_png, &png, width, height, 4, pixels, width * 4) || !png.data) {
+            server_reply_error(job, "failed to encode the image");
+        } else {
+            server_reply_bytes(job, stats.samples_per_pixel, stats.time, png.data, png.len);
+        }
+
+        free(png.data);
     }
 
-    return buffer;
+    free(pixels);
+    server_stop(&server);
+    return !device_lost;
 }
 
-static VkPipeline create_compute_pipeline(VkDevice device, VkPipelineLayout pipeline_layout, VkShaderModule shader) {
-    const VkPipelineShaderStageCreateInfo compute_shader_stage = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
-        .module = shader,
-        .pName = "main"
-    };
+// Everything the trace shader counted, and the averages per ray and per path that follow from it.
+static void print_ray_stats(const render_stats *stats, uint64_t pixel_count) {
+    uint64_t paths = stats->escaped_paths + stats->bounce_limited_paths;
+    double rays = stats->rays ? (double)stats->rays : 1.0;
+    double path_total = paths ? (double)paths : 1.0;
+    printf("Traced %llu rays in %llu paths (%.1f Mrays/s), %.2f rays per path\n",
+        (unsigned long long)stats->rays, (unsigned long long)paths, stats->time > 0.0 ? stats->rays / stats->time * 1e-6 : 0.0, stats->rays / path_total);
+    printf("  %llu hits and %llu misses, %.2f%% of paths left the scene and %.2f%% reached the bounce limit\n",
+        (unsigned long long)stats->hits, (unsigned long long)(stats->rays - stats->hits),
+        100.0 * stats->escaped_paths / path_total, 100.0 * stats->bounce_limited_paths / path_total);
+    printf("  %.2f node and %.2f primitive tests per ray, %.2f%% of pixels changed by more than 1%% in the last pass\n",
+        stats->node_tests / rays, stats->primitive_tests / rays, 100.0 * stats->unconverged_pixels / (double)pixel_count);
+    if(stats->shader_cycles) {
+        printf("  %.0f shader clock cycles per ray\n", stats->shader_cycles / rays);
+    }
+}
 
-    const VkComputePipelineCreateInfo compute_pipeline_info = {
-        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-        .layout = pipeline_layout,
-        .stage = compute_shader_stage,
-    };
-    
-    VkPipeline pipeline;
-    VkResult result = vkCreateComputePipelines(device, NULL, 1, &compute_pipeline_info, NULL, &pipeline);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create compute pipeline: %s\n", string_VkResult(result));
-        return NULL;
+// Renders one band at a time and streams its rows into the PNG, so neither the device nor the host ever holds the whole image.
+static bool render_bands(renderer *r, const render_settings *settings, const char *filename) {
+    uint32_t width = renderer_width(r);
+    uint32_t height = renderer_height(r);
+    uint32_t band_height = renderer_band_height(r);
+    uint32_t band_count = renderer_band_count(r);
+
+    uint8_t *pixels = malloc((size_t)width * band_height * 4);
+    if(!pixels) {
+        fprintf(stderr, "Failed to allocate the band pixels\n");
+        return false;
     }
 
-    return pipeline;
-}
+    png_stream stream;
+    if(!png_stream_begin(&stream, filename, width, height)) {
+        free(pixels);
+        return false;
+    }
 
-static VkBuffer create_staging_buffer(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize size, VkDeviceMemory *buffer_memory) {
-    const VkBufferCreateInfo buffer_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
+    render_stats total = {0};
+    bool success = true;
+    for(uint32_t band = 0; band < band_count && success; band++) {
+        render_stats stats;
+        renderer_result result = renderer_render_band(r, settings, band, &stats);
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Rendering band %u failed: %s\n", band, renderer_result_string(result));
+            success = false;
+            break;
+        }
+
+        uint32_t rows = height - band * band_height < band_height ? height - band * band_height : band_height;
+        TIMELINE_ZONE("renderer_readback") {
+            renderer_readback(r, pixels);
+        }
 
-    VkBuffer staging_buffer;
-    VkResult result = vkCreateBuffer(device, &buffer_info, NULL, &staging_buffer);
-    if(result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create staging buffer: %s\n", string_VkResult(result));
-        return NULL;
+        TIMELINE_ZONE("png_stream_write_rows") {
+            success = png_stream_write_rows(&stream, pixels, rows);
+        }
+
+        total.time += stats.time;
+        total.samples_per_pixel = stats.samples_per_pixel;
+        total.rays += stats.rays;
+        total.primitive_tests += stats.primitive_tests;
+        total.hits += stats.hits;
+        total.node_tests += stats.node_tests;
+        total.escaped_paths += stats.escaped_paths;
+        total.bounce_limited_paths += stats.bounce_limited_paths;
+        total.unconverged_pixels += stats.unconverged_pixels;
+        total.shader_cycles += stats.shader_cycles;
+        printf("Band %u/%u rendered in %.1f ms\n", band + 1, band_count, stats.time * 1000.0);
     }
 
-    VkMemoryRequirements memory_requirements;
-    vkGetBufferMemoryRequirements(device, staging_buffer, &memory_requirements);
-    
-    const VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memory_requirements.size,
-        .memoryTypeIndex = find_memory_type(physical_device, memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+    char samples_text[16];
+    char time_text[32];
+    snprintf(samples_text, sizeof(samples_text), "%u", total.samples_per_pixel);
+    snprintf(time_text, sizeof(time_text), "%.3f", total.time);
+
+    const png_text metadata[] = {
+        { "SamplesPerPixel", samples_text },
+        { "RenderTime", time_text },
     };
 
-    VkResult alloc_result = vkAllocateMemory(device, &alloc_info, NULL, buffer_memory);
-    if(alloc_result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to allocate memory for staging buffer: %s\n", string_VkResult(alloc_result));
-        return NULL;
+    // Always finish the file, so a failed render does not leave a dangling handle behind.
+    success = png_stream_end(&stream, metadata, ARRAY_LENGTH(metadata)) && success;
+    free(pixels);
+
+    if(success) {
+        printf("Rendered %ux%u in %u bands of %u rows in %.1f ms, saved as %s\n", width, height, band_count, band_height, total.time * 1000.0, filename);
+        print_ray_stats(&total, (uint64_t)width * height);
+    }
+
+    return success;
+}
+
+// Renders the frames of a camera path with one renderer. Only the push constants change between frames, unless the
+// builtin animated_scene is given. That one is posed at each frame's time and the renderer's BVHs are refit to it.
+static bool render_sequence(renderer *r, const render_settings *defaults, const camera_path *path, uint32_t frame_count, const char *animated_scene) {
+    uint32_t width = renderer_width(r);
+    uint32_t height = renderer_height(r);
+    uint8_t *pixels = malloc((size_t)width * height * 4);
+    if(!pixels) {
+        fprintf(stderr, "Failed to allocate the frame pixels\n");
+        return false;
+    }
+
+    float start_time = path->keyframes[0].time;
+    float end_time = path->keyframes[path->keyframe_count - 1].time;
+
+    double sequence_start = get_time();
+    bool success = true;
+    for(uint32_t frame = 0; frame < frame_count; frame++) {
+        float t = frame_count > 1 ? (float)frame / (float)(frame_count - 1) : 0.0f;
+        float time = start_time + (end_time - start_time) * t;
+        render_settings settings = *defaults;
+        settings.camera = camera_path_evaluate(path, time);
+        // Frames where neither the camera nor the scene moved only resolve the samples of the one before again.
+        settings.accumulate = true;
+
+        renderer_result result = RENDERER_SUCCESS;
+        scene_update_stats update = {0};
+        if(animated_scene) {
+            scene frame_scene;
+            if(!scene_create_builtin(animated_scene, time, &frame_scene)) {
+                success = false;
+                break;
+            }
+
+            result = renderer_update_scene(r, &frame_scene, &update);
+            scene_free(&frame_scene);
+        }
+
+        render_stats stats;
+        if(result == RENDERER_SUCCESS) {
+            result = renderer_render(r, &settings, NULL, &stats);
+        }
+
+        if(result != RENDERER_SUCCESS) {
+            fprintf(stderr, "Rendering frame %u failed: %s\n", frame, renderer_result_string(result));
+            success = false;
+            break;
+        }
+
+        renderer_readback(r, pixels);
+
+        char filename[32];
+        snprintf(filename, sizeof(filename), "frame_%04u.png", frame);
+        if(!write_output_png(filename, width, height, pixels, &stats)) {
+            fprintf(stderr, "Failed to save %s\n", filename);
+            success = false;
+            break;
+        }
+
+        printf("Frame %u/%u rendered in %.1f ms at %u spp\n", frame + 1, frame_count, stats.time * 1000.0, stats.samples_per_pixel);
+        if(animated_scene) {
+            printf("  Scene updated in %.2f ms, %u BVHs refit and %u rebuilt, %.1f KiB uploaded in %u ranges\n", update.time * 1000.0,
+                update.refits, update.rebuilds, update.uploaded_bytes / 1024.0, update.uploaded_ranges);
+        }
     }
 
-    vkBindBufferMemory(device, staging_buffer, *buffer_memory, 0);
+    if(success) {
+        printf("Sequence of %u frames completed in %.2f s\n", frame_count, get_time() - sequence_start);
+    }
 
-    return staging_buffer;
+    free(pixels);
+    return success;
 }
 
-int main() {
-    const VkDebugUtilsMessengerCreateInfoEXT debug_info = {
-        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
-        .pfnUserCallback = debug_callback,
-        .messageType = 
-            VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-            VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-            VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
-
-        .messageSeverity = 
-            //VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-            // VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
-            VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-            VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
+int main(int argc, char **argv) {
+    bool report_memory = false;
+    bool benchmark_denoise = false;
+    const char *checkpoint_path = NULL;
+    bool resume = false;
+    const char *socket_path = NULL;
+    const char *camera_path_file = NULL;
+    uint32_t frame_count = 0;
+    uint32_t image_width = 0;
+    uint32_t image_height = 0;
+    uint32_t band_height = 0;
+    render_precision precision = RENDER_PRECISION_FULL;
+    bool benchmark_precisions = false;
+    bool disable_subgroups = false;
+    bool benchmark_pixel_orders = false;
+    bool benchmark_sorting = false;
+    const char *scene_name = "spheres";
+    const char *scene_file_path = NULL;
+    const char *write_scene_path = NULL;
+    bool animate = false;
+    blas_builder builder = BLAS_BUILDER_SAH;
+    uint32_t bvh_thread_count = 0;
+    bool benchmark_builders = false;
+    render_settings settings = {
+        .camera = camera_default(),
+        .samples_per_pixel = 1000,
+        .samples_per_pass = 50,
+        .exposure = 0.0f,
+        .tonemap = TONEMAP_ACES,
+        .denoise = false,
+        .denoise_iterations = 5,
+        .read_aovs = false,
+        .checkpoint_writer = NULL,
+        .checkpoint_interval = 4,
+        .time_budget = 0.0,
+        .pixel_order = PIXEL_ORDER_LINEAR,
+        .trace_mode = TRACE_MODE_MEGAKERNEL,
     };
 
-    VkInstance instance = create_instance(&debug_info);
-    if(!instance) {
-        fprintf(stderr, "Cannot proceed without a valid instance");
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if(strcmp(argv[i], "--report-memory") == 0) {
+            report_memory = true;
+        }
+        else if(strcmp(argv[i], "--spp") == 0 && has_value) {
+            settings.samples_per_pixel = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--samples-per-pass") == 0 && has_value) {
+            settings.samples_per_pass = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--exposure") == 0 && has_value) {
+            settings.exposure = strtof(argv[++i], NULL);
+        }
+        else if(strcmp(argv[i], "--tonemap") == 0 && has_value) {
+            if(!parse_tonemap(argv[++i], &settings.tonemap)) {
+                fprintf(stderr, "Unknown tonemap operator: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--denoise") == 0) {
+            settings.denoise = true;
+        }
+        else if(strcmp(argv[i], "--denoise-iterations") == 0 && has_value) {
+            settings.denoise_iterations = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--benchmark-denoise") == 0) {
+            benchmark_denoise = true;
+        }
+        else if(strcmp(argv[i], "--precision") == 0 && has_value) {
+            i++;
+            if(strcmp(argv[i], "full") == 0) {
+                precision = RENDER_PRECISION_FULL;
+            } else if(strcmp(argv[i], "half") == 0) {
+                precision = RENDER_PRECISION_HALF;
+            } else {
+                fprintf(stderr, "Unknown precision: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--benchmark-precision") == 0) {
+            benchmark_precisions = true;
+        }
+        else if(strcmp(argv[i], "--no-subgroups") == 0) {
+            disable_subgroups = true;
+        }
+        else if(strcmp(argv[i], "--pixel-order") == 0 && has_value) {
+            i++;
+            if(strcmp(argv[i], "linear") == 0) {
+                settings.pixel_order = PIXEL_ORDER_LINEAR;
+            } else if(strcmp(argv[i], "morton") == 0) {
+                settings.pixel_order = PIXEL_ORDER_MORTON;
+            } else if(strcmp(argv[i], "hilbert") == 0) {
+                settings.pixel_order = PIXEL_ORDER_HILBERT;
+            } else {
+                fprintf(stderr, "Unknown pixel order: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--benchmark-pixel-order") == 0) {
+            benchmark_pixel_orders = true;
+        }
+        else if(strcmp(argv[i], "--trace-mode") == 0 && has_value) {
+            i++;
+            if(strcmp(argv[i], "megakernel") == 0) {
+                settings.trace_mode = TRACE_MODE_MEGAKERNEL;
+            } else if(strcmp(argv[i], "wavefront") == 0) {
+                settings.trace_mode = TRACE_MODE_WAVEFRONT;
+            } else if(strcmp(argv[i], "sorted") == 0) {
+                settings.trace_mode = TRACE_MODE_WAVEFRONT_SORTED;
+            } else {
+                fprintf(stderr, "Unknown trace mode: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--cost-view") == 0 && has_value) {
+            i++;
+            if(strcmp(argv[i], "bounces") == 0) {
+                settings.cost_view = COST_VIEW_BOUNCES;
+            } else if(strcmp(argv[i], "tests") == 0) {
+                settings.cost_view = COST_VIEW_TESTS;
+            } else if(strcmp(argv[i], "cycles") == 0) {
+                settings.cost_view = COST_VIEW_CYCLES;
+            } else {
+                fprintf(stderr, "Unknown cost view: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--benchmark-ray-sorting") == 0) {
+            benchmark_sorting = true;
+        }
+        else if(strcmp(argv[i], "--scene") == 0 && has_value) {
+            scene_name = argv[++i];
+        }
+        else if(strcmp(argv[i], "--timeline") == 0 && has_value) {
+            timeline_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--scene-file") == 0 && has_value) {
+            scene_file_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--write-scene-file") == 0 && has_value) {
+            write_scene_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--aov") == 0) {
+            settings.read_aovs = true;
+        }
+        else if(strcmp(argv[i], "--checkpoint") == 0 && has_value) {
+            checkpoint_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--checkpoint-interval") == 0 && has_value) {
+            settings.checkpoint_interval = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        }
+        else if(strcmp(argv[i], "--time-budget") == 0 && has_value) {
+            settings.time_budget = strtod(argv[++i], NULL);
+        }
+        else if(strcmp(argv[i], "--width") == 0 && has_value) {
+            image_width = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--height") == 0 && has_value) {
+            image_height = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--band-height") == 0 && has_value) {
+            band_height = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--camera") == 0 && has_value) {
+            if(!camera_parse(argv[++i], &settings.camera)) {
+                fprintf(stderr, "Expected --camera px,py,pz,tx,ty,tz[,fov], got %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--camera-path") == 0 && has_value) {
+            camera_path_file = argv[++i];
+        }
+        else if(strcmp(argv[i], "--frames") == 0 && has_value) {
+            frame_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--animate") == 0) {
+            animate = true;
+        }
+        else if(strcmp(argv[i], "--bvh-builder") == 0 && has_value) {
+            i++;
+            if(strcmp(argv[i], "sah") == 0) {
+                builder = BLAS_BUILDER_SAH;
+            } else if(strcmp(argv[i], "median") == 0) {
+                builder = BLAS_BUILDER_MEDIAN;
+            } else if(strcmp(argv[i], "gpu") == 0) {
+                builder = BLAS_BUILDER_GPU;
+            } else {
+                fprintf(stderr, "Unknown BVH builder: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--bvh-threads") == 0 && has_value) {
+            bvh_thread_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--benchmark-bvh") == 0) {
+            benchmark_builders = true;
+        }
+        else if(strcmp(argv[i], "--serve") == 0 && has_value) {
+            socket_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(settings.time_budget < 0.0) {
+        fprintf(stderr, "The time budget cannot be negative\n");
         return EXIT_FAILURE;
     }
 
-    VkDebugUtilsMessengerEXT messenger = create_messenger(instance, &debug_info);
-    if(!messenger) {
-        fprintf(stderr, "Cannot proceed without a debug utils messenger");
+    if(settings.samples_per_pixel == 0 || settings.samples_per_pass == 0) {
+        fprintf(stderr, "Sample counts must be greater than zero\n");
         return EXIT_FAILURE;
     }
 
-    VkPhysicalDevice physical_device = find_physical_device(instance);
-    if(!physical_device) {
-        fprintf(stderr, "Failed to find a suitable physical device");
+    if(checkpoint_path && settings.checkpoint_interval == 0) {
+        fprintf(stderr, "The checkpoint interval must be greater than zero\n");
         return EXIT_FAILURE;
     }
 
-    uint32_t compute_queue_index = find_compute_family(physical_device);
-    VkDevice device = create_device(physical_device, compute_queue_index);
-    if(!device) {
-        fprintf(stderr, "Cannot proceed without a device");
+    if(resume && !checkpoint_path) {
+        fprintf(stderr, "--resume requires --checkpoint\n");
         return EXIT_FAILURE;
     }
-    
-    VkQueue compute_queue;
-    vkGetDeviceQueue(device, compute_queue_index, 0, &compute_queue);
 
-    VkImage image = create_image(device);
-    if(!image) {
-        fprintf(stderr, "Cannot proceed without an image");
+    if(camera_path_file && (checkpoint_path || socket_path)) {
+        fprintf(stderr, "--camera-path cannot be combined with --checkpoint or --serve\n");
         return EXIT_FAILURE;
     }
 
-    VkDeviceMemory image_memory = allocate_image(physical_device, device, image);
-    if(!image_memory) {
-        fprintf(stderr, "Cannot proceed without allocated image memory");
+    if(band_height && (checkpoint_path || socket_path || camera_path_file || benchmark_denoise || benchmark_precisions || benchmark_pixel_orders || benchmark_sorting || benchmark_builders || settings.read_aovs)) {
+        fprintf(stderr, "--band-height only renders single images, without --aov or --checkpoint\n");
         return EXIT_FAILURE;
     }
 
-    VkImageView image_view = create_image_view(device, image);
-    if(!image_view) {
-        fprintf(stderr, "Cannot proceed without an image view");
+    if(report_memory && (socket_path || band_height || camera_path_file)) {
+        fprintf(stderr, "--report-memory measures the readback of a single image, without --serve, --band-height or --camera-path\n");
         return EXIT_FAILURE;
     }
 
-    VkDescriptorSetLayout descriptor_set_layout = create_descriptor_set_layout(device);
-    if(!descriptor_set_layout) {
-        fprintf(stderr, "Cannot proceed without a descriptor set layout");
+    bool benchmarking = benchmark_denoise || benchmark_precisions || benchmark_pixel_orders || benchmark_sorting || benchmark_builders;
+    if(settings.cost_view != COST_VIEW_NONE && (settings.trace_mode != TRACE_MODE_MEGAKERNEL || resume || socket_path || camera_path_file || benchmarking)) {
+        fprintf(stderr, "--cost-view only renders single images with the megakernel, without --resume\n");
         return EXIT_FAILURE;
     }
 
-    VkPipelineLayout pipeline_layout = create_pipeline_layout(device, descriptor_set_layout);
-    if(!pipeline_layout) {
-        fprintf(stderr, "Cannot proceed without a pipeline layout");
+    if((frame_count || animate) && !camera_path_file) {
+        fprintf(stderr, "--frames and --animate require --camera-path\n");
         return EXIT_FAILURE;
     }
 
-    VkDescriptorPool descriptor_pool = create_descriptor_pool(device);
-    if(!descriptor_pool)  {
-        fprintf(stderr, "Cannot proceed without a descriptor pool");
+    if(scene_file_path && (animate || benchmark_builders)) {
+        fprintf(stderr, "--scene-file cannot be combined with --animate or --benchmark-bvh\n");
         return EXIT_FAILURE;
     }
 
-    VkDescriptorSet descriptor_set = create_descriptor_set(device, descriptor_pool, descriptor_set_layout);
-    if(!descriptor_set) {
-        fprintf(stderr, "Cannot proceed without a descriptor set");
+    if(timeline_path) {
+        if(!timeline_start(timeline_path, TIMELINE_MAX_EVENTS)) {
+            return EXIT_FAILURE;
+        }
+
+        atexit(finish_timeline);
+    }
+
+    if(write_scene_path) {
+        return write_scene_file(scene_name, builder, bvh_thread_count, write_scene_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    camera_path path = {0};
+    if(camera_path_file) {
+        if(!camera_path_load(camera_path_file, &path)) {
+            return EXIT_FAILURE;
+        }
+
+        if(frame_count == 0) {
+            frame_count = path.keyframe_count * 2;
+        }
+    }
+
+    // The renderer copies the scene, so it is freed, or its file closed, as soon as the renderers are created.
+    scene render_scene = {0};
+    scene_file render_scene_file = {0};
+    if(scene_file_path) {
+        if(!scene_file_open(scene_file_path, &render_scene_file)) {
+            camera_path_free(&path);
+            return EXIT_FAILURE;
+        }
+
+        const scene_tables *tables = &render_scene_file.tables;
+        printf("Mapped %s: %u primitives, %u objects, %u instances, %u BVH nodes\n", scene_file_path,
+            tables->primitive_count, tables->object_count, tables->instance_count, tables->blas_node_count + tables->tlas_node_count);
+    } else if(!scene_create_builtin(scene_name, 0.0f, &render_scene)) {
+        camera_path_free(&path);
         return EXIT_FAILURE;
     }
 
-    const VkDescriptorImageInfo descriptor_image_info = {
-        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-        .imageView = image_view,
+    const renderer_create_info create_info = {
+        .shader_directory = "shaders",
+        .scene = &render_scene,
+        .scene_file = scene_file_path ? &render_scene_file : NULL,
+        .enable_validation = true,
+        .enable_aovs = settings.read_aovs,
+        .enable_checkpoints = checkpoint_path != NULL,
+        .width = image_width,
+        .height = image_height,
+        .band_height = band_height,
+        .precision = precision,
+        .disable_subgroups = disable_subgroups,
+        .enable_wavefront = settings.trace_mode != TRACE_MODE_MEGAKERNEL || benchmark_sorting,
+        .blas_builder = builder,
+        .bvh_thread_count = bvh_thread_count,
+        .enable_cost_view = settings.cost_view != COST_VIEW_NONE,
+        .enable_gpu_timeline = timeline_path != NULL,
     };
 
-    const VkWriteDescriptorSet descriptor_write = {
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet = descriptor_set,
-        .dstBinding = 0,
-        .dstArrayElement = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .descriptorCount = 1,
-        .pImageInfo = &descriptor_image_info,
-    };
+    if(benchmark_precisions) {
+        settings.read_aovs = false;
+        settings.time_budget = 0.0;
+        renderer_create_info benchmark_info = create_info;
+        benchmark_info.enable_aovs = false;
+        benchmark_info.enable_checkpoints = false;
+        camera_path_free(&path);
+        bool benchmarked = benchmark_precision(&benchmark_info, &settings);
+        scene_free(&render_scene);
+        scene_file_close(&render_scene_file);
+        return benchmarked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    vkUpdateDescriptorSets(device, 1, &descriptor_write, 0, NULL);
+    if(benchmark_sorting) {
+        settings.read_aovs = false;
+        settings.time_budget = 0.0;
+        renderer_create_info benchmark_info = create_info;
+        benchmark_info.enable_aovs = false;
+        benchmark_info.enable_checkpoints = false;
+        camera_path_free(&path);
+        bool benchmarked = benchmark_ray_sorting(&benchmark_info, scene_file_path ? scene_file_path : scene_name, &settings);
+        scene_free(&render_scene);
+        scene_file_close(&render_scene_file);
+        return benchmarked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    VkCommandPool command_pool = create_command_pool(device, compute_queue_index);
-    if(!command_pool) {
-        fprintf(stderr, "Cannot proceed without a command pool");
-        return EXIT_FAILURE;
+    if(benchmark_builders) {
+        settings.read_aovs = false;
+        settings.time_budget = 0.0;
+        renderer_create_info benchmark_info = create_info;
+        benchmark_info.enable_aovs = false;
+        benchmark_info.enable_checkpoints = false;
+        camera_path_free(&path);
+        bool benchmarked = benchmark_bvh_builders(&benchmark_info, &settings);
+        scene_free(&render_scene);
+        scene_file_close(&render_scene_file);
+        return benchmarked ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    VkCommandBuffer command_buffer = create_command_buffer(device, command_pool);
-    if(!command_buffer) {
-        fprintf(stderr, "Cannot proceed without a command buffer");
+    renderer *r;
+    renderer_result result = renderer_create(&create_info, &r);
+    scene_free(&render_scene);
+    scene_file_close(&render_scene_file);
+    if(result != RENDERER_SUCCESS) {
+        fprintf(stderr, "Cannot proceed without a renderer: %s\n", renderer_result_string(result));
+        camera_path_free(&path);
         return EXIT_FAILURE;
     }
 
-    VkFence compute_completed_fence;
-    {
-        const VkFenceCreateInfo fence_info = {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        };
+    if(renderer_band_count(r) > 1) {
+        bool rendered = render_bands(r, &settings, "output.png");
+        renderer_destroy(r);
+        return rendered ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-        VkResult result = vkCreateFence(device, &fence_info, NULL, &compute_completed_fence);
-        if(result != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create fence");
-            return EXIT_FAILURE;
-        }
+    if(camera_path_file) {
+        settings.read_aovs = false;
+        bool rendered = render_sequence(r, &settings, &path, frame_count, animate ? scene_name : NULL);
+        camera_path_free(&path);
+        renderer_destroy(r);
+        return rendered ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    size_t shader_code_len;
-    const uint8_t *shader_code = read_file("shaders/pathtracer.comp.spv", &shader_code_len);
+    if(benchmark_pixel_orders) {
+        settings.read_aovs = false;
+        settings.time_budget = 0.0;
+        bool benchmarked = benchmark_pixel_order(r, &settings);
+        renderer_destroy(r);
+        return benchmarked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    const VkShaderModuleCreateInfo shader_mod_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .pCode = (uint32_t*)shader_code,
-        .codeSize = shader_code_len,
-    };
+    if(benchmark_denoise) {
+        settings.read_aovs = false;
+        settings.time_budget = 0.0;
+        bool benchmarked = benchmark_denoiser(r, &settings);
+        renderer_destroy(r);
+        return benchmarked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    VkShaderModule shader_mod;
-    {
-        VkResult result = vkCreateShaderModule(device, &shader_mod_info, NULL, &shader_mod);
-        if(result != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create shader module: %s\n", string_VkResult(result));
+    if(socket_path) {
+        settings.read_aovs = false;
+        bool served = run_server(r, scene_file_path ? scene_file_path : scene_name, &settings, socket_path);
+        renderer_destroy(r);
+        return served ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    checkpoint resume_checkpoint = {0};
+    if(resume) {
+        if(!checkpoint_read(checkpoint_path, &resume_checkpoint) || renderer_validate_checkpoint(r, &resume_checkpoint, &settings) != RENDERER_SUCCESS) {
+            fprintf(stderr, "Cannot resume from %s\n", checkpoint_path);
+            checkpoint_free(&resume_checkpoint);
+            renderer_destroy(r);
             return EXIT_FAILURE;
         }
-    }
 
-    VkPipeline pipeline = create_compute_pipeline(device, pipeline_layout, shader_mod);
-    if(!pipeline) {
-        fprintf(stderr, "Cannot proceed without a pipeline");
-        return EXIT_FAILURE;
+        printf("Resuming from %s at %u samples\n", checkpoint_path, resume_checkpoint.header.samples_completed);
     }
 
-    VkDeviceSize image_size = IMAGE_WIDTH * IMAGE_HEIGHT * 4;
-    VkDeviceMemory staging_buffer_memory;
-    VkBuffer staging_buffer = create_staging_buffer(physical_device, device, image_size, &staging_buffer_memory);
-    
-    VkCommandBufferBeginInfo begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-    };
+    uint32_t width = renderer_width(r);
+    uint32_t height = renderer_height(r);
 
-    if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
-        fprintf(stderr, "Failed to begin recording command buffers");
-        return EXIT_FAILURE;
-    }
+    checkpoint_writer writer;
+    if(checkpoint_path) {
+        if(!checkpoint_writer_start(&writer, checkpoint_path, width, height)) {
+            fprintf(stderr, "Cannot proceed without a checkpoint writer\n");
+            checkpoint_free(&resume_checkpoint);
+            renderer_destroy(r);
+            return EXIT_FAILURE;
+        }
 
-    const VkImageMemoryBarrier general_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = image,
-        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .subresourceRange.baseMipLevel = 0,
-        .subresourceRange.levelCount = 1,
-        .subresourceRange.baseArrayLayer = 0,
-        .subresourceRange.layerCount = 1,
-        .srcAccessMask = 0,
-        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
-    };
+        settings.checkpoint_writer = &writer;
+    }
 
-    vkCmdPipelineBarrier(
-        command_buffer, 
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
-        0, 
-        0, NULL, 
-        0, NULL, 
-        1, &general_barrier
-    );
-
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_set, 0, NULL);
-
-    uint32_t num_work_groups_width = (IMAGE_WIDTH + 31) / 32;
-    uint32_t num_work_groups_height = (IMAGE_HEIGHT + 31) / 32;
-
-    vkCmdDispatch(command_buffer, num_work_groups_width, num_work_groups_height, 1);
-
-    const VkImageMemoryBarrier transfer_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
-        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = image,
-        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .subresourceRange.baseMipLevel = 0,
-        .subresourceRange.levelCount = 1,
-        .subresourceRange.baseArrayLayer = 0,
-        .subresourceRange.layerCount = 1,
-        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-    };
+    render_stats stats;
+    TIMELINE_ZONE("renderer_render") {
+        result = renderer_render(r, &settings, resume ? &resume_checkpoint : NULL, &stats);
+    }
 
-    vkCmdPipelineBarrier(
-        command_buffer, 
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
-        VK_PIPELINE_STAGE_TRANSFER_BIT, 
-        0, 
-        0, NULL, 
-        0, NULL, 
-        1, &transfer_barrier
-    );
-
-    const VkBufferImageCopy region = {
-        .bufferOffset = 0,
-        .bufferRowLength = 0,
-        .bufferImageHeight = 0,
-        .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .imageSubresource.mipLevel = 0,
-        .imageSubresource.baseArrayLayer = 0,
-        .imageSubresource.layerCount = 1,
-        .imageOffset = {0, 0, 0},
-        .imageExtent = {IMAGE_WIDTH, IMAGE_HEIGHT, 1},
-    };
+    if(checkpoint_path) {
+        checkpoint_writer_stop(&writer);
+    }
 
-    vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging_buffer, 1, &region);
+    checkpoint_free(&resume_checkpoint);
 
-    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-        fprintf(stderr, "Failed to end recording command buffers");
+    if(result != RENDERER_SUCCESS) {
+        fprintf(stderr, "Rendering failed: %s\n", renderer_result_string(result));
+        renderer_destroy(r);
         return EXIT_FAILURE;
     }
 
-    VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffer,
-    };
+    printf("Rendering completed in %.1f ms at %u spp\n", stats.time * 1000.0, stats.samples_per_pixel);
+    print_ray_stats(&stats, (uint64_t)width * height);
 
-    VkResult submit_result = vkQueueSubmit(compute_queue, 1, &submit_info, compute_completed_fence);
-    if(submit_result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to submit command buffers");
+    size_t image_size = (size_t)width * height * 4;
+    uint8_t *pixels = malloc(image_size);
+    if(!pixels) {
+        fprintf(stderr, "Failed to allocate the output pixels\n");
+        renderer_destroy(r);
         return EXIT_FAILURE;
     }
 
-    VkResult wait_result = vkWaitForFences(device, 1, &compute_completed_fence, VK_TRUE, UINT64_MAX);
-    if(wait_result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to wait for fences: %s\n", string_VkResult(wait_result));
-        return EXIT_FAILURE;
+    double readback_start = get_time();
+    TIMELINE_ZONE("renderer_readback") {
+        renderer_readback(r, pixels);
     }
 
-    printf("Rendering completed\n");
+    double readback_time = get_time() - readback_start;
 
-    void* data;
-    vkMapMemory(device, staging_buffer_memory, 0, image_size, 0, &data);
+    if(report_memory) {
+        renderer_print_memory_report(r);
+        printf("Readback: %.2f MiB in %.3f ms (%.1f MiB/s)\n",
+            image_size / (1024.0 * 1024.0), readback_time * 1000.0,
+            image_size / (1024.0 * 1024.0) / readback_time);
+    }
 
     printf("Writing image...\n");
     const char *filename = "output.png";
-    if (stbi_write_png("output.png", IMAGE_WIDTH, IMAGE_HEIGHT, 4, data, IMAGE_WIDTH * 4)) {
+    bool written = false;
+    TIMELINE_ZONE("write_output_png") {
+        written = write_output_png(filename, width, height, pixels, &stats);
+    }
+
+    if (written) {
         printf("Image saved as %s\n", filename);
     } else {
         printf("Failed to save image!\n");
     }
 
-    vkUnmapMemory(device, staging_buffer_memory);
-    
-    vkDestroyShaderModule(device, shader_mod, NULL);
-    vkDestroyBuffer(device, staging_buffer, NULL);
-    vkFreeMemory(device, staging_buffer_memory, NULL);
-    vkDestroyPipeline(device, pipeline, NULL);
-    vkDestroyFence(device, compute_completed_fence, NULL);
-    vkDestroyCommandPool(device, command_pool, NULL);
-    vkDestroyDescriptorPool(device, descriptor_pool, NULL);
-    vkDestroyPipelineLayout(device, pipeline_layout, NULL);
-    vkDestroyDescriptorSetLayout(device, descriptor_set_layout, NULL);
-    vkDestroyImageView(device, image_view, NULL);
-    vkFreeMemory(device, image_memory, NULL);
-    vkDestroyImage(device, image, NULL);
-    vkDestroyDevice(device, NULL);
-    vkDestroyDebugUtilsMessengerEXT(instance, messenger, NULL);
-    vkDestroyInstance(instance, NULL);
+    free(pixels);
+
+    if(settings.read_aovs) {
+        bool aovs_written = false;
+        TIMELINE_ZONE("write_aovs") {
+            aovs_written = write_aovs(r);
+        }
+
+        if(aovs_written) {
+            printf("AOVs saved as albedo.pfm, normal.pfm, depth.pfm and hit_id.pfm\n");
+        } else {
+            printf("Failed to save AOVs!\n");
+        }
+    }
+
+    if(settings.cost_view != COST_VIEW_NONE) {
+        if(write_costs(r)) {
+            printf("Costs per sample saved as costs.pfm\n");
+        } else {
+            printf("Failed to save costs!\n");
+        }
+    }
+
+    renderer_destroy(r);
     return EXIT_SUCCESS;
 }
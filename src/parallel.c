@@ -0,0 +1,94 @@
+#include "parallel.h"
+#include "timeline.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// More threads than this are never started, the callers split their work into fewer pieces anyway.
+#define MAX_THREADS 64
+
+typedef struct parallel_job {
+    atomic_uint next;
+    uint32_t count;
+    parallel_function function;
+    void *context;
+} parallel_job;
+
+// A started thread and the slot it takes among those of its parallel_for() call.
+typedef struct parallel_worker {
+    parallel_job *job;
+    uint32_t slot;
+} parallel_worker;
+
+static int run_job(void *arg) {
+    parallel_job *job = arg;
+    uint32_t index;
+    while((index = atomic_fetch_add(&job->next, 1u)) < job->count) {
+        TIMELINE_ZONE("parallel_for item") {
+            job->function(job->context, index);
+        }
+    }
+
+    return 0;
+}
+
+static int run_worker(void *arg) {
+    parallel_worker *worker = arg;
+    timeline_set_worker(worker->slot);
+    return run_job(worker->job);
+}
+
+uint32_t parallel_thread_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    long count = (long)system_info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if(count < 1) {
+        return 1;
+    }
+
+    return count > MAX_THREADS ? MAX_THREADS : (uint32_t)count;
+}
+
+void parallel_for(uint32_t count, uint32_t thread_count, parallel_function function, void *context) {
+    parallel_job job = {
+        .count = count,
+        .function = function,
+        .context = context,
+    };
+
+    atomic_init(&job.next, 0u);
+
+    if(thread_count > count) {
+        thread_count = count;
+    }
+
+    if(thread_count > MAX_THREADS) {
+        thread_count = MAX_THREADS;
+    }
+
+    thrd_t threads[MAX_THREADS];
+    parallel_worker workers[MAX_THREADS];
+    uint32_t started = 0;
+    for(uint32_t i = 1; i < thread_count; i++) {
+        workers[started] = (parallel_worker){ .job = &job, .slot = started };
+        if(thrd_create(&threads[started], run_worker, &workers[started]) != thrd_success) {
+            break;
+        }
+
+        started++;
+    }
+
+    run_job(&job);
+    for(uint32_t i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+}
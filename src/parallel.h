@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <stdint.h>
+
+typedef void (*parallel_function)(void *context, uint32_t index);
+
+// Threads worth running for CPU bound work, at least one.
+uint32_t parallel_thread_count(void);
+
+// Calls function(context, i) for every i in [0, count), spread over at most thread_count threads including the
+// calling one. Indices are handed out one at a time, so uneven work balances itself. Falls back to fewer threads
+// when some cannot be started, and returns once every call has returned.
+void parallel_for(uint32_t count, uint32_t thread_count, parallel_function function, void *context);
+
+#endif // PARALLEL_H
@@ -0,0 +1,3800 @@
+#include "renderer.h"
+#include "allocator.h"
+#include "timeline.h"
+#include "utils.h"
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vk_enum_string_helper.h>
+
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof((x)[0]))
+
+static const char *VALIDATION_LAYERS[] = {
+    "VK_LAYER_KHRONOS_validation",
+};
+
+static const char *EXTENSIONS[] = {
+    VK_EXT_DEBUG_UTILS_EXTENSION_NAME
+};
+
+// Extensions create_device() only enables where they are asked for and the device has them.
+typedef struct device_options {
+    // VK_EXT_descriptor_indexing, for non-uniform indexing into the texture array. Only core from Vulkan 1.2 on.
+    bool texture_array;
+    // VK_KHR_shader_clock, for the cost views.
+    bool shader_clock;
+    // VK_EXT_calibrated_timestamps, to place GPU ranges on the timeline.
+    bool calibrated_timestamps;
+} device_options;
+
+// Used when renderer_create_info leaves the resolution at zero.
+static const uint32_t DEFAULT_IMAGE_WIDTH = 1920;
+static const uint32_t DEFAULT_IMAGE_HEIGHT = 1080;
+
+// Linear radiance is summed here across sample passes, the resolve pass turns it into the 8-bit output.
+static const VkFormat ACCUMULATION_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+static const VkFormat OUTPUT_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+// First hit albedo and normal/depth sums that guide the denoiser, plus the two images it ping-pongs between.
+static const VkFormat GUIDE_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+static const VkFormat DENOISE_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+// Replaces the three formats above with RENDER_PRECISION_HALF. The accumulation and guide images then hold averages.
+static const VkFormat HALF_FLOAT_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+// Index of the object seen by the primary ray, HIT_ID_MISS where it escaped the scene.
+static const VkFormat HIT_ID_FORMAT = VK_FORMAT_R32_UINT;
+static const uint32_t HIT_ID_MISS = UINT32_MAX;
+
+// Storage images up to FIRST_BUFFER_BINDING, then buffers with the texture array among them, shared by all pipelines through one
+// descriptor set.
+enum {
+    BINDING_ACCUMULATION_IMAGE = 0,
+    BINDING_OUTPUT_IMAGE = 1,
+    BINDING_ALBEDO_IMAGE = 2,
+    BINDING_NORMAL_DEPTH_IMAGE = 3,
+    BINDING_DENOISE_PING_IMAGE = 4,
+    BINDING_DENOISE_PONG_IMAGE = 5,
+    BINDING_HIT_ID_IMAGE = 6,
+    BINDING_STATS_BUFFER = 7,
+    BINDING_TILE_ORDER_BUFFER = 8,
+    // Only present with enable_wavefront.
+    BINDING_WAVEFRONT_CONTROL_BUFFER = 9,
+    BINDING_RAY_QUEUE_BUFFER = 10,
+    BINDING_PATH_STATE_BUFFER = 11,
+    // The sections of the scene buffer, in the order they are laid out.
+    BINDING_MATERIAL_BUFFER = 12,
+    BINDING_PRIMITIVE_BUFFER = 13,
+    BINDING_BLAS_BUFFER = 14,
+    BINDING_TLAS_BUFFER = 15,
+    BINDING_INSTANCE_BUFFER = 16,
+    // Only bound with BLAS_BUILDER_GPU, for lbvh.comp.
+    BINDING_BVH_BOUNDS_BUFFER = 17,
+    BINDING_BVH_SCRATCH_BUFFER = 18,
+    // MAX_TEXTURE_COUNT combined image samplers, the slots the scene leaves empty hold a white texel.
+    BINDING_TEXTURES = 19,
+    // Only present with enable_cost_view.
+    BINDING_COST_BUFFER = 20,
+    BINDING_COUNT,
+};
+
+#define SCENE_SECTION_COUNT (BINDING_INSTANCE_BUFFER + 1 - BINDING_MATERIAL_BUFFER)
+
+// The scene buffer is device local and filled by copies out of a persistent ring of at most this many bytes, with
+// one submission per fill of the ring or of its copy regions.
+#define SCENE_STAGING_RING_SIZE ((VkDeviceSize)4 << 20)
+#define SCENE_UPLOAD_MAX_REGIONS 256
+// Updates compare the sections in blocks of this many bytes. Changed blocks less than SCENE_DIRTY_MERGE_GAP bytes
+// apart are copied as one region.
+#define SCENE_DIRTY_BLOCK_SIZE 64
+#define SCENE_DIRTY_MERGE_GAP 256
+
+// Must match pathtracer.comp.
+#define MAX_TEXTURE_COUNT 64
+
+// Texels are sRGB, which storage images rarely support. The images are UNORM for mipgen.comp, which converts by
+// itself, and sampled through sRGB views so filtering happens on linear values.
+static const VkFormat TEXTURE_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+static const VkFormat TEXTURE_SAMPLED_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+// Must match the local size of mipgen.comp.
+static const uint32_t MIPGEN_GROUP_SIZE = 8;
+
+static const uint32_t FIRST_BUFFER_BINDING = BINDING_STATS_BUFFER;
+
+// A vec4 of sums per pixel in the cost buffer, must match pathtracer.comp and heatmap.comp.
+static const VkDeviceSize COST_SIZE = 16;
+
+// Must match the local size of pathtracer.comp.
+static const uint32_t TRACE_TILE_SIZE = 32;
+
+// Must match the wavefront variant of pathtracer.comp.
+enum {
+    WAVEFRONT_STAGE_GENERATE = 0,
+    WAVEFRONT_STAGE_EXTEND = 1,
+    WAVEFRONT_STAGE_PREPARE = 2,
+    WAVEFRONT_STAGE_COUNT_BINS = 3,
+    WAVEFRONT_STAGE_SCAN_BINS = 4,
+    WAVEFRONT_STAGE_SCATTER = 5,
+    WAVEFRONT_STAGE_FINISH = 6,
+};
+
+static const uint32_t WAVEFRONT_GROUP_SIZE = 256;
+static const uint32_t WAVEFRONT_BOUNCE_COUNT = 10;
+static const uint32_t WAVEFRONT_SORT_BIN_COUNT = 256;
+// queued_ray and path_state in pathtracer.comp.
+static const VkDeviceSize WAVEFRONT_RAY_SIZE = 32;
+static const VkDeviceSize WAVEFRONT_PATH_SIZE = 96;
+// The ray counts of both queue halves come first, then their VkDispatchIndirectCommands, then the bins.
+static const VkDeviceSize WAVEFRONT_DISPATCH_ARGS_OFFSET = 2 * sizeof(uint32_t);
+
+// Must match lbvh.comp.
+enum {
+    LBVH_STAGE_CODES = 0,
+    LBVH_STAGE_COUNT_DIGITS = 1,
+    LBVH_STAGE_SCAN_DIGITS = 2,
+    LBVH_STAGE_SCATTER = 3,
+    LBVH_STAGE_EMIT = 4,
+    LBVH_STAGE_REFIT = 5,
+    LBVH_STAGE_DEPTH = 6,
+};
+
+static const uint32_t LBVH_GROUP_SIZE = 256;
+// An even number of passes over the 32 bits of the keys, so the sorted keys end up in the first half again.
+static const uint32_t LBVH_RADIX_BITS = 4;
+static const uint32_t LBVH_KEY_BITS = 32;
+
+// Counters of the stats buffer, must match pathtracer.comp. 64-bit counters take two words, the low one first.
+enum {
+    STATS_RAYS = 0,
+    STATS_PRIMITIVE_TESTS = 2,
+    STATS_UNCONVERGED_PIXELS = 4,
+    STATS_NODE_TESTS = 5,
+    STATS_HITS = 7,
+    STATS_ESCAPED_PATHS = 9,
+    STATS_BOUNCE_LIMITED_PATHS = 11,
+    // In units of 256 cycles, only counted by the cost views.
+    STATS_SHADER_CYCLES = 13,
+    STATS_COUNTER_COUNT = 15,
+};
+
+// Must match the push_constants blocks in pathtracer.comp, lbvh.comp, denoise.comp, resolve.comp and heatmap.comp.
+typedef struct trace_push_constants {
+    // The w component of the position holds tan(fov / 2).
+    float camera_position[4];
+    float camera_right[4];
+    float camera_up[4];
+    float camera_forward[4];
+    uint32_t sample_offset;
+    uint32_t sample_count;
+    uint32_t band_offset;
+    uint32_t image_height;
+    uint32_t count_convergence;
+    uint32_t pixel_order;
+    uint32_t stage;
+    uint32_t bounce;
+    uint32_t queue_half;
+    uint32_t pass_sample;
+} trace_push_constants;
+
+typedef struct lbvh_push_constants {
+    float bounds_min[4];
+    float bounds_scale[4];
+    uint32_t stage;
+    uint32_t first_primitive;
+    uint32_t primitive_count;
+    uint32_t blas_root;
+    uint32_t capacity;
+    uint32_t shift;
+} lbvh_push_constants;
+
+typedef struct denoise_push_constants {
+    uint32_t sample_count;
+    uint32_t iteration;
+    float sigma_color;
+    float sigma_normal;
+    float sigma_depth;
+    float sigma_albedo;
+} denoise_push_constants;
+
+typedef enum resolve_source {
+    RESOLVE_SOURCE_ACCUMULATION = 0,
+    RESOLVE_SOURCE_DENOISE_PING = 1,
+    RESOLVE_SOURCE_DENOISE_PONG = 2,
+} resolve_source;
+
+typedef struct resolve_push_constants {
+    uint32_t sample_count;
+    float exposure;
+    uint32_t tonemap;
+    uint32_t source;
+} resolve_push_constants;
+
+typedef struct heatmap_push_constants {
+    uint32_t sample_count;
+    uint32_t cost_view;
+    // Pixels the stats buffer counted over, for the means the tests and cycles are scaled by.
+    uint32_t pixel_count;
+} heatmap_push_constants;
+
+typedef struct storage_image {
+    VkImage image;
+    VkImageView view;
+    allocation memory;
+} storage_image;
+
+// A sampled texture with a full mip chain, in the general layout like the storage images.
+typedef struct texture_image {
+    VkImage image;
+    // sRGB view of every level.
+    VkImageView view;
+    allocation memory;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+} texture_image;
+
+// Where each image lands in the staging buffer. The AOVs follow the 8-bit output and are only present when requested,
+// the costs only with enable_cost_view.
+typedef struct staging_layout {
+    VkDeviceSize output_offset;
+    VkDeviceSize albedo_offset;
+    VkDeviceSize normal_depth_offset;
+    VkDeviceSize hit_id_offset;
+    VkDeviceSize cost_offset;
+    VkDeviceSize stats_offset;
+    VkDeviceSize size;
+} staging_layout;
+
+// GPU ranges of the command buffer being recorded, each timed by a pair of timestamp queries. submit_and_wait()
+// reads them back and adds them to the timeline.
+#define GPU_RANGE_CAPACITY 32
+
+typedef struct gpu_timeline {
+    VkQueryPool query_pool;
+    const char *names[GPU_RANGE_CAPACITY];
+    uint32_t range_count;
+    bool range_open;
+    // Seconds per timestamp tick, and the bits of a timestamp the compute queue actually writes.
+    double tick_period;
+    uint64_t valid_mask;
+    // NULL without VK_EXT_calibrated_timestamps.
+    PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps;
+} gpu_timeline;
+
+// Copies staged in the scene ring, recorded and submitted together by flush_scene_upload().
+typedef struct scene_upload {
+    VkBufferCopy regions[SCENE_UPLOAD_MAX_REGIONS];
+    uint32_t region_count;
+    VkDeviceSize ring_used;
+    // Totals over every flush: bytes staged, the changed ranges they came from and a bit per section that changed.
+    VkDeviceSize bytes;
+    uint32_t range_count;
+    uint32_t changed_sections;
+} scene_upload;
+
+struct renderer {
+    VkInstance instance;
+    VkDebugUtilsMessengerEXT messenger;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    uint32_t compute_queue_index;
+    VkQueue compute_queue;
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+
+    VkPipelineLayout trace_pipeline_layout;
+    VkPipelineLayout denoise_pipeline_layout;
+    VkPipelineLayout resolve_pipeline_layout;
+    VkPipelineLayout lbvh_pipeline_layout;
+    VkPipelineLayout heatmap_pipeline_layout;
+    VkPipeline trace_pipeline;
+    // Shares the trace pipeline layout, VK_NULL_HANDLE without enable_wavefront.
+    VkPipeline wavefront_pipeline;
+    VkPipeline denoise_pipeline;
+    VkPipeline resolve_pipeline;
+    // VK_NULL_HANDLE unless the scene was created with BLAS_BUILDER_GPU.
+    VkPipeline lbvh_pipeline;
+    // The trace shader variant that also sums the costs of every pixel, sharing the trace pipeline layout, and the
+    // pass turning them into the output image. VK_NULL_HANDLE without enable_cost_view.
+    VkPipeline cost_pipeline;
+    VkPipeline heatmap_pipeline;
+
+    storage_image accumulation;
+    storage_image output;
+    storage_image albedo;
+    storage_image normal_depth;
+    storage_image denoise_ping;
+    storage_image denoise_pong;
+    storage_image hit_id;
+
+    // Ray counters written by the trace shader with atomics, copied to the staging buffer with the output.
+    VkBuffer stats_buffer;
+    allocation stats_memory;
+    // The trace shader reduces its counters across each subgroup before issuing atomics.
+    bool subgroups_enabled;
+    // The cost pipeline also reads the shader clock.
+    bool shader_clock_enabled;
+    // Devices without non-uniform indexing into the texture array use the untextured trace shaders, which only
+    // render scenes without textures. The texture binding then holds just the white texel.
+    bool texture_array_enabled;
+
+    // Only allocated with enable_gpu_timeline on a compute queue with timestamps. Device timestamps are placed on the
+    // timeline through calibrated timestamps where the device has them.
+    gpu_timeline *gpu_timeline;
+    bool calibrated_timestamps_enabled;
+
+    // Tile coordinates in Morton and Hilbert order, for dispatches with a pixel order other than PIXEL_ORDER_LINEAR.
+    VkBuffer tile_order_buffer;
+    allocation tile_order_memory;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+
+    // Ray counts, indirect dispatch arguments and sort bins, two halves of one queued ray per pixel of a band,
+    // and the rest of every path while its ray is queued.
+    VkBuffer wavefront_control_buffer;
+    allocation wavefront_control_memory;
+    VkBuffer ray_queue_buffer;
+    allocation ray_queue_memory;
+    VkBuffer path_state_buffer;
+    allocation path_state_memory;
+
+    // Sums of the rays, tests and shader clock cycles of every pixel of a band, as a vec4. Only created with
+    // enable_cost_view.
+    VkBuffer cost_buffer;
+    allocation cost_memory;
+
+    // The materials, primitives, BLAS nodes, TLAS nodes and instances, each at an offset the device can bind a
+    // storage buffer at. Indexed by binding - BINDING_MATERIAL_BUFFER. Device local, only written by copies.
+    VkBuffer scene_buffer;
+    allocation scene_memory;
+    VkDeviceSize scene_section_offsets[SCENE_SECTION_COUNT];
+    VkDeviceSize scene_section_ranges[SCENE_SECTION_COUNT];
+    // Every upload to the scene buffer, and every readback from it, goes through this ring.
+    VkBuffer scene_staging_buffer;
+    allocation scene_staging_memory;
+    VkDeviceSize scene_staging_size;
+    // The sections as last uploaded, at the scene buffer's offsets. Updates compare against it to only copy what
+    // changed. NULL for scene files, which cannot be updated.
+    uint8_t *scene_shadow;
+    // Kept for renderer_update_scene(), which refits the BVHs in place. Only the counts and BLAS roots of a scene file.
+    scene_tables scene_tables;
+    bool scene_from_file;
+    // Host time the BVHs took when the renderer was created, GPU BLAS builds included.
+    double bvh_build_time;
+
+    // Bounds of every primitive, written through the mapping, and the sort and hierarchy scratch of lbvh.comp sized
+    // for the largest object. Only created with BLAS_BUILDER_GPU.
+    VkBuffer bvh_bounds_buffer;
+    allocation bvh_bounds_memory;
+    VkBuffer bvh_scratch_buffer;
+    allocation bvh_scratch_memory;
+    uint32_t bvh_scratch_capacity;
+
+    // The scene's textures followed by the white texel of the empty slots, and the sampler they share.
+    texture_image *textures;
+    uint32_t texture_count;
+    VkSampler texture_sampler;
+    // The first level of every texture, only held until upload_textures() has copied it.
+    VkBuffer texture_staging_buffer;
+    allocation texture_staging_memory;
+    // Hash of the texels, which the scene hash starts from.
+    uint64_t texture_hash;
+
+    VkBuffer staging_buffer;
+    allocation staging_memory;
+
+    // Holds the accumulation, albedo and normal/depth images while checkpointing or resuming, NULL otherwise.
+    VkBuffer checkpoint_buffer;
+    allocation checkpoint_memory;
+
+    uint32_t width;
+    uint32_t height;
+    render_precision precision;
+    // The storage images and the staging buffer only hold band_height rows, the image is rendered in band_count bands.
+    uint32_t band_height;
+    uint32_t band_count;
+    // Rows of the band rendered last, the rest of the staging buffer is stale.
+    uint32_t last_band_rows;
+
+    allocator allocator;
+    // Identifies the contents of the scene buffer, and the trace shader with the resolution. Combined and extended
+    // with the camera per render, so checkpoints of other scenes or views are rejected.
+    uint64_t scene_hash;
+    uint64_t trace_hash;
+
+    bool aovs_enabled;
+    // Sample count of the last render, the AOV images hold sums over it, and whether the cost buffer holds its costs.
+    uint32_t last_sample_count;
+    bool last_cost_view;
+    // What the accumulation image holds samples of, and how many, for render_settings.accumulate. Zero samples after
+    // band renders and failures. Reading the AOVs back leaves the albedo and normal/depth images in
+    // TRANSFER_SRC_OPTIMAL.
+    uint64_t accumulated_hash;
+    uint32_t accumulated_samples;
+    bool accumulated_aovs_read;
+};
+
+static VKAPI_ATTR VkBool32 debug_callback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT           messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT                  messageTypes,
+    const VkDebugUtilsMessengerCallbackDataEXT*      pCallbackData,
+    void*                                            pUserData) {
+
+    // pMessage is NULL if messageTypes is equal to VK_DEBUG_UTILS_MESSAGE_TYPE_DEVICE_ADDRESS_BINDING_BIT_EXT.
+    if(!pCallbackData->pMessage) {
+        return VK_FALSE;
+    }
+
+    switch (messageSeverity) {
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
+        fprintf(stderr, "%s\n", pCallbackData->pMessage);
+        break;
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
+        fprintf(stderr, "%s\n", pCallbackData->pMessage);
+        break;
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
+        fprintf(stderr, "%s\n", pCallbackData->pMessage);
+        break;
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
+        fprintf(stderr, "%s\n", pCallbackData->pMessage);
+        break;
+    default:
+        break;
+    }
+
+    return VK_FALSE;
+}
+
+// debug_info is NULL when validation is disabled.
+static VkInstance create_instance(const VkDebugUtilsMessengerCreateInfoEXT *debug_info) {
+    const VkApplicationInfo app_info = {
+        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .apiVersion = VK_API_VERSION_1_1,
+        .applicationVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
+        .pApplicationName = NULL,
+        .engineVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
+        .pEngineName = NULL,
+    };
+
+    const VkInstanceCreateInfo instance_info = {
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pNext = debug_info,
+        .pApplicationInfo = &app_info,
+        .ppEnabledLayerNames = VALIDATION_LAYERS,
+        .enabledLayerCount = debug_info ? ARRAY_LENGTH(VALIDATION_LAYERS) : 0,
+        .ppEnabledExtensionNames = EXTENSIONS,
+        .enabledExtensionCount = debug_info ? ARRAY_LENGTH(EXTENSIONS) : 0,
+    };
+
+    VkInstance instance;
+    VkResult result = vkCreateInstance(&instance_info, NULL, &instance);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create instance: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return instance;
+}
+
+static VkDebugUtilsMessengerEXT create_messenger(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT *debug_info) {
+    VkDebugUtilsMessengerEXT messenger;
+    VkResult result = vkCreateDebugUtilsMessengerEXT(instance, debug_info, NULL, &messenger);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create debug utils messenger: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return messenger;
+}
+
+static int rate_physical_device(VkPhysicalDevice physical_device) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    int score = 0;
+
+    if(properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+        score += 100;
+    }
+
+    return score;
+}
+
+static bool has_device_extension(VkPhysicalDevice physical_device, const char *name) {
+    uint32_t extension_count;
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, NULL);
+
+    VkExtensionProperties *extensions = malloc(sizeof(VkExtensionProperties) * extension_count);
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, extensions);
+
+    bool found = false;
+    for(uint32_t i = 0; i < extension_count && !found; i++) {
+        found = strcmp(extensions[i].extensionName, name) == 0;
+    }
+
+    free(extensions);
+    return found;
+}
+
+// The trace shader indexes one array of MAX_TEXTURE_COUNT textures with the material of each hit. Descriptor indexing
+// is an extension in Vulkan 1.1, but supported nearly everywhere.
+static bool supports_texture_array(VkPhysicalDevice physical_device) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    if(properties.apiVersion < VK_API_VERSION_1_1 ||
+       properties.limits.maxPerStageDescriptorSampledImages < MAX_TEXTURE_COUNT ||
+       properties.limits.maxPerStageDescriptorSamplers < MAX_TEXTURE_COUNT) {
+        return false;
+    }
+
+    if(!has_device_extension(physical_device, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+    };
+
+    VkPhysicalDeviceFeatures2 features2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &indexing_features,
+    };
+
+    vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+    return indexing_features.shaderSampledImageArrayNonUniformIndexing;
+}
+
+static VkPhysicalDevice find_physical_device(VkInstance instance, bool texture_array) {
+    uint32_t physical_device_count;
+    vkEnumeratePhysicalDevices(instance, &physical_device_count, NULL);
+
+    VkPhysicalDevice *physical_devices = malloc(sizeof(VkPhysicalDevice) * physical_device_count);
+    vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices);
+
+    int highest_score = INT_MIN;
+    VkPhysicalDevice best_physical_device = NULL;
+    for(uint32_t i = 0; i < physical_device_count; i++) {
+        VkPhysicalDevice physical_device = physical_devices[i];
+        if(texture_array && !supports_texture_array(physical_device)) {
+            continue;
+        }
+
+        int score = rate_physical_device(physical_device);
+        if(score > highest_score) {
+            highest_score = score;
+            best_physical_device = physical_device;
+        }
+    }
+
+    free(physical_devices);
+    return best_physical_device;
+}
+
+static uint32_t find_compute_family(VkPhysicalDevice physical_device) {
+    uint32_t property_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &property_count, NULL);
+
+    VkQueueFamilyProperties *properties = malloc(sizeof(VkQueueFamilyProperties) * property_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &property_count, properties);
+
+    for(uint32_t i = 0; i < property_count; i++) {
+        VkQueueFamilyProperties queue = properties[i];
+        if(queue.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            free(properties);
+            return i;
+        }
+    }
+
+    // All Vulkan implementations are required to support compute, so this code should be unreachable.
+    free(properties);
+    fprintf(stderr, "Error: No compute queue family found!\n");
+    return UINT32_MAX;
+}
+
+// Subgroups are core in Vulkan 1.1, but arithmetic in compute shaders is optional.
+static bool supports_subgroups(VkPhysicalDevice physical_device) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    if(properties.apiVersion < VK_API_VERSION_1_1) {
+        return false;
+    }
+
+    VkPhysicalDeviceSubgroupProperties subgroup_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+    };
+
+    VkPhysicalDeviceProperties2 properties2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &subgroup_properties,
+    };
+
+    vkGetPhysicalDeviceProperties2(physical_device, &properties2);
+
+    const VkSubgroupFeatureFlags required_operations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+
+    return (subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+        (subgroup_properties.supportedOperations & required_operations) == required_operations;
+}
+
+// The cost views time their invocations with clock2x32ARB(), which reads the subgroup scope clock.
+static bool supports_shader_clock(VkPhysicalDevice physical_device) {
+    // The features are queried with vkGetPhysicalDeviceFeatures2, which is core in Vulkan 1.1.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    if(properties.apiVersion < VK_API_VERSION_1_1 || !has_device_extension(physical_device, VK_KHR_SHADER_CLOCK_EXTENSION_NAME)) {
+        return false;
+    }
+
+    VkPhysicalDeviceShaderClockFeaturesKHR clock_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR,
+    };
+
+    VkPhysicalDeviceFeatures2 features2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &clock_features,
+    };
+
+    vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+    return clock_features.shaderSubgroupClock;
+}
+
+// Timestamps of the device and of CLOCK_MONOTONIC, which timeline_time() reads, taken together.
+static bool supports_calibrated_timestamps(VkInstance instance, VkPhysicalDevice physical_device) {
+    if(!timeline_clock_is_monotonic() || !has_device_extension(physical_device, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)) {
+        return false;
+    }
+
+    PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT get_time_domains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    if(!get_time_domains) {
+        return false;
+    }
+
+    VkTimeDomainEXT domains[8];
+    uint32_t domain_count = ARRAY_LENGTH(domains);
+    if(get_time_domains(physical_device, &domain_count, domains) < 0) {
+        return false;
+    }
+
+    bool device_domain = false;
+    bool monotonic_domain = false;
+    for(uint32_t i = 0; i < domain_count; i++) {
+        device_domain = device_domain || domains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+        monotonic_domain = monotonic_domain || domains[i] == VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+    }
+
+    return device_domain && monotonic_domain;
+}
+
+static VkDevice create_device(VkPhysicalDevice physical_device, uint32_t compute_queue, bool validation, const device_options *options) {
+    const float queue_priorities = 1.0f;
+    const VkDeviceQueueCreateInfo queue_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .queueCount = 1,
+        .queueFamilyIndex = compute_queue,
+        .pQueuePriorities = &queue_priorities,
+    };
+
+    const VkPhysicalDeviceShaderClockFeaturesKHR clock_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR,
+        .shaderSubgroupClock = VK_TRUE,
+    };
+
+    const VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+        .pNext = options->shader_clock ? (void *)&clock_features : NULL,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+    };
+
+    const void *features = options->shader_clock ? (const void *)&clock_features : NULL;
+    const char *extensions[3];
+    uint32_t extension_count = 0;
+    if(options->texture_array) {
+        extensions[extension_count++] = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+        features = &indexing_features;
+    }
+
+    if(options->shader_clock) {
+        extensions[extension_count++] = VK_KHR_SHADER_CLOCK_EXTENSION_NAME;
+    }
+
+    if(options->calibrated_timestamps) {
+        extensions[extension_count++] = VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+    }
+
+    const VkDeviceCreateInfo device_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = features,
+        .ppEnabledExtensionNames = extensions,
+        .enabledExtensionCount = extension_count,
+        .ppEnabledLayerNames = VALIDATION_LAYERS,
+        .enabledLayerCount = validation ? ARRAY_LENGTH(VALIDATION_LAYERS) : 0,
+        .pQueueCreateInfos = &queue_create_info,
+        .queueCreateInfoCount = 1,
+    };
+    
+    VkDevice device;
+    VkResult result = vkCreateDevice(physical_device, &device_info, NULL, &device);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create device : %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return device;
+}
+
+static void print_memory_type(VkPhysicalDevice physical_device, const char *label, uint32_t type_index) {
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+    VkMemoryType type = memory_properties.memoryTypes[type_index];
+    VkMemoryHeap heap = memory_properties.memoryHeaps[type.heapIndex];
+
+    printf("%s: memory type %u, heap %u (%llu MiB%s), flags:%s%s%s%s\n",
+        label, type_index, type.heapIndex,
+        (unsigned long long)(heap.size / (1024 * 1024)),
+        (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? ", device local" : "",
+        (type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? " DEVICE_LOCAL" : "",
+        (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? " HOST_VISIBLE" : "",
+        (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? " HOST_COHERENT" : "",
+        (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? " HOST_CACHED" : "");
+}
+
+static VkImage create_image(VkDevice device, VkImageCreateFlags flags, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height, uint32_t level_count) {
+    const VkImageCreateInfo image_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .flags = flags,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent.width = width,
+        .extent.height = height,
+        .extent.depth = 1,
+        .mipLevels = level_count,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VkImage image;
+    VkResult result = vkCreateImage(device, &image_info, NULL, &image);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create image: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return image;
+}
+
+// Usage restricts the view to a subset of the usage of the image, zero keeps all of it.
+static VkImageView create_image_view(VkDevice device, VkImage image, VkFormat format, uint32_t base_level, uint32_t level_count, VkImageUsageFlags usage) {
+    const VkImageViewUsageCreateInfo usage_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO,
+        .usage = usage,
+    };
+
+    const VkImageViewCreateInfo image_view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = usage ? &usage_info : NULL,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.baseMipLevel = base_level,
+        .subresourceRange.levelCount = level_count,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1,
+    };
+
+    VkImageView image_view;
+    VkResult result = vkCreateImageView(device, &image_view_info, NULL, &image_view);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create image view: %s\n", string_VkResult(result));
+        return NULL;
+    }
+    
+    return image_view;
+}
+
+static VkDescriptorType get_descriptor_type(uint32_t binding) {
+    if(binding == BINDING_TEXTURES) {
+        return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    }
+
+    return binding >= FIRST_BUFFER_BINDING ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+}
+
+// The texture array has MAX_TEXTURE_COUNT slots, or one for the untextured trace shaders.
+static uint32_t get_texture_slot_count(const renderer *r) {
+    return r->texture_array_enabled ? MAX_TEXTURE_COUNT : 1;
+}
+
+static VkDescriptorSetLayout create_descriptor_set_layout(VkDevice device, uint32_t texture_slot_count) {
+    VkDescriptorSetLayoutBinding image_layout_bindings[BINDING_COUNT];
+    for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+        image_layout_bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = get_descriptor_type(i),
+            .descriptorCount = i == BINDING_TEXTURES ? texture_slot_count : 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = ARRAY_LENGTH(image_layout_bindings),
+        .pBindings = image_layout_bindings
+    };
+
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkResult result = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_info, NULL, &descriptor_set_layout);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create descriptor set layout: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return descriptor_set_layout;
+}
+
+static VkPipelineLayout create_pipeline_layout(VkDevice device, VkDescriptorSetLayout descriptor_layout, uint32_t push_constant_size) {
+    const VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = push_constant_size,
+    };
+
+    const VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &descriptor_layout,
+        .pushConstantRangeCount = push_constant_size ? 1 : 0,
+        .pPushConstantRanges = &push_constant_range,
+    };
+
+    VkPipelineLayout pipeline_layout;
+    VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_info, NULL, &pipeline_layout);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create pipeline layout: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return pipeline_layout;
+}
+
+static VkDescriptorPool create_descriptor_pool(VkDevice device, uint32_t texture_slot_count) {
+    const VkDescriptorPoolSize pool_sizes[] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = FIRST_BUFFER_BINDING,
+        },
+        // Every binding after the images but the texture array.
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = BINDING_COUNT - 1 - FIRST_BUFFER_BINDING,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = texture_slot_count,
+        },
+    };
+
+    const VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = ARRAY_LENGTH(pool_sizes),
+        .pPoolSizes = pool_sizes,
+        .maxSets = 1
+    };
+
+    VkDescriptorPool descriptor_pool;
+    VkResult result = vkCreateDescriptorPool(device, &pool_info, NULL, &descriptor_pool);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create descriptor pool: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return descriptor_pool;
+}
+
+static VkDescriptorSet create_descriptor_set(VkDevice device, VkDescriptorPool descriptor_pool, VkDescriptorSetLayout layout) {
+    const VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout,
+    };
+
+    VkDescriptorSet descriptor_set;
+    VkResult result = vkAllocateDescriptorSets(device, &alloc_info, &descriptor_set);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create descriptor set: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return descriptor_set;
+}
+
+static VkCommandPool create_command_pool(VkDevice device, uint32_t compute_queue_index) {
+    const VkCommandPoolCreateInfo command_pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .queueFamilyIndex = compute_queue_index,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    };
+
+    VkCommandPool command_pool;
+    VkResult result = vkCreateCommandPool(device, &command_pool_info, NULL, &command_pool);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create command pool: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return command_pool;
+}
+
+static VkCommandBuffer create_command_buffer(VkDevice device, VkCommandPool command_pool) {
+    const VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer buffer;
+    VkResult result = vkAllocateCommandBuffers(device, &alloc_info, &buffer);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create command buffer: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return buffer;
+}
+
+static VkPipeline create_compute_pipeline(VkDevice device, VkPipelineLayout pipeline_layout, VkShaderModule shader) {
+    const VkPipelineShaderStageCreateInfo compute_shader_stage = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+        .module = shader,
+        .pName = "main"
+    };
+
+    const VkComputePipelineCreateInfo compute_pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .layout = pipeline_layout,
+        .stage = compute_shader_stage,
+    };
+    
+    VkPipeline pipeline;
+    VkResult result = vkCreateComputePipelines(device, NULL, 1, &compute_pipeline_info, NULL, &pipeline);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create compute pipeline: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+// code_hash is optional and receives a hash of the SPIR-V.
+static VkShaderModule create_shader_module(VkDevice device, const char *filename, uint64_t *code_hash) {
+    size_t shader_code_len;
+    uint8_t *shader_code = read_file(filename, &shader_code_len);
+    if(!shader_code) {
+        return NULL;
+    }
+
+    if(code_hash) {
+        *code_hash = hash_bytes(shader_code, shader_code_len, HASH_SEED);
+    }
+
+    const VkShaderModuleCreateInfo shader_mod_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .pCode = (uint32_t*)shader_code,
+        .codeSize = shader_code_len,
+    };
+
+    VkShaderModule shader_mod;
+    VkResult result = vkCreateShaderModule(device, &shader_mod_info, NULL, &shader_mod);
+    free(shader_code);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create shader module %s: %s\n", filename, string_VkResult(result));
+        return NULL;
+    }
+
+    return shader_mod;
+}
+
+static void transition_image(VkCommandBuffer command_buffer, VkImage image,
+    VkImageLayout old_layout, VkImageLayout new_layout,
+    VkAccessFlags src_access, VkAccessFlags dst_access,
+    VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+
+    const VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.baseMipLevel = 0,
+        .subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+    };
+
+    vkCmdPipelineBarrier(
+        command_buffer, 
+        src_stage, 
+        dst_stage, 
+        0, 
+        0, NULL, 
+        0, NULL, 
+        1, &barrier
+    );
+}
+
+static bool create_storage_image(VkDevice device, allocator *allocator, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height, storage_image *out) {
+    out->image = create_image(device, 0, format, VK_IMAGE_USAGE_STORAGE_BIT | usage, width, height, 1);
+    if(!out->image) {
+        return false;
+    }
+
+    if(!allocator_bind_image(allocator, out->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ALLOCATION_STRATEGY_FREE_LIST, &out->memory)) {
+        vkDestroyImage(device, out->image, NULL);
+        return false;
+    }
+
+    out->view = create_image_view(device, out->image, format, 0, 1, 0);
+    if(!out->view) {
+        vkDestroyImage(device, out->image, NULL);
+        allocator_free(allocator, &out->memory);
+        return false;
+    }
+
+    return true;
+}
+
+static void destroy_storage_image(VkDevice device, allocator *allocator, storage_image *image) {
+    vkDestroyImageView(device, image->view, NULL);
+    vkDestroyImage(device, image->image, NULL);
+    allocator_free(allocator, &image->memory);
+}
+
+static void memory_barrier(VkCommandBuffer command_buffer,
+    VkAccessFlags src_access, VkAccessFlags dst_access,
+    VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+
+    const VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+    };
+
+    vkCmdPipelineBarrier(
+        command_buffer, 
+        src_stage, 
+        dst_stage, 
+        0, 
+        1, &barrier, 
+        0, NULL, 
+        0, NULL
+    );
+}
+
+// Makes compute shader writes visible to the next dispatch.
+static void compute_barrier(VkCommandBuffer command_buffer) {
+    memory_barrier(command_buffer,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+// Buffers that live as long as the renderer take ALLOCATION_STRATEGY_FREE_LIST. One-shot uploads take
+// ALLOCATION_STRATEGY_LINEAR, whose block rewinds once they are freed after their submission.
+static VkBuffer create_staging_buffer(allocator *allocator, VkDeviceSize size, VkBufferUsageFlags usage, allocation_strategy strategy, allocation *buffer_allocation) {
+    const VkBufferCreateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VkBuffer staging_buffer;
+    VkResult result = vkCreateBuffer(allocator->device, &buffer_info, NULL, &staging_buffer);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create staging buffer: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    // The staging buffer is only ever read by the CPU. Uncached memory is usually write-combined on discrete GPUs,
+    // which makes reads extremely slow, so prefer a cached type and invalidate the mapped range manually.
+    if(!allocator_bind_buffer(allocator, staging_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, strategy, buffer_allocation)) {
+        vkDestroyBuffer(allocator->device, staging_buffer, NULL);
+        return NULL;
+    }
+
+    return staging_buffer;
+}
+
+// Device local buffer that only shaders and indirect dispatches access.
+static VkBuffer create_device_buffer(allocator *allocator, VkDeviceSize size, VkBufferUsageFlags usage, allocation *buffer_allocation) {
+    const VkBufferCreateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VkBuffer buffer;
+    VkResult result = vkCreateBuffer(allocator->device, &buffer_info, NULL, &buffer);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create device buffer: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    if(!allocator_bind_buffer(allocator, buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ALLOCATION_STRATEGY_FREE_LIST, buffer_allocation)) {
+        vkDestroyBuffer(allocator->device, buffer, NULL);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Where the host keeps each section. BLAS nodes built on the GPU are left NULL, they follow from the primitives.
+static void get_scene_sources(const renderer *r, const scene *s, const void *sources[SCENE_SECTION_COUNT]) {
+    sources[0] = s->materials;
+    sources[1] = r->scene_tables.primitives;
+    sources[2] = r->scene_tables.builder == BLAS_BUILDER_GPU ? NULL : r->scene_tables.blas_nodes;
+    sources[3] = r->scene_tables.tlas.nodes;
+    sources[4] = r->scene_tables.instances;
+}
+
+// Hashes the sections the shadow copy holds into the scene hash, on top of the textures.
+static uint64_t hash_scene_shadow(const renderer *r) {
+    uint64_t hash = r->texture_hash;
+    for(uint32_t i = 0; i < SCENE_SECTION_COUNT; i++) {
+        if(i == BINDING_BLAS_BUFFER - BINDING_MATERIAL_BUFFER && r->scene_tables.builder == BLAS_BUILDER_GPU) {
+            continue;
+        }
+
+        hash = hash_bytes(r->scene_shadow + r->scene_section_offsets[i], r->scene_section_ranges[i], hash);
+    }
+
+    return hash;
+}
+
+// Copies the materials and the tables into the shadow copy. upload_scene_buffer() takes them to the scene buffer
+// once the command buffer exists.
+static bool create_scene_shadow(renderer *r, const scene *s, VkDeviceSize size) {
+    r->scene_shadow = malloc(size);
+    if(!r->scene_shadow) {
+        fprintf(stderr, "Failed to allocate the host copy of the scene buffer\n");
+        return false;
+    }
+
+    const void *sources[SCENE_SECTION_COUNT];
+    get_scene_sources(r, s, sources);
+    for(uint32_t i = 0; i < SCENE_SECTION_COUNT; i++) {
+        if(sources[i]) {
+            memcpy(r->scene_shadow + r->scene_section_offsets[i], sources[i], r->scene_section_ranges[i]);
+        }
+    }
+
+    r->scene_hash = hash_scene_shadow(r);
+    return true;
+}
+
+// The counts and BLAS roots of a scene file, the rest of its tables only goes to the scene buffer.
+static bool copy_scene_file_tables(renderer *r, const scene_file *file) {
+    const scene_tables *tables = &file->tables;
+    r->scene_tables = (scene_tables){
+        .primitive_count = tables->primitive_count,
+        .blas_node_count = tables->blas_node_count,
+        .tlas_node_count = tables->tlas_node_count,
+        .instance_count = tables->instance_count,
+        .object_count = tables->object_count,
+        .blas_roots = malloc(sizeof(uint32_t) * (tables->object_count ? tables->object_count : 1)),
+        .builder = tables->builder,
+    };
+
+    if(!r->scene_tables.blas_roots) {
+        fprintf(stderr, "Failed to allocate the BLAS roots of the scene file\n");
+        return false;
+    }
+
+    memcpy(r->scene_tables.blas_roots, tables->blas_roots, sizeof(uint32_t) * tables->object_count);
+    r->scene_from_file = true;
+    return true;
+}
+
+// Words of lbvh.comp scratch for objects of up to capacity primitives: two halves of keys and values, a histogram
+// entry per digit and workgroup, parents and slots of the internal nodes and leaves, the refit visit counts, and
+// the depth of the deepest leaf last.
+static VkDeviceSize get_lbvh_scratch_words(uint32_t capacity) {
+    VkDeviceSize group_count = (capacity + LBVH_GROUP_SIZE - 1) / LBVH_GROUP_SIZE;
+    return (VkDeviceSize)capacity * 9 + group_count * (1u << LBVH_RADIX_BITS) + 1;
+}
+
+// Builds the acceleration structures, or takes them from the scene file, and sizes the sections for them. Their
+// sizes never change afterwards. GPU BLAS builds only get their buffers here, they run once the pipelines exist.
+static bool create_scene_buffer(renderer *r, const scene *s, const renderer_create_info *info, VkDeviceSize offset_alignment) {
+    if(s->material_count == 0 || s->primitive_count == 0) {
+        fprintf(stderr, "The scene needs at least one material and one primitive\n");
+        return false;
+    }
+
+    const scene_file *file = info->scene_file;
+    double build_start = get_time();
+    bool built = false;
+    TIMELINE_ZONE(file ? "copy_scene_file_tables" : "scene_build_tables") {
+        built = file ? copy_scene_file_tables(r, file) : scene_build_tables(s, info->blas_builder, info->bvh_thread_count, &r->scene_tables);
+    }
+
+    if(!built) {
+        return false;
+    }
+
+    r->bvh_build_time = get_time() - build_start;
+
+    const VkDeviceSize section_sizes[SCENE_SECTION_COUNT] = {
+        s->material_count * sizeof(scene_material),
+        s->primitive_count * sizeof(scene_primitive),
+        r->scene_tables.blas_node_count * sizeof(bvh_node),
+        r->scene_tables.tlas_node_count * sizeof(bvh_node),
+        s->instance_count * sizeof(scene_gpu_instance),
+    };
+
+    VkDeviceSize size = 0;
+    for(uint32_t i = 0; i < SCENE_SECTION_COUNT; i++) {
+        r->scene_section_offsets[i] = align_up(size, offset_alignment ? offset_alignment : 1);
+        r->scene_section_ranges[i] = section_sizes[i];
+        size = r->scene_section_offsets[i] + section_sizes[i];
+    }
+
+    // Traversal reads every section for every ray, so they live in device local memory instead of being read over
+    // the bus. The ring is sized for the whole scene when it is small.
+    r->scene_buffer = create_device_buffer(&r->allocator, size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &r->scene_memory);
+    r->scene_staging_size = size < SCENE_STAGING_RING_SIZE ? size : SCENE_STAGING_RING_SIZE;
+    r->scene_staging_buffer = create_staging_buffer(&r->allocator, r->scene_staging_size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, ALLOCATION_STRATEGY_FREE_LIST, &r->scene_staging_memory);
+    if(!r->scene_buffer || !r->scene_staging_buffer) {
+        return false;
+    }
+
+    if(!file && !create_scene_shadow(r, s, size)) {
+        return false;
+    }
+
+    if(r->scene_tables.builder == BLAS_BUILDER_GPU) {
+        for(uint32_t i = 0; i < s->object_count; i++) {
+            uint32_t primitive_count = s->objects[i].primitive_count;
+            r->bvh_scratch_capacity = primitive_count > r->bvh_scratch_capacity ? primitive_count : r->bvh_scratch_capacity;
+        }
+
+        const VkBufferCreateInfo bounds_buffer_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = s->primitive_count * sizeof(bvh_bounds),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+
+        VkResult result = vkCreateBuffer(r->device, &bounds_buffer_info, NULL, &r->bvh_bounds_buffer);
+        if(result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create BVH bounds buffer: %s\n", string_VkResult(result));
+            return false;
+        }
+
+        // Rewritten by every update and read once per build, like the scene buffer.
+        if(!allocator_bind_buffer(&r->allocator, r->bvh_bounds_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ALLOCATION_STRATEGY_FREE_LIST, &r->bvh_bounds_memory)) {
+            return false;
+        }
+
+        // The depth is cleared before and copied out after every build.
+        r->bvh_scratch_buffer = create_device_buffer(&r->allocator, get_lbvh_scratch_words(r->bvh_scratch_capacity) * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &r->bvh_scratch_memory);
+        if(!r->bvh_scratch_buffer) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool validate_material_textures(const scene *s, uint32_t texture_count) {
+    for(uint32_t i = 0; i < s->material_count; i++) {
+        uint32_t texture = s->materials[i].albedo_texture;
+        if(texture != SCENE_NO_TEXTURE && texture >= texture_count) {
+            fprintf(stderr, "Material %u uses texture %u, but there are only %u textures\n", i, texture, texture_count);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool create_texture_image(renderer *r, uint32_t width, uint32_t height, texture_image *out) {
+    // Down to 1x1, the trace shader picks small levels for wide ray cones.
+    uint32_t level_count = 1;
+    while((width | height) >> level_count) {
+        level_count++;
+    }
+
+    out->width = width;
+    out->height = height;
+    out->level_count = level_count;
+    out->image = create_image(r->device, VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT, TEXTURE_FORMAT,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, width, height, level_count);
+    if(!out->image) {
+        return false;
+    }
+
+    if(!allocator_bind_image(&r->allocator, out->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ALLOCATION_STRATEGY_FREE_LIST, &out->memory)) {
+        return false;
+    }
+
+    // The sRGB format does not support the storage usage of the image, so the view leaves it out.
+    out->view = create_image_view(r->device, out->image, TEXTURE_SAMPLED_FORMAT, 0, level_count, VK_IMAGE_USAGE_SAMPLED_BIT);
+    return out->view != NULL;
+}
+
+static void destroy_texture_image(VkDevice device, allocator *allocator, texture_image *texture) {
+    vkDestroyImageView(device, texture->view, NULL);
+    vkDestroyImage(device, texture->image, NULL);
+    allocator_free(allocator, &texture->memory);
+}
+
+// Creates an image for every texture of the scene and one for the white texel, and stages their first levels for
+// upload_textures(), which runs once the command buffer exists. Textures are never updated afterwards.
+static bool create_textures(renderer *r, const scene *s) {
+    static const uint8_t white_texel[4] = { 255, 255, 255, 255 };
+
+    if(s->texture_count > MAX_TEXTURE_COUNT) {
+        fprintf(stderr, "The scene has %u textures, at most %u are supported\n", s->texture_count, MAX_TEXTURE_COUNT);
+        return false;
+    }
+
+    if(!validate_material_textures(s, s->texture_count)) {
+        return false;
+    }
+
+    r->texture_count = s->texture_count;
+    r->textures = calloc(r->texture_count + 1, sizeof(texture_image));
+    if(!r->textures) {
+        return false;
+    }
+
+    VkDeviceSize staging_size = sizeof(white_texel);
+    for(uint32_t i = 0; i < s->texture_count; i++) {
+        staging_size += (VkDeviceSize)s->textures[i].width * s->textures[i].height * 4;
+    }
+
+    r->texture_staging_buffer = create_staging_buffer(&r->allocator, staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ALLOCATION_STRATEGY_LINEAR, &r->texture_staging_memory);
+    if(!r->texture_staging_buffer) {
+        return false;
+    }
+
+    uint8_t *mapped = r->texture_staging_memory.mapped;
+    VkDeviceSize offset = 0;
+    r->texture_hash = 0;
+    for(uint32_t i = 0; i <= r->texture_count; i++) {
+        bool white = i == r->texture_count;
+        const uint32_t size[] = { white ? 1 : s->textures[i].width, white ? 1 : s->textures[i].height };
+        const uint8_t *pixels = white ? white_texel : s->textures[i].pixels;
+        if(!create_texture_image(r, size[0], size[1], &r->textures[i])) {
+            return false;
+        }
+
+        VkDeviceSize bytes = (VkDeviceSize)size[0] * size[1] * 4;
+        memcpy(mapped + offset, pixels, bytes);
+        r->texture_hash = hash_bytes(size, sizeof(size), r->texture_hash);
+        r->texture_hash = hash_bytes(pixels, bytes, r->texture_hash);
+        offset += bytes;
+    }
+
+    allocator_flush(&r->allocator, &r->texture_staging_memory, 0, VK_WHOLE_SIZE);
+
+    // The trace shader picks the level itself, the sampler blends between the two closest.
+    const VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .maxLod = VK_LOD_CLAMP_NONE,
+    };
+
+    VkResult result = vkCreateSampler(r->device, &sampler_info, NULL, &r->texture_sampler);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture sampler: %s\n", string_VkResult(result));
+        return false;
+    }
+
+    return true;
+}
+
+// Size of one RGBA texel of the accumulation, guide and denoise images.
+static VkDeviceSize get_float_texel_size(const renderer *r) {
+    return r->precision == RENDER_PRECISION_HALF ? 4 * sizeof(uint16_t) : 4 * sizeof(float);
+}
+
+static float half_to_float(uint16_t half) {
+    uint32_t exponent = (half >> 10) & 0x1Fu;
+    uint32_t mantissa = half & 0x3FFu;
+
+    float value;
+    if(exponent == 0) {
+        value = ldexpf((float)mantissa, -24);
+    } else if(exponent == 31) {
+        value = mantissa ? NAN : INFINITY;
+    } else {
+        value = ldexpf((float)(mantissa | 0x400u), (int)exponent - 25);
+    }
+
+    return (half & 0x8000u) ? -value : value;
+}
+
+// Rounds to nearest even, like the GPU does when storing to a half float image.
+static uint16_t float_to_half(float value) {
+    uint16_t sign = signbit(value) ? 0x8000u : 0;
+    float magnitude = fabsf(value);
+
+    if(isnan(value)) {
+        return sign | 0x7E00u;
+    }
+
+    // Everything from halfway between the largest half and the next power of two up rounds to infinity.
+    if(magnitude >= 65520.0f) {
+        return sign | 0x7C00u;
+    }
+
+    // Subnormals count in units of 2^-24. Rounding up to 0x400 yields the smallest normal, which is still correct.
+    if(magnitude < 0x1p-14f) {
+        return sign | (uint16_t)lrintf(magnitude * 0x1p24f);
+    }
+
+    int exponent;
+    float fraction = frexpf(magnitude, &exponent);
+    uint32_t mantissa = (uint32_t)lrintf(fraction * 2048.0f);
+    int biased_exponent = exponent - 1 + 15;
+    if(mantissa == 2048) {
+        mantissa = 1024;
+        biased_exponent++;
+    }
+
+    return sign | (uint16_t)((biased_exponent << 10) | (mantissa & 0x3FFu));
+}
+
+// Converts texels of either float image format to RGBA32F, multiplied by scale.
+static void unpack_texels(const uint8_t *source, render_precision precision, size_t texel_count, float scale, float *out) {
+    if(precision == RENDER_PRECISION_HALF) {
+        const uint16_t *halves = (const uint16_t *)source;
+        for(size_t i = 0; i < texel_count * 4; i++) {
+            out[i] = half_to_float(halves[i]) * scale;
+        }
+    } else if(scale == 1.0f) {
+        memcpy(out, source, texel_count * 4 * sizeof(float));
+    } else {
+        const float *floats = (const float *)source;
+        for(size_t i = 0; i < texel_count * 4; i++) {
+            out[i] = floats[i] * scale;
+        }
+    }
+}
+
+static void pack_texels(const float *source, render_precision precision, size_t texel_count, float scale, uint8_t *out) {
+    if(precision == RENDER_PRECISION_HALF) {
+        uint16_t *halves = (uint16_t *)out;
+        for(size_t i = 0; i < texel_count * 4; i++) {
+            halves[i] = float_to_half(source[i] * scale);
+        }
+    } else if(scale == 1.0f) {
+        memcpy(out, source, texel_count * 4 * sizeof(float));
+    } else {
+        float *floats = (float *)out;
+        for(size_t i = 0; i < texel_count * 4; i++) {
+            floats[i] = source[i] * scale;
+        }
+    }
+}
+
+static staging_layout get_staging_layout(const renderer *r, bool aovs) {
+    VkDeviceSize pixel_count = (VkDeviceSize)r->width * r->band_height;
+
+    staging_layout layout = {
+        .output_offset = 0,
+        .size = pixel_count * 4,
+    };
+
+    if(aovs) {
+        layout.albedo_offset = layout.size;
+        layout.normal_depth_offset = layout.albedo_offset + pixel_count * get_float_texel_size(r);
+        layout.hit_id_offset = layout.normal_depth_offset + pixel_count * get_float_texel_size(r);
+        layout.size = layout.hit_id_offset + pixel_count * sizeof(uint32_t);
+    }
+
+    if(r->cost_buffer) {
+        layout.cost_offset = layout.size;
+        layout.size += pixel_count * COST_SIZE;
+    }
+
+    layout.stats_offset = layout.size;
+    layout.size += STATS_COUNTER_COUNT * sizeof(uint32_t);
+    return layout;
+}
+
+// The checkpoint buffer holds the accumulation, albedo and normal/depth images back to back, in their image format.
+// Checkpoints are only available when the whole image is a single band.
+static VkDeviceSize get_checkpoint_buffer_size(const renderer *r) {
+    return (VkDeviceSize)r->width * r->height * get_float_texel_size(r) * 3;
+}
+
+// Copies the accumulated state into the checkpoint buffer, or back out of it when resuming.
+static void record_checkpoint_copy(VkCommandBuffer command_buffer, const renderer *r, bool upload) {
+    const storage_image *images[] = { &r->accumulation, &r->albedo, &r->normal_depth };
+    VkDeviceSize image_size = (VkDeviceSize)r->width * r->height * get_float_texel_size(r);
+
+    for(uint32_t i = 0; i < ARRAY_LENGTH(images); i++) {
+        const VkBufferImageCopy region = {
+            .bufferOffset = image_size * i,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .imageSubresource.mipLevel = 0,
+            .imageSubresource.baseArrayLayer = 0,
+            .imageSubresource.layerCount = 1,
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {r->width, r->height, 1},
+        };
+
+        // Transfers are allowed in the GENERAL layout, which saves transitioning the images back and forth.
+        if(upload) {
+            vkCmdCopyBufferToImage(command_buffer, r->checkpoint_buffer, images[i]->image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+        } else {
+            vkCmdCopyImageToBuffer(command_buffer, images[i]->image, VK_IMAGE_LAYOUT_GENERAL, r->checkpoint_buffer, 1, &region);
+        }
+    }
+
+    // The checkpoint is written out from the mapped buffer once the submission is done.
+    if(!upload) {
+        memory_barrier(command_buffer,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+    }
+}
+
+// Keeps the even bits of value and packs them into the low half.
+static uint32_t compact_bits(uint32_t value) {
+    value &= 0x55555555u;
+    value = (value | (value >> 1)) & 0x33333333u;
+    value = (value | (value >> 2)) & 0x0F0F0F0Fu;
+    value = (value | (value >> 4)) & 0x00FF00FFu;
+    value = (value | (value >> 8)) & 0x0000FFFFu;
+    return value;
+}
+
+// Position of the index-th cell along a Hilbert curve through a side x side grid, side being a power of two.
+static void hilbert_decode(uint32_t side, uint32_t index, uint32_t *x, uint32_t *y) {
+    *x = 0;
+    *y = 0;
+    for(uint32_t s = 1; s < side; s *= 2) {
+        uint32_t rx = 1 & (index / 2);
+        uint32_t ry = 1 & (index ^ rx);
+        if(ry == 0) {
+            if(rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+
+            uint32_t t = *x;
+            *x = *y;
+            *y = t;
+        }
+
+        *x += s * rx;
+        *y += s * ry;
+        index /= 4;
+    }
+}
+
+// Walks both curves over the smallest power of two square around the tile grid and keeps the tiles inside it.
+// order receives the Morton order followed by the Hilbert order, each tile packed as x | y << 16.
+static void build_tile_order(uint32_t tiles_x, uint32_t tiles_y, uint32_t *order) {
+    uint32_t side = 1;
+    while(side < tiles_x || side < tiles_y) {
+        side *= 2;
+    }
+
+    uint32_t morton_count = 0;
+    uint32_t hilbert_count = 0;
+    uint32_t *hilbert_order = order + tiles_x * tiles_y;
+    for(uint32_t i = 0; i < side * side; i++) {
+        uint32_t x = compact_bits(i);
+        uint32_t y = compact_bits(i >> 1);
+        if(x < tiles_x && y < tiles_y) {
+            order[morton_count++] = x | y << 16;
+        }
+
+        hilbert_decode(side, i, &x, &y);
+        if(x < tiles_x && y < tiles_y) {
+            hilbert_order[hilbert_count++] = x | y << 16;
+        }
+    }
+}
+
+// Everything but the pass, sample and wavefront stage.
+static trace_push_constants get_trace_push_constants(const renderer *r, const render_settings *settings, uint32_t band_offset) {
+    // The camera was validated by renderer_render(), so the basis always exists.
+    trace_push_constants trace_constants = {0};
+    camera_basis(&settings->camera, trace_constants.camera_right, trace_constants.camera_up, trace_constants.camera_forward);
+    memcpy(trace_constants.camera_position, settings->camera.position, sizeof(settings->camera.position));
+    trace_constants.camera_position[3] = tanf(settings->camera.fov * 0.5f * 3.14159265358979f / 180.0f);
+    trace_constants.band_offset = band_offset;
+    trace_constants.image_height = r->height;
+    trace_constants.pixel_order = settings->pixel_order;
+    return trace_constants;
+}
+
+static void set_pass_push_constants(trace_push_constants *trace_constants, const render_settings *settings, uint32_t pass, uint32_t end_pass) {
+    uint32_t sample_offset = pass * settings->samples_per_pass;
+    uint32_t remaining = settings->samples_per_pixel - sample_offset;
+    trace_constants->sample_offset = sample_offset;
+    trace_constants->sample_count = remaining < settings->samples_per_pass ? remaining : settings->samples_per_pass;
+    trace_constants->count_convergence = pass + 1 == end_pass;
+}
+
+// The next stage may read the ray counts as dispatch arguments.
+static void wavefront_barrier(VkCommandBuffer command_buffer) {
+    memory_barrier(command_buffer,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+}
+
+static void record_wavefront_stage(VkCommandBuffer command_buffer, const renderer *r, trace_push_constants *trace_constants, uint32_t stage, uint32_t group_count) {
+    trace_constants->stage = stage;
+    vkCmdPushConstants(command_buffer, r->trace_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*trace_constants), trace_constants);
+    vkCmdDispatch(command_buffer, group_count, 1, 1);
+    wavefront_barrier(command_buffer);
+}
+
+// Dispatches one invocation per ray queued in the given half, the count is only known on the device.
+static void record_wavefront_stage_indirect(VkCommandBuffer command_buffer, const renderer *r, trace_push_constants *trace_constants, uint32_t stage, uint32_t queue_half) {
+    trace_constants->stage = stage;
+    vkCmdPushConstants(command_buffer, r->trace_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*trace_constants), trace_constants);
+    vkCmdDispatchIndirect(command_buffer, r->wavefront_control_buffer, WAVEFRONT_DISPATCH_ARGS_OFFSET + queue_half * sizeof(VkDispatchIndirectCommand));
+    wavefront_barrier(command_buffer);
+}
+
+// The wavefront counterpart of record_trace_passes(). Paths are traced one sample at a time: the camera rays of every
+// pixel are queued, then each bounce traces one half of the queue and appends the continuations to the other.
+// Sorting counts the rays per bin, scans the counts and scatters the rays back into the traced half.
+static void record_wavefront_passes(VkCommandBuffer command_buffer, const renderer *r, const render_settings *settings,
+    uint32_t band_offset, uint32_t band_rows, uint32_t first_pass, uint32_t end_pass) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->wavefront_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->trace_pipeline_layout, 0, 1, &r->descriptor_set, 0, NULL);
+
+    uint32_t pixel_groups = (r->width * band_rows + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+    bool sort = settings->trace_mode == TRACE_MODE_WAVEFRONT_SORTED;
+
+    trace_push_constants trace_constants = get_trace_push_constants(r, settings, band_offset);
+    for(uint32_t pass = first_pass; pass < end_pass; pass++) {
+        set_pass_push_constants(&trace_constants, settings, pass, end_pass);
+
+        for(uint32_t sample = 0; sample < trace_constants.sample_count; sample++) {
+            trace_constants.pass_sample = sample;
+            trace_constants.bounce = 0;
+            trace_constants.queue_half = 0;
+            record_wavefront_stage(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_GENERATE, pixel_groups);
+
+            // Bounces past the end of the longest path dispatch zero workgroups.
+            for(uint32_t bounce = 0; bounce < WAVEFRONT_BOUNCE_COUNT; bounce++) {
+                trace_constants.bounce = bounce;
+                record_wavefront_stage_indirect(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_EXTEND, trace_constants.queue_half);
+                if(bounce + 1 == WAVEFRONT_BOUNCE_COUNT) {
+                    break;
+                }
+
+                record_wavefront_stage(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_PREPARE, 1);
+                if(sort) {
+                    record_wavefront_stage_indirect(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_COUNT_BINS, 1 - trace_constants.queue_half);
+                    record_wavefront_stage(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_SCAN_BINS, 1);
+                    record_wavefront_stage_indirect(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_SCATTER, trace_constants.queue_half);
+                } else {
+                    trace_constants.queue_half = 1 - trace_constants.queue_half;
+                }
+            }
+        }
+
+        record_wavefront_stage(command_buffer, r, &trace_constants, WAVEFRONT_STAGE_FINISH, pixel_groups);
+    }
+}
+
+// Records the sample passes [first_pass, end_pass) over the rows [band_offset, band_offset + band_rows).
+static void record_trace_passes(VkCommandBuffer command_buffer, const renderer *r, const render_settings *settings,
+    uint32_t band_offset, uint32_t band_rows, uint32_t first_pass, uint32_t end_pass) {
+    if(settings->trace_mode != TRACE_MODE_MEGAKERNEL) {
+        record_wavefront_passes(command_buffer, r, settings, band_offset, band_rows, first_pass, end_pass);
+        return;
+    }
+
+    VkPipeline pipeline = settings->cost_view != COST_VIEW_NONE ? r->cost_pipeline : r->trace_pipeline;
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->trace_pipeline_layout, 0, 1, &r->descriptor_set, 0, NULL);
+
+    uint32_t num_work_groups_width = (r->width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    uint32_t num_work_groups_height = (band_rows + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+
+    // Curve orders look their tile up by the workgroup index, which needs a one-dimensional dispatch over the
+    // tiles of a full band. Tiles past the rows of a shorter last band return right away.
+    if(settings->pixel_order != PIXEL_ORDER_LINEAR) {
+        num_work_groups_width = r->tiles_x * r->tiles_y;
+        num_work_groups_height = 1;
+    }
+
+    // Each pass adds its samples to the accumulation image, so passes have to be serialized.
+    trace_push_constants trace_constants = get_trace_push_constants(r, settings, band_offset);
+    for(uint32_t pass = first_pass; pass < end_pass; pass++) {
+        set_pass_push_constants(&trace_constants, settings, pass, end_pass);
+
+        vkCmdPushConstants(command_buffer, r->trace_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(trace_constants), &trace_constants);
+        vkCmdDispatch(command_buffer, num_work_groups_width, num_work_groups_height, 1);
+        compute_barrier(command_buffer);
+    }
+}
+
+// Records the optional denoiser, the resolve pass and the readback of the first band_rows rows into the staging buffer.
+static void record_resolve(VkCommandBuffer command_buffer, const renderer *r, const render_settings *settings, uint32_t band_rows, uint32_t sample_count) {
+    // The heatmap takes the place of the denoiser and the resolve pass. The costs are sums in every precision.
+    bool cost_view = settings->cost_view != COST_VIEW_NONE;
+    if(cost_view) {
+        const heatmap_push_constants heatmap_constants = {
+            .sample_count = sample_count,
+            .cost_view = settings->cost_view,
+            .pixel_count = r->width * band_rows,
+        };
+
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->heatmap_pipeline);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->heatmap_pipeline_layout, 0, 1, &r->descriptor_set, 0, NULL);
+        vkCmdPushConstants(command_buffer, r->heatmap_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(heatmap_constants), &heatmap_constants);
+        vkCmdDispatch(command_buffer, (r->width + 15) / 16, (band_rows + 15) / 16, 1);
+    }
+
+    // Half precision images already hold averages.
+    if(r->precision == RENDER_PRECISION_HALF) {
+        sample_count = 1;
+    }
+
+    resolve_push_constants resolve_constants = {
+        .sample_count = sample_count,
+        .exposure = powf(2.0f, settings->exposure),
+        .tonemap = settings->tonemap,
+        .source = RESOLVE_SOURCE_ACCUMULATION,
+    };
+
+    if(!cost_view && settings->denoise && settings->denoise_iterations > 0) {
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->denoise_pipeline);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->denoise_pipeline_layout, 0, 1, &r->descriptor_set, 0, NULL);
+
+        // Iteration i filters with a step width of 2^i. Even iterations write the ping image, odd ones the pong image.
+        for(uint32_t iteration = 0; iteration < settings->denoise_iterations; iteration++) {
+            const denoise_push_constants denoise_constants = {
+                .sample_count = sample_count,
+                .iteration = iteration,
+                .sigma_color = 4.0f,
+                .sigma_normal = 0.1f,
+                .sigma_depth = 0.5f,
+                .sigma_albedo = 0.1f,
+            };
+
+            vkCmdPushConstants(command_buffer, r->denoise_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(denoise_constants), &denoise_constants);
+            vkCmdDispatch(command_buffer, (r->width + 15) / 16, (band_rows + 15) / 16, 1);
+            compute_barrier(command_buffer);
+        }
+
+        resolve_constants.sample_count = 1;
+        resolve_constants.source = (settings->denoise_iterations % 2 == 1) ? RESOLVE_SOURCE_DENOISE_PING : RESOLVE_SOURCE_DENOISE_PONG;
+    }
+
+    if(!cost_view) {
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->resolve_pipeline);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->resolve_pipeline_layout, 0, 1, &r->descriptor_set, 0, NULL);
+        vkCmdPushConstants(command_buffer, r->resolve_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(resolve_constants), &resolve_constants);
+        vkCmdDispatch(command_buffer, (r->width + 15) / 16, (band_rows + 15) / 16, 1);
+    }
+
+    // The beauty image and the AOVs are read back together, behind a single barrier.
+    staging_layout layout = get_staging_layout(r, r->aovs_enabled);
+    const storage_image *readback_images[] = { &r->output, &r->albedo, &r->normal_depth, &r->hit_id };
+    const VkDeviceSize readback_offsets[] = { layout.output_offset, layout.albedo_offset, layout.normal_depth_offset, layout.hit_id_offset };
+    uint32_t readback_count = settings->read_aovs ? ARRAY_LENGTH(readback_images) : 1;
+
+    VkImageMemoryBarrier readback_barriers[ARRAY_LENGTH(readback_images)];
+    for(uint32_t i = 0; i < readback_count; i++) {
+        readback_barriers[i] = (VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = readback_images[i]->image,
+            .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .subresourceRange.baseMipLevel = 0,
+            .subresourceRange.levelCount = 1,
+            .subresourceRange.baseArrayLayer = 0,
+            .subresourceRange.layerCount = 1,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        };
+    }
+
+    // Covers the counter atomics of every trace pass and the cost sums as well.
+    const VkMemoryBarrier stats_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+
+    vkCmdPipelineBarrier(
+        command_buffer, 
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 
+        0, 
+        1, &stats_barrier, 
+        0, NULL, 
+        readback_count, readback_barriers
+    );
+
+    const VkBufferCopy stats_region = {
+        .srcOffset = 0,
+        .dstOffset = layout.stats_offset,
+        .size = STATS_COUNTER_COUNT * sizeof(uint32_t),
+    };
+
+    vkCmdCopyBuffer(command_buffer, r->stats_buffer, r->staging_buffer, 1, &stats_region);
+
+    if(cost_view) {
+        const VkBufferCopy cost_region = {
+            .srcOffset = 0,
+            .dstOffset = layout.cost_offset,
+            .size = (VkDeviceSize)r->width * band_rows * COST_SIZE,
+        };
+
+        vkCmdCopyBuffer(command_buffer, r->cost_buffer, r->staging_buffer, 1, &cost_region);
+    }
+
+    for(uint32_t i = 0; i < readback_count; i++) {
+        const VkBufferImageCopy region = {
+            .bufferOffset = readback_offsets[i],
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .imageSubresource.mipLevel = 0,
+            .imageSubresource.baseArrayLayer = 0,
+            .imageSubresource.layerCount = 1,
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {r->width, band_rows, 1},
+        };
+
+        vkCmdCopyImageToBuffer(command_buffer, readback_images[i]->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, r->staging_buffer, 1, &region);
+    }
+
+    memory_barrier(command_buffer,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+}
+
+// Times the commands recorded until end_gpu_range(), from the top of the pipe to the bottom, so waiting on the
+// barriers in between counts towards the range. Ranges past GPU_RANGE_CAPACITY in one submission are not timed.
+static void begin_gpu_range(VkCommandBuffer command_buffer, const renderer *r, const char *name) {
+    gpu_timeline *timeline = r->gpu_timeline;
+    if(!timeline || !timeline_enabled() || timeline->range_open || timeline->range_count == GPU_RANGE_CAPACITY) {
+        return;
+    }
+
+    if(timeline->range_count == 0) {
+        vkCmdResetQueryPool(command_buffer, timeline->query_pool, 0, 2 * GPU_RANGE_CAPACITY);
+    }
+
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timeline->query_pool, 2 * timeline->range_count);
+    timeline->names[timeline->range_count] = name;
+    timeline->range_open = true;
+}
+
+static void end_gpu_range(VkCommandBuffer command_buffer, const renderer *r) {
+    gpu_timeline *timeline = r->gpu_timeline;
+    if(!timeline || !timeline->range_open) {
+        return;
+    }
+
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timeline->query_pool, 2 * timeline->range_count + 1);
+    timeline->range_count++;
+    timeline->range_open = false;
+}
+
+// Converts the timestamps of a finished submission to timeline time, relative to a device and a host time taken
+// together. Without calibrated timestamps the end of the last range stands in for wait_end, when the fence wait
+// returned, which places the ranges slightly late.
+static void add_gpu_ranges(const renderer *r, uint32_t range_count, double wait_end) {
+    gpu_timeline *timeline = r->gpu_timeline;
+    uint64_t timestamps[2 * GPU_RANGE_CAPACITY];
+    VkResult result = vkGetQueryPoolResults(r->device, timeline->query_pool, 0, 2 * range_count, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if(result != VK_SUCCESS) {
+        return;
+    }
+
+    uint64_t device_time = timestamps[2 * range_count - 1];
+    double host_time = wait_end;
+    if(timeline->get_calibrated_timestamps) {
+        const VkCalibratedTimestampInfoEXT infos[] = {
+            { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+            { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT },
+        };
+
+        uint64_t calibrated[2];
+        uint64_t max_deviation;
+        if(timeline->get_calibrated_timestamps(r->device, 2, infos, calibrated, &max_deviation) == VK_SUCCESS) {
+            device_time = calibrated[0];
+            host_time = (double)calibrated[1] * 1e-9;
+        }
+    }
+
+    // Differences are taken within the valid bits, so a counter that wrapped since a range still works out.
+    for(uint32_t i = 0; i < range_count; i++) {
+        double start = host_time - (double)((device_time - timestamps[2 * i]) & timeline->valid_mask) * timeline->tick_period;
+        double end = host_time - (double)((device_time - timestamps[2 * i + 1]) & timeline->valid_mask) * timeline->tick_period;
+        timeline_add_gpu(timeline->names[i], start, end);
+    }
+}
+
+static bool submit_and_wait(const renderer *r) {
+    VkCommandBuffer command_buffer = r->command_buffer;
+
+    // The next recording starts its ranges over, whether this submission succeeds or not.
+    uint32_t gpu_range_count = 0;
+    if(r->gpu_timeline) {
+        gpu_range_count = r->gpu_timeline->range_count;
+        r->gpu_timeline->range_count = 0;
+        r->gpu_timeline->range_open = false;
+    }
+
+    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to end recording command buffers");
+        return false;
+    }
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+
+    vkResetFences(r->device, 1, &r->fence);
+    timeline_zone submit_zone = timeline_zone_begin("vkQueueSubmit");
+    VkResult submit_result = vkQueueSubmit(r->compute_queue, 1, &submit_info, r->fence);
+    timeline_zone_end(&submit_zone);
+    if(submit_result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to submit command buffers");
+        return false;
+    }
+
+    timeline_zone wait_zone = timeline_zone_begin("vkWaitForFences");
+    VkResult wait_result = vkWaitForFences(r->device, 1, &r->fence, VK_TRUE, UINT64_MAX);
+    timeline_zone_end(&wait_zone);
+    if(wait_result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to wait for fences: %s\n", string_VkResult(wait_result));
+        return false;
+    }
+
+    if(gpu_range_count > 0 && timeline_enabled()) {
+        add_gpu_ranges(r, gpu_range_count, timeline_time());
+    }
+
+    return true;
+}
+
+static void record_lbvh_stage(VkCommandBuffer command_buffer, const renderer *r, lbvh_push_constants *lbvh_constants, uint32_t stage, uint32_t group_count) {
+    lbvh_constants->stage = stage;
+    vkCmdPushConstants(command_buffer, r->lbvh_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*lbvh_constants), lbvh_constants);
+    vkCmdDispatch(command_buffer, group_count, 1, 1);
+    compute_barrier(command_buffer);
+}
+
+// Copies the staged regions into the scene buffer and waits, so the ring can be filled from its start again.
+static bool flush_scene_upload(const renderer *r, scene_upload *upload) {
+    if(upload->region_count == 0) {
+        return true;
+    }
+
+    allocator_flush(&r->allocator, &r->scene_staging_memory, 0, VK_WHOLE_SIZE);
+
+    VkCommandBuffer command_buffer = r->command_buffer;
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to begin recording command buffers");
+        return false;
+    }
+
+    begin_gpu_range(command_buffer, r, "scene upload");
+    vkCmdCopyBuffer(command_buffer, r->scene_staging_buffer, r->scene_buffer, upload->region_count, upload->regions);
+    end_gpu_range(command_buffer, r);
+
+    // Traversal reads the sections, lbvh.comp reads the primitives and writes the BLAS nodes.
+    memory_barrier(command_buffer,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    upload->region_count = 0;
+    upload->ring_used = 0;
+    return submit_and_wait(r);
+}
+
+// Stages size bytes for the scene buffer at offset, flushing whenever the ring or the copy regions run out.
+static bool stage_scene_bytes(const renderer *r, scene_upload *upload, VkDeviceSize offset, const uint8_t *data, VkDeviceSize size) {
+    while(size > 0) {
+        if(upload->ring_used == r->scene_staging_size || upload->region_count == SCENE_UPLOAD_MAX_REGIONS) {
+            if(!flush_scene_upload(r, upload)) {
+                return false;
+            }
+        }
+
+        VkDeviceSize chunk = r->scene_staging_size - upload->ring_used;
+        chunk = chunk < size ? chunk : size;
+        memcpy((uint8_t *)r->scene_staging_memory.mapped + upload->ring_used, data, chunk);
+        upload->regions[upload->region_count++] = (VkBufferCopy){
+            .srcOffset = upload->ring_used,
+            .dstOffset = offset,
+            .size = chunk,
+        };
+
+        upload->ring_used += chunk;
+        upload->bytes += chunk;
+        offset += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+// Uploads every section, from the shadow copy or straight out of the scene file's mapping. The first sections of a
+// scene file are those of the scene buffer in its layout, and the hash written with it stands in for hashing them.
+static bool upload_scene_buffer(renderer *r, const scene_file *file) {
+    scene_upload upload = {0};
+    for(uint32_t i = 0; i < SCENE_SECTION_COUNT; i++) {
+        if(i == BINDING_BLAS_BUFFER - BINDING_MATERIAL_BUFFER && r->scene_tables.builder == BLAS_BUILDER_GPU) {
+            continue;
+        }
+
+        const uint8_t *source = file
+            ? (const uint8_t *)file->mapping + file->header.section_offsets[SCENE_FILE_MATERIALS + i]
+            : r->scene_shadow + r->scene_section_offsets[i];
+        if(!stage_scene_bytes(r, &upload, r->scene_section_offsets[i], source, r->scene_section_ranges[i])) {
+            return false;
+        }
+    }
+
+    if(file) {
+        r->scene_hash = hash_bytes(&file->header.content_hash, sizeof(file->header.content_hash), r->texture_hash);
+    }
+
+    return flush_scene_upload(r, &upload);
+}
+
+// Brings the shadow copy of section up to date over [start, end) and stages that range.
+static bool stage_scene_range(renderer *r, scene_upload *upload, uint32_t section, const uint8_t *source, VkDeviceSize start, VkDeviceSize end) {
+    VkDeviceSize offset = r->scene_section_offsets[section] + start;
+    memcpy(r->scene_shadow + offset, source + start, end - start);
+    upload->range_count++;
+    upload->changed_sections |= 1u << section;
+    return stage_scene_bytes(r, upload, offset, source + start, end - start);
+}
+
+// Compares every section with the shadow copy and uploads the blocks that changed, so moving a few primitives or
+// editing a material copies a few ranges instead of the whole scene. The scene hash only changes with the contents.
+static bool upload_scene_changes(renderer *r, const scene *s, scene_upload *upload) {
+    const void *sources[SCENE_SECTION_COUNT];
+    get_scene_sources(r, s, sources);
+    for(uint32_t i = 0; i < SCENE_SECTION_COUNT; i++) {
+        if(!sources[i]) {
+            continue;
+        }
+
+        const uint8_t *source = sources[i];
+        const uint8_t *shadow = r->scene_shadow + r->scene_section_offsets[i];
+        VkDeviceSize size = r->scene_section_ranges[i];
+
+        // The pending range is [start, end), empty while start == end.
+        VkDeviceSize start = 0;
+        VkDeviceSize end = 0;
+        for(VkDeviceSize block = 0; block < size; block += SCENE_DIRTY_BLOCK_SIZE) {
+            VkDeviceSize block_size = size - block < SCENE_DIRTY_BLOCK_SIZE ? size - block : SCENE_DIRTY_BLOCK_SIZE;
+            if(memcmp(source + block, shadow + block, block_size) == 0) {
+                continue;
+            }
+
+            if(end > start && block - end >= SCENE_DIRTY_MERGE_GAP) {
+                if(!stage_scene_range(r, upload, i, source, start, end)) {
+                    return false;
+                }
+
+                start = end;
+            }
+
+            if(start == end) {
+                start = block;
+            }
+
+            end = block + block_size;
+        }
+
+        if(end > start && !stage_scene_range(r, upload, i, source, start, end)) {
+            return false;
+        }
+    }
+
+    if(upload->changed_sections) {
+        r->scene_hash = hash_scene_shadow(r);
+    }
+
+    return flush_scene_upload(r, upload);
+}
+
+// Copies a section of the scene buffer back through the ring, for the nodes only the device has.
+static bool read_scene_section(const renderer *r, uint32_t section, void *out) {
+    VkCommandBuffer command_buffer = r->command_buffer;
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VkDeviceSize size = r->scene_section_ranges[section];
+    for(VkDeviceSize done = 0; done < size;) {
+        VkDeviceSize chunk = size - done < r->scene_staging_size ? size - done : r->scene_staging_size;
+        if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to begin recording command buffers");
+            return false;
+        }
+
+        const VkBufferCopy region = {
+            .srcOffset = r->scene_section_offsets[section] + done,
+            .dstOffset = 0,
+            .size = chunk,
+        };
+
+        vkCmdCopyBuffer(command_buffer, r->scene_buffer, r->scene_staging_buffer, 1, &region);
+        memory_barrier(command_buffer,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+
+        if(!submit_and_wait(r)) {
+            return false;
+        }
+
+        allocator_invalidate(&r->allocator, &r->scene_staging_memory);
+        memcpy((uint8_t *)out + done, r->scene_staging_memory.mapped, chunk);
+        done += chunk;
+    }
+
+    return true;
+}
+
+// Replaces the BLAS built on the GPU with ones from the host SAH builder, for the rest of the renderer's life. Those
+// reorder the primitives, so they are uploaded again along with the nodes.
+static bool use_host_blas(renderer *r, const scene *s) {
+    scene_tables tables;
+    if(!scene_build_tables(s, BLAS_BUILDER_SAH, r->scene_tables.thread_count, &tables)) {
+        return false;
+    }
+
+    scene_tables_free(&r->scene_tables);
+    r->scene_tables = tables;
+
+    // The shadow copy never held the nodes built on the GPU, so the section is staged whole instead of compared.
+    const uint32_t section = BINDING_BLAS_BUFFER - BINDING_MATERIAL_BUFFER;
+    scene_upload upload = {0};
+    return stage_scene_range(r, &upload, section, (const uint8_t *)r->scene_tables.blas_nodes, 0, r->scene_section_ranges[section]) &&
+           upload_scene_changes(r, s, &upload);
+}
+
+// Builds the BLAS of every object with lbvh.comp, one object after another as they share the scratch buffer.
+// Uploads the primitive bounds first, so it also serves the updates. Waits for the build, then reads back the depth
+// of the deepest leaf, which nothing bounds in a linear BVH. Trees too deep for the traversal stack are replaced by
+// use_host_blas().
+static bool build_gpu_blas(renderer *r, const scene *s) {
+    const scene_tables *tables = &r->scene_tables;
+    memcpy(r->bvh_bounds_memory.mapped, tables->primitive_bounds, tables->primitive_count * sizeof(bvh_bounds));
+    allocator_flush(&r->allocator, &r->bvh_bounds_memory, 0, VK_WHOLE_SIZE);
+
+    VkCommandBuffer command_buffer = r->command_buffer;
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to begin recording command buffers");
+        return false;
+    }
+
+    const VkDeviceSize depth_offset = (get_lbvh_scratch_words(r->bvh_scratch_capacity) - 1) * sizeof(uint32_t);
+    vkCmdFillBuffer(command_buffer, r->bvh_scratch_buffer, depth_offset, sizeof(uint32_t), 0);
+    memory_barrier(command_buffer,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    begin_gpu_range(command_buffer, r, "lbvh build");
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->lbvh_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, r->lbvh_pipeline_layout, 0, 1, &r->descriptor_set, 0, NULL);
+
+    for(uint32_t i = 0; i < tables->object_count; i++) {
+        const scene_object *object = &tables->objects[i];
+        const bvh_bounds *bounds = &tables->object_bounds[i];
+        lbvh_push_constants lbvh_constants = {
+            .first_primitive = object->first_primitive,
+            .primitive_count = object->primitive_count,
+            .blas_root = tables->blas_roots[i],
+            .capacity = r->bvh_scratch_capacity,
+        };
+
+        for(uint32_t axis = 0; axis < 3; axis++) {
+            float extent = bounds->max[axis] - bounds->min[axis];
+            lbvh_constants.bounds_min[axis] = bounds->min[axis];
+            lbvh_constants.bounds_scale[axis] = extent > 0.0f ? 1.0f / extent : 0.0f;
+        }
+
+        uint32_t group_count = (object->primitive_count + LBVH_GROUP_SIZE - 1) / LBVH_GROUP_SIZE;
+        record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_CODES, group_count);
+        for(uint32_t shift = 0; shift < LBVH_KEY_BITS; shift += LBVH_RADIX_BITS) {
+            lbvh_constants.shift = shift;
+            record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_COUNT_DIGITS, group_count);
+            record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_SCAN_DIGITS, 1);
+            record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_SCATTER, group_count);
+        }
+
+        record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_EMIT, group_count);
+        record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_REFIT, group_count);
+        record_lbvh_stage(command_buffer, r, &lbvh_constants, LBVH_STAGE_DEPTH, group_count);
+    }
+
+    end_gpu_range(command_buffer, r);
+
+    // Traversal reads the nodes, renderer_get_build_info() copies them back.
+    memory_barrier(command_buffer,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    // The scene uploads waited for their copies, so the start of the ring is free.
+    const VkBufferCopy depth_region = { .srcOffset = depth_offset, .dstOffset = 0, .size = sizeof(uint32_t) };
+    vkCmdCopyBuffer(command_buffer, r->bvh_scratch_buffer, r->scene_staging_buffer, 1, &depth_region);
+    memory_barrier(command_buffer,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+
+    if(!submit_and_wait(r)) {
+        return false;
+    }
+
+    allocator_invalidate(&r->allocator, &r->scene_staging_memory);
+    uint32_t depth;
+    memcpy(&depth, r->scene_staging_memory.mapped, sizeof(depth));
+    if(depth < BVH_MAX_DEPTH) {
+        return true;
+    }
+
+    fprintf(stderr, "The GPU built a BLAS deeper than the %u levels traversal supports, building them on the host instead\n", BVH_MAX_DEPTH);
+    return use_host_blas(r, s);
+}
+
+static uint64_t get_scene_hash(const renderer *r, const render_settings *settings) {
+    return hash_bytes(&settings->camera, sizeof(settings->camera), r->scene_hash ^ r->trace_hash);
+}
+
+// Identifies the samples in the accumulation image: the scene, trace shader and camera of the checkpoint hash, and
+// the pass size and trace mode the passes were traced with. Exposure, tonemapping and denoising only change the
+// resolve, so the samples are kept across them.
+static uint64_t get_accumulation_hash(const renderer *r, const render_settings *settings) {
+    const uint32_t sampling[] = { settings->samples_per_pass, settings->trace_mode };
+    return hash_bytes(sampling, sizeof(sampling), get_scene_hash(r, settings));
+}
+
+// Hands the contents of the checkpoint buffer to the writer thread, which writes them while rendering continues.
+static void save_checkpoint(const renderer *r, const render_settings *settings, uint32_t pass_index) {
+    checkpoint *snapshot = checkpoint_writer_acquire(settings->checkpoint_writer);
+    if(!snapshot) {
+        printf("Skipping checkpoint, the previous one is still being written\n");
+        return;
+    }
+
+    allocator_invalidate(&r->allocator, &r->checkpoint_memory);
+
+    uint32_t samples_completed = pass_index * settings->samples_per_pass;
+    samples_completed = samples_completed < settings->samples_per_pixel ? samples_completed : settings->samples_per_pixel;
+
+    // Checkpoint files always hold RGBA32F sums, whatever the precision of the images.
+    float scale = r->precision == RENDER_PRECISION_HALF ? (float)samples_completed : 1.0f;
+    size_t pixel_count = (size_t)r->width * r->height;
+    size_t image_size = pixel_count * get_float_texel_size(r);
+    const uint8_t *mapped = r->checkpoint_memory.mapped;
+    unpack_texels(mapped, r->precision, pixel_count, scale, snapshot->accumulation);
+    unpack_texels(mapped + image_size, r->precision, pixel_count, scale, snapshot->albedo);
+    unpack_texels(mapped + image_size * 2, r->precision, pixel_count, scale, snapshot->normal_depth);
+
+    snapshot->header = (checkpoint_header){
+        .magic = CHECKPOINT_MAGIC,
+        .version = CHECKPOINT_VERSION,
+        .width = r->width,
+        .height = r->height,
+        .samples_completed = samples_completed,
+        .samples_per_pass = settings->samples_per_pass,
+        .pass_index = pass_index,
+        .scene_hash = get_scene_hash(r, settings),
+    };
+
+    checkpoint_writer_submit(settings->checkpoint_writer);
+}
+
+static uint64_t read_wide_counter(const uint32_t *counters, uint32_t index) {
+    return (uint64_t)counters[index + 1] << 32 | counters[index];
+}
+
+static void read_ray_stats(const renderer *r, render_stats *stats) {
+    allocator_invalidate(&r->allocator, &r->staging_memory);
+
+    staging_layout layout = get_staging_layout(r, r->aovs_enabled);
+    const uint32_t *counters = (const uint32_t *)((const uint8_t *)r->staging_memory.mapped + layout.stats_offset);
+    stats->rays = read_wide_counter(counters, STATS_RAYS);
+    stats->primitive_tests = read_wide_counter(counters, STATS_PRIMITIVE_TESTS);
+    stats->hits = read_wide_counter(counters, STATS_HITS);
+    stats->node_tests = read_wide_counter(counters, STATS_NODE_TESTS);
+    stats->escaped_paths = read_wide_counter(counters, STATS_ESCAPED_PATHS);
+    stats->bounce_limited_paths = read_wide_counter(counters, STATS_BOUNCE_LIMITED_PATHS);
+    stats->unconverged_pixels = counters[STATS_UNCONVERGED_PIXELS];
+    stats->shader_cycles = read_wide_counter(counters, STATS_SHADER_CYCLES) * 256;
+}
+
+// Every band has band_height rows except possibly the last one.
+static uint32_t get_band_rows(const renderer *r, uint32_t band) {
+    uint32_t remaining = r->height - band * r->band_height;
+    return remaining < r->band_height ? remaining : r->band_height;
+}
+
+// resume is optional and must already have been validated against the settings and the renderer. Otherwise the
+// passes before kept_passes are those the accumulation image still holds from the previous render.
+static bool render(const renderer *r, const render_settings *settings, const checkpoint *resume, uint32_t kept_passes, uint32_t band, render_stats *stats) {
+    VkCommandBuffer command_buffer = r->command_buffer;
+
+    uint32_t band_offset = band * r->band_height;
+    uint32_t band_rows = get_band_rows(r, band);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    if(resume) {
+        uint32_t samples_completed = resume->header.samples_completed;
+        float scale = r->precision == RENDER_PRECISION_HALF && samples_completed > 0 ? 1.0f / (float)samples_completed : 1.0f;
+        size_t pixel_count = (size_t)r->width * r->height;
+        size_t image_size = pixel_count * get_float_texel_size(r);
+        uint8_t *mapped = r->checkpoint_memory.mapped;
+        pack_texels(resume->accumulation, r->precision, pixel_count, scale, mapped);
+        pack_texels(resume->albedo, r->precision, pixel_count, scale, mapped + image_size);
+        pack_texels(resume->normal_depth, r->precision, pixel_count, scale, mapped + image_size * 2);
+        allocator_flush(&r->allocator, &r->checkpoint_memory, 0, VK_WHOLE_SIZE);
+    }
+
+    uint32_t pass_count = (settings->samples_per_pixel + settings->samples_per_pass - 1) / settings->samples_per_pass;
+    uint32_t first_pass = resume ? resume->header.pass_index : kept_passes;
+    bool time_budget = settings->time_budget > 0.0;
+
+    // A time budget needs a fence after every pass to measure it, checkpoints need one every checkpoint_interval passes.
+    // Otherwise every pass goes into a single submission together with the resolve.
+    uint32_t passes_per_submit = pass_count;
+    if(time_budget) {
+        passes_per_submit = 1;
+    } else if(settings->checkpoint_writer) {
+        passes_per_submit = settings->checkpoint_interval;
+    }
+
+    double start = get_time();
+    double slowest_submit = 0.0;
+    bool first_submit = true;
+
+    for(uint32_t pass = first_pass;;) {
+        // Passes take roughly the same time, so stop once the slowest one so far would overrun the budget.
+        // At least one pass is always traced, the resolve has nothing to average otherwise.
+        bool out_of_time = time_budget && pass > 0 && get_time() - start + slowest_submit > settings->time_budget;
+
+        uint32_t end_pass = pass_count - pass > passes_per_submit ? pass + passes_per_submit : pass_count;
+        if(out_of_time) {
+            end_pass = pass;
+        }
+
+        bool last = end_pass == pass_count || out_of_time;
+        bool take_checkpoint = !last && settings->checkpoint_writer && (end_pass - first_pass) % settings->checkpoint_interval == 0;
+
+        if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to begin recording command buffers");
+            return false;
+        }
+
+        if(first_submit) {
+            // Previous contents are discarded, every image is fully rewritten by the first pass or the resume copy that touches it.
+            // Kept passes keep the sums in the accumulation, albedo and normal/depth images.
+            const storage_image *storage_images[] = {
+                &r->accumulation, &r->output, &r->albedo, &r->normal_depth, &r->denoise_ping, &r->denoise_pong, &r->hit_id,
+            };
+
+            for(uint32_t i = 0; i < ARRAY_LENGTH(storage_images); i++) {
+                bool aov = storage_images[i] == &r->albedo || storage_images[i] == &r->normal_depth;
+                if(kept_passes > 0 && (aov || storage_images[i] == &r->accumulation)) {
+                    transition_image(command_buffer, storage_images[i]->image,
+                        aov && r->accumulated_aovs_read ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+                    continue;
+                }
+
+                transition_image(command_buffer, storage_images[i]->image,
+                    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                    0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+            }
+
+            if(resume) {
+                record_checkpoint_copy(command_buffer, r, true);
+            }
+        }
+
+        // Rays are counted over the whole render, convergence only by the last pass of each submission.
+        // The previous render copied the counters out and the previous submission added to them.
+        memory_barrier(command_buffer,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        if(first_submit) {
+            vkCmdFillBuffer(command_buffer, r->stats_buffer, 0, VK_WHOLE_SIZE, 0);
+        } else {
+            vkCmdFillBuffer(command_buffer, r->stats_buffer, STATS_UNCONVERGED_PIXELS * sizeof(uint32_t), sizeof(uint32_t), 0);
+        }
+
+        memory_barrier(command_buffer,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        begin_gpu_range(command_buffer, r, "trace passes");
+        record_trace_passes(command_buffer, r, settings, band_offset, band_rows, pass, end_pass);
+        end_gpu_range(command_buffer, r);
+
+        uint32_t samples_completed = end_pass * settings->samples_per_pass;
+        if(samples_completed > settings->samples_per_pixel) {
+            samples_completed = settings->samples_per_pixel;
+        }
+
+        if(last) {
+            begin_gpu_range(command_buffer, r, "resolve and readback");
+            record_resolve(command_buffer, r, settings, band_rows, samples_completed);
+            end_gpu_range(command_buffer, r);
+        } else if(take_checkpoint) {
+            memory_barrier(command_buffer,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            begin_gpu_range(command_buffer, r, "checkpoint copy");
+            record_checkpoint_copy(command_buffer, r, false);
+            end_gpu_range(command_buffer, r);
+        }
+
+        double submit_start = get_time();
+        if(!submit_and_wait(r)) {
+            return false;
+        }
+
+        double submit_time = get_time() - submit_start;
+        if(submit_time > slowest_submit) {
+            slowest_submit = submit_time;
+        }
+
+        if(last) {
+            stats->samples_per_pixel = samples_completed;
+            read_ray_stats(r, stats);
+            break;
+        }
+
+        if(take_checkpoint) {
+            TIMELINE_ZONE("save_checkpoint") {
+                save_checkpoint(r, settings, end_pass);
+            }
+        }
+
+        first_submit = false;
+        pass = end_pass;
+    }
+
+    stats->time = get_time() - start;
+    return true;
+}
+
+const char *renderer_result_string(renderer_result result) {
+    switch(result) {
+    case RENDERER_SUCCESS:
+        return "success";
+    case RENDERER_ERROR_INVALID_ARGUMENT:
+        return "invalid argument";
+    case RENDERER_ERROR_OUT_OF_MEMORY:
+        return "out of memory";
+    case RENDERER_ERROR_INITIALIZATION_FAILED:
+        return "initialization failed";
+    case RENDERER_ERROR_NO_DEVICE:
+        return "no suitable device";
+    case RENDERER_ERROR_MISSING_SHADER:
+        return "missing shader";
+    case RENDERER_ERROR_DEVICE_LOST:
+        return "device lost";
+    case RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT:
+        return "incompatible checkpoint";
+    default:
+        return "unknown error";
+    }
+}
+
+static VkShaderModule load_shader(VkDevice device, const char *directory, const char *name, uint64_t *code_hash) {
+    char path[4096];
+    if(snprintf(path, sizeof(path), "%s/%s", directory, name) >= (int)sizeof(path)) {
+        fprintf(stderr, "Shader path is too long: %s/%s\n", directory, name);
+        return NULL;
+    }
+
+    return create_shader_module(device, path, code_hash);
+}
+
+// mipgen.comp reads one level and writes the next through UNORM views of a single level each.
+static VkDescriptorSetLayout create_mipgen_descriptor_set_layout(VkDevice device) {
+    VkDescriptorSetLayoutBinding bindings[2];
+    for(uint32_t i = 0; i < ARRAY_LENGTH(bindings); i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = ARRAY_LENGTH(bindings),
+        .pBindings = bindings
+    };
+
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkResult result = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_info, NULL, &descriptor_set_layout);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create mipgen descriptor set layout: %s\n", string_VkResult(result));
+        return NULL;
+    }
+
+    return descriptor_set_layout;
+}
+
+// Records the copies of the first levels and one mipgen.comp dispatch per further level. The textures advance one
+// level at a time together, so a single barrier separates the levels of all of them.
+static bool record_texture_upload(const renderer *r, VkPipelineLayout pipeline_layout, VkPipeline pipeline,
+    VkDescriptorPool descriptor_pool, VkDescriptorSetLayout set_layout, const VkImageView *level_views) {
+
+    VkCommandBuffer command_buffer = r->command_buffer;
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to begin recording command buffers");
+        return false;
+    }
+
+    begin_gpu_range(command_buffer, r, "texture upload");
+    VkDeviceSize offset = 0;
+    uint32_t max_level_count = 1;
+    for(uint32_t i = 0; i <= r->texture_count; i++) {
+        const texture_image *texture = &r->textures[i];
+        transition_image(command_buffer, texture->image,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        const VkBufferImageCopy region = {
+            .bufferOffset = offset,
+            .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .imageSubresource.mipLevel = 0,
+            .imageSubresource.baseArrayLayer = 0,
+            .imageSubresource.layerCount = 1,
+            .imageExtent = { texture->width, texture->height, 1 },
+        };
+
+        vkCmdCopyBufferToImage(command_buffer, r->texture_staging_buffer, texture->image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+        offset += (VkDeviceSize)texture->width * texture->height * 4;
+        max_level_count = texture->level_count > max_level_count ? texture->level_count : max_level_count;
+    }
+
+    end_gpu_range(command_buffer, r);
+    memory_barrier(command_buffer,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    begin_gpu_range(command_buffer, r, "mipgen");
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    for(uint32_t level = 1; level < max_level_count; level++) {
+        uint32_t first_view = 0;
+        for(uint32_t i = 0; i <= r->texture_count; i++) {
+            const texture_image *texture = &r->textures[i];
+            if(level < texture->level_count) {
+                VkDescriptorSet descriptor_set = create_descriptor_set(r->device, descriptor_pool, set_layout);
+                if(!descriptor_set) {
+                    return false;
+                }
+
+                VkDescriptorImageInfo image_infos[2];
+                VkWriteDescriptorSet writes[2];
+                for(uint32_t j = 0; j < 2; j++) {
+                    image_infos[j] = (VkDescriptorImageInfo){
+                        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                        .imageView = level_views[first_view + level - 1 + j],
+                    };
+
+                    writes[j] = (VkWriteDescriptorSet){
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = descriptor_set,
+                        .dstBinding = j,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                        .descriptorCount = 1,
+                        .pImageInfo = &image_infos[j],
+                    };
+                }
+
+                vkUpdateDescriptorSets(r->device, ARRAY_LENGTH(writes), writes, 0, NULL);
+                vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_set, 0, NULL);
+
+                uint32_t width = texture->width >> level ? texture->width >> level : 1;
+                uint32_t height = texture->height >> level ? texture->height >> level : 1;
+                vkCmdDispatch(command_buffer, (width + MIPGEN_GROUP_SIZE - 1) / MIPGEN_GROUP_SIZE, (height + MIPGEN_GROUP_SIZE - 1) / MIPGEN_GROUP_SIZE, 1);
+            }
+
+            first_view += texture->level_count;
+        }
+
+        compute_barrier(command_buffer);
+    }
+
+    end_gpu_range(command_buffer, r);
+    return submit_and_wait(r);
+}
+
+// Uploads the textures staged by create_textures() and generates their mip chains on the device. Compute queues
+// cannot blit, so mipgen.comp filters the levels instead. Everything but the textures is released again.
+static renderer_result upload_textures(renderer *r, const char *shader_directory) {
+    VkDevice device = r->device;
+    uint32_t view_count = 0;
+    for(uint32_t i = 0; i <= r->texture_count; i++) {
+        view_count += r->textures[i].level_count;
+    }
+
+    VkShaderModule shader_mod = load_shader(device, shader_directory, "mipgen.comp.spv", NULL);
+    if(!shader_mod) {
+        return RENDERER_ERROR_MISSING_SHADER;
+    }
+
+    VkDescriptorSetLayout set_layout = create_mipgen_descriptor_set_layout(device);
+    VkPipelineLayout pipeline_layout = set_layout ? create_pipeline_layout(device, set_layout, 0) : NULL;
+    VkPipeline pipeline = pipeline_layout ? create_compute_pipeline(device, pipeline_layout, shader_mod) : NULL;
+    vkDestroyShaderModule(device, shader_mod, NULL);
+
+    // One set per generated level, each with the views of the level read and the level written.
+    const VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .descriptorCount = 2 * view_count,
+    };
+
+    const VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+        .maxSets = view_count,
+    };
+
+    VkDescriptorPool descriptor_pool = NULL;
+    VkResult pool_result = vkCreateDescriptorPool(device, &pool_info, NULL, &descriptor_pool);
+    if(pool_result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create mipgen descriptor pool: %s\n", string_VkResult(pool_result));
+        descriptor_pool = NULL;
+    }
+
+    // Indexed by the first level of each texture plus the level.
+    VkImageView *level_views = calloc(view_count, sizeof(VkImageView));
+    bool views_created = level_views != NULL;
+    for(uint32_t i = 0, view = 0; i <= r->texture_count && views_created; i++) {
+        for(uint32_t level = 0; level < r->textures[i].level_count && views_created; level++, view++) {
+            level_views[view] = create_image_view(device, r->textures[i].image, TEXTURE_FORMAT, level, 1, VK_IMAGE_USAGE_STORAGE_BIT);
+            views_created = level_views[view] != NULL;
+        }
+    }
+
+    renderer_result result = RENDERER_SUCCESS;
+    if(!pipeline || !descriptor_pool || !views_created) {
+        result = RENDERER_ERROR_INITIALIZATION_FAILED;
+    } else if(!record_texture_upload(r, pipeline_layout, pipeline, descriptor_pool, set_layout, level_views)) {
+        result = RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    for(uint32_t i = 0; level_views && i < view_count; i++) {
+        vkDestroyImageView(device, level_views[i], NULL);
+    }
+
+    free(level_views);
+    vkDestroyDescriptorPool(device, descriptor_pool, NULL);
+    vkDestroyPipeline(device, pipeline, NULL);
+    vkDestroyPipelineLayout(device, pipeline_layout, NULL);
+    vkDestroyDescriptorSetLayout(device, set_layout, NULL);
+
+    vkDestroyBuffer(device, r->texture_staging_buffer, NULL);
+    allocator_free(&r->allocator, &r->texture_staging_memory);
+    r->texture_staging_buffer = NULL;
+    return result;
+}
+
+static renderer_result create_gpu_timeline(renderer *r, const VkPhysicalDeviceProperties *properties) {
+    uint32_t family_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(r->physical_device, &family_count, NULL);
+
+    VkQueueFamilyProperties *families = malloc(sizeof(VkQueueFamilyProperties) * family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(r->physical_device, &family_count, families);
+    uint32_t valid_bits = families[r->compute_queue_index].timestampValidBits;
+    free(families);
+
+    // Only the GPU ranges are missing then, the host zones are still recorded.
+    if(valid_bits == 0) {
+        fprintf(stderr, "The compute queue has no timestamps, the timeline only shows the host\n");
+        return RENDERER_SUCCESS;
+    }
+
+    r->gpu_timeline = calloc(1, sizeof(gpu_timeline));
+    if(!r->gpu_timeline) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    r->gpu_timeline->tick_period = properties->limits.timestampPeriod * 1e-9;
+    r->gpu_timeline->valid_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+    if(r->calibrated_timestamps_enabled) {
+        r->gpu_timeline->get_calibrated_timestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(r->device, "vkGetCalibratedTimestampsEXT");
+    }
+
+    const VkQueryPoolCreateInfo query_pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * GPU_RANGE_CAPACITY,
+    };
+
+    VkResult result = vkCreateQueryPool(r->device, &query_pool_info, NULL, &r->gpu_timeline->query_pool);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create timestamp query pool: %s\n", string_VkResult(result));
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+static renderer_result create_device_objects(renderer *r, const renderer_create_info *info, const scene *s) {
+    VkDevice device = r->device;
+
+    r->width = info->width ? info->width : DEFAULT_IMAGE_WIDTH;
+    r->height = info->height ? info->height : DEFAULT_IMAGE_HEIGHT;
+    r->band_height = info->band_height && info->band_height < r->height ? info->band_height : r->height;
+    r->band_count = (r->height + r->band_height - 1) / r->band_height;
+    r->precision = info->precision;
+
+    // Only the band has to fit into an image, the full height is never allocated.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(r->physical_device, &properties);
+    uint32_t max_dimension = properties.limits.maxImageDimension2D;
+    if(r->width > max_dimension || r->band_height > max_dimension) {
+        fprintf(stderr, "Images are limited to %u pixels per side, render %ux%u in narrower bands\n", max_dimension, r->width, r->height);
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    // The AOV and checkpoint paths copy whole images at once.
+    if(r->band_count > 1 && (info->enable_aovs || info->enable_checkpoints)) {
+        fprintf(stderr, "AOVs and checkpoints are not available when rendering in bands\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(!allocator_init(&r->allocator, r->physical_device, device, 0)) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    // Checkpoints copy the accumulated state out of and back into these images.
+    const VkImageUsageFlags checkpoint_usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    // The guides double as AOVs, so they can be copied out as well.
+    bool half = r->precision == RENDER_PRECISION_HALF;
+    VkFormat accumulation_format = half ? HALF_FLOAT_FORMAT : ACCUMULATION_FORMAT;
+    VkFormat guide_format = half ? HALF_FLOAT_FORMAT : GUIDE_FORMAT;
+    VkFormat denoise_format = half ? HALF_FLOAT_FORMAT : DENOISE_FORMAT;
+
+    uint32_t width = r->width;
+    uint32_t rows = r->band_height;
+    if(!create_storage_image(device, &r->allocator, accumulation_format, checkpoint_usage, width, rows, &r->accumulation) ||
+       !create_storage_image(device, &r->allocator, OUTPUT_FORMAT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, width, rows, &r->output) ||
+       !create_storage_image(device, &r->allocator, guide_format, checkpoint_usage, width, rows, &r->albedo) ||
+       !create_storage_image(device, &r->allocator, guide_format, checkpoint_usage, width, rows, &r->normal_depth) ||
+       !create_storage_image(device, &r->allocator, HIT_ID_FORMAT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, width, rows, &r->hit_id) ||
+       !create_storage_image(device, &r->allocator, denoise_format, 0, width, rows, &r->denoise_ping) ||
+       !create_storage_image(device, &r->allocator, denoise_format, 0, width, rows, &r->denoise_pong)) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    r->descriptor_set_layout = create_descriptor_set_layout(device, get_texture_slot_count(r));
+    if(!r->descriptor_set_layout) {
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    r->trace_pipeline_layout = create_pipeline_layout(device, r->descriptor_set_layout, sizeof(trace_push_constants));
+    r->denoise_pipeline_layout = create_pipeline_layout(device, r->descriptor_set_layout, sizeof(denoise_push_constants));
+    r->resolve_pipeline_layout = create_pipeline_layout(device, r->descriptor_set_layout, sizeof(resolve_push_constants));
+    r->lbvh_pipeline_layout = create_pipeline_layout(device, r->descriptor_set_layout, sizeof(lbvh_push_constants));
+    r->heatmap_pipeline_layout = create_pipeline_layout(device, r->descriptor_set_layout, sizeof(heatmap_push_constants));
+    if(!r->trace_pipeline_layout || !r->denoise_pipeline_layout || !r->resolve_pipeline_layout || !r->lbvh_pipeline_layout || !r->heatmap_pipeline_layout) {
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    r->descriptor_pool = create_descriptor_pool(device, get_texture_slot_count(r));
+    if(!r->descriptor_pool) {
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    r->descriptor_set = create_descriptor_set(device, r->descriptor_pool, r->descriptor_set_layout);
+    if(!r->descriptor_set) {
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    const VkBufferCreateInfo stats_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = STATS_COUNTER_COUNT * sizeof(uint32_t),
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VkResult stats_result = vkCreateBuffer(device, &stats_buffer_info, NULL, &r->stats_buffer);
+    if(stats_result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create stats buffer: %s\n", string_VkResult(stats_result));
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // Every invocation hits these counters with atomics, so keep them out of host memory.
+    if(!allocator_bind_buffer(&r->allocator, r->stats_buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ALLOCATION_STRATEGY_FREE_LIST, &r->stats_memory)) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    r->tiles_x = (r->width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    r->tiles_y = (r->band_height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+
+    const VkBufferCreateInfo tile_order_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = (VkDeviceSize)r->tiles_x * r->tiles_y * 2 * sizeof(uint32_t),
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VkResult tile_order_result = vkCreateBuffer(device, &tile_order_buffer_info, NULL, &r->tile_order_buffer);
+    if(tile_order_result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create tile order buffer: %s\n", string_VkResult(tile_order_result));
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // Written once and read once per workgroup, so it is filled through the mapping instead of a staging copy.
+    if(!allocator_bind_buffer(&r->allocator, r->tile_order_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ALLOCATION_STRATEGY_FREE_LIST, &r->tile_order_memory)) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    build_tile_order(r->tiles_x, r->tiles_y, r->tile_order_memory.mapped);
+    allocator_flush(&r->allocator, &r->tile_order_memory, 0, VK_WHOLE_SIZE);
+
+    if(info->enable_wavefront) {
+        // The wavefront stages dispatch one workgroup per group of pixels or rays in one dimension.
+        VkDeviceSize band_pixels = (VkDeviceSize)r->width * r->band_height;
+        if((band_pixels + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE > properties.limits.maxComputeWorkGroupCount[0]) {
+            fprintf(stderr, "Bands of %ux%u pixels are too large for the wavefront, use narrower bands\n", r->width, r->band_height);
+            return RENDERER_ERROR_INVALID_ARGUMENT;
+        }
+
+        VkDeviceSize control_size = (2 + 2 * 3 + 2 * WAVEFRONT_SORT_BIN_COUNT) * sizeof(uint32_t);
+        r->wavefront_control_buffer = create_device_buffer(&r->allocator, control_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &r->wavefront_control_memory);
+        r->ray_queue_buffer = create_device_buffer(&r->allocator, 2 * band_pixels * WAVEFRONT_RAY_SIZE,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &r->ray_queue_memory);
+        r->path_state_buffer = create_device_buffer(&r->allocator, band_pixels * WAVEFRONT_PATH_SIZE,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &r->path_state_memory);
+        if(!r->wavefront_control_buffer || !r->ray_queue_buffer || !r->path_state_buffer) {
+            return RENDERER_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    if(info->enable_cost_view) {
+        r->cost_buffer = create_device_buffer(&r->allocator, (VkDeviceSize)r->width * r->band_height * COST_SIZE,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &r->cost_memory);
+        if(!r->cost_buffer) {
+            return RENDERER_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    if(!create_textures(r, s) || !create_scene_buffer(r, s, info, properties.limits.minStorageBufferOffsetAlignment)) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    const storage_image *bound_images[BINDING_COUNT] = {
+        [BINDING_ACCUMULATION_IMAGE] = &r->accumulation,
+        [BINDING_OUTPUT_IMAGE] = &r->output,
+        [BINDING_ALBEDO_IMAGE] = &r->albedo,
+        [BINDING_NORMAL_DEPTH_IMAGE] = &r->normal_depth,
+        [BINDING_DENOISE_PING_IMAGE] = &r->denoise_ping,
+        [BINDING_DENOISE_PONG_IMAGE] = &r->denoise_pong,
+        [BINDING_HIT_ID_IMAGE] = &r->hit_id,
+    };
+
+    const VkBuffer bound_buffers[BINDING_COUNT] = {
+        [BINDING_STATS_BUFFER] = r->stats_buffer,
+        [BINDING_TILE_ORDER_BUFFER] = r->tile_order_buffer,
+        [BINDING_WAVEFRONT_CONTROL_BUFFER] = r->wavefront_control_buffer,
+        [BINDING_RAY_QUEUE_BUFFER] = r->ray_queue_buffer,
+        [BINDING_PATH_STATE_BUFFER] = r->path_state_buffer,
+        [BINDING_MATERIAL_BUFFER] = r->scene_buffer,
+        [BINDING_PRIMITIVE_BUFFER] = r->scene_buffer,
+        [BINDING_BLAS_BUFFER] = r->scene_buffer,
+        [BINDING_TLAS_BUFFER] = r->scene_buffer,
+        [BINDING_INSTANCE_BUFFER] = r->scene_buffer,
+        [BINDING_BVH_BOUNDS_BUFFER] = r->bvh_bounds_buffer,
+        [BINDING_BVH_SCRATCH_BUFFER] = r->bvh_scratch_buffer,
+        [BINDING_COST_BUFFER] = r->cost_buffer,
+    };
+
+    // Zero ranges bind the whole buffer.
+    VkDeviceSize bound_buffer_offsets[BINDING_COUNT] = {0};
+    VkDeviceSize bound_buffer_ranges[BINDING_COUNT] = {0};
+    for(uint32_t i = 0; i < SCENE_SECTION_COUNT; i++) {
+        bound_buffer_offsets[BINDING_MATERIAL_BUFFER + i] = r->scene_section_offsets[i];
+        bound_buffer_ranges[BINDING_MATERIAL_BUFFER + i] = r->scene_section_ranges[i];
+    }
+
+    // Bindings without a buffer stay unwritten, only pipelines that never use them are bound then.
+    uint32_t descriptor_write_count = 0;
+    VkDescriptorImageInfo descriptor_image_infos[BINDING_COUNT];
+    VkDescriptorBufferInfo descriptor_buffer_infos[BINDING_COUNT];
+    VkWriteDescriptorSet descriptor_writes[BINDING_COUNT];
+    for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+        if(i == BINDING_TEXTURES) {
+            continue;
+        }
+
+        if(i >= FIRST_BUFFER_BINDING) {
+            if(!bound_buffers[i]) {
+                continue;
+            }
+
+            descriptor_buffer_infos[i] = (VkDescriptorBufferInfo){
+                .buffer = bound_buffers[i],
+                .offset = bound_buffer_offsets[i],
+                .range = bound_buffer_ranges[i] ? bound_buffer_ranges[i] : VK_WHOLE_SIZE,
+            };
+
+            descriptor_writes[descriptor_write_count++] = (VkWriteDescriptorSet){
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = r->descriptor_set,
+                .dstBinding = i,
+                .dstArrayElement = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .pBufferInfo = &descriptor_buffer_infos[i],
+            };
+            continue;
+        }
+
+        descriptor_image_infos[i] = (VkDescriptorImageInfo){
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .imageView = bound_images[i]->view,
+        };
+
+        descriptor_writes[descriptor_write_count++] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = r->descriptor_set,
+            .dstBinding = i,
+            .dstArrayElement = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .pImageInfo = &descriptor_image_infos[i],
+        };
+    }
+
+    // Every slot of the texture array is written, the empty ones with the white texel after the scene's textures.
+    VkDescriptorImageInfo texture_infos[MAX_TEXTURE_COUNT];
+    for(uint32_t i = 0; i < get_texture_slot_count(r); i++) {
+        texture_infos[i] = (VkDescriptorImageInfo){
+            .sampler = r->texture_sampler,
+            .imageView = r->textures[i < r->texture_count ? i : r->texture_count].view,
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+    }
+
+    descriptor_writes[descriptor_write_count++] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = r->descriptor_set,
+        .dstBinding = BINDING_TEXTURES,
+        .dstArrayElement = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = get_texture_slot_count(r),
+        .pImageInfo = texture_infos,
+    };
+
+    vkUpdateDescriptorSets(device, descriptor_write_count, descriptor_writes, 0, NULL);
+
+    r->command_pool = create_command_pool(device, r->compute_queue_index);
+    if(!r->command_pool) {
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    r->command_buffer = create_command_buffer(device, r->command_pool);
+    if(!r->command_buffer) {
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    const VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    VkResult result = vkCreateFence(device, &fence_info, NULL, &r->fence);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create fence: %s\n", string_VkResult(result));
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    if(info->enable_gpu_timeline) {
+        renderer_result timeline_result = create_gpu_timeline(r, &properties);
+        if(timeline_result != RENDERER_SUCCESS) {
+            return timeline_result;
+        }
+    }
+
+    // Scene files are copied straight out of their mapping, which is why they have to stay open until here.
+    double upload_start = get_time();
+    bool uploaded = false;
+    TIMELINE_ZONE("upload_scene_buffer") {
+        uploaded = upload_scene_buffer(r, info->scene_file);
+    }
+
+    if(!uploaded) {
+        return RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    if(info->scene_file) {
+        r->bvh_build_time += get_time() - upload_start;
+    }
+
+    const char *shader_directory = info->shader_directory ? info->shader_directory : "shaders";
+
+    // The scene buffer contents were hashed when it was created. The trace shader code is added, as the half
+    // precision variants differ in code, so checkpoints are also tied to the precision. The subgroup variant
+    // traces the same rays, but is kept apart as well to stay on the safe side of compiler differences.
+    r->subgroups_enabled = !info->disable_subgroups && supports_subgroups(r->physical_device);
+
+    const char *untextured = r->texture_array_enabled ? "" : "_untextured";
+    char trace_shader_name[64];
+    snprintf(trace_shader_name, sizeof(trace_shader_name), "pathtracer%s%s%s.comp.spv", half ? "_half" : "", r->subgroups_enabled ? "_subgroup" : "", untextured);
+
+    uint64_t trace_code_hash = 0;
+    VkShaderModule trace_shader_mod = load_shader(device, shader_directory, trace_shader_name, &trace_code_hash);
+    VkShaderModule denoise_shader_mod = load_shader(device, shader_directory, half ? "denoise_half.comp.spv" : "denoise.comp.spv", NULL);
+    VkShaderModule resolve_shader_mod = load_shader(device, shader_directory, half ? "resolve_half.comp.spv" : "resolve.comp.spv", NULL);
+    VkShaderModule wavefront_shader_mod = NULL;
+    if(info->enable_wavefront) {
+        char wavefront_shader_name[64];
+        snprintf(wavefront_shader_name, sizeof(wavefront_shader_name), "pathtracer%s_wavefront%s.comp.spv", half ? "_half" : "", untextured);
+        wavefront_shader_mod = load_shader(device, shader_directory, wavefront_shader_name, NULL);
+    }
+
+    bool gpu_blas = r->scene_tables.builder == BLAS_BUILDER_GPU;
+    VkShaderModule lbvh_shader_mod = NULL;
+    if(gpu_blas) {
+        lbvh_shader_mod = load_shader(device, shader_directory, "lbvh.comp.spv", NULL);
+    }
+
+    // The cost variants trace the same paths with the costs added up. The heatmap only reads those and the stats,
+    // so it has no half precision variant.
+    VkShaderModule cost_shader_mod = NULL;
+    VkShaderModule heatmap_shader_mod = NULL;
+    if(info->enable_cost_view) {
+        char cost_shader_name[64];
+        snprintf(cost_shader_name, sizeof(cost_shader_name), "pathtracer%s_cost%s%s.comp.spv", half ? "_half" : "", r->shader_clock_enabled ? "_clock" : "", untextured);
+        cost_shader_mod = load_shader(device, shader_directory, cost_shader_name, NULL);
+        heatmap_shader_mod = load_shader(device, shader_directory, "heatmap.comp.spv", NULL);
+    }
+
+    renderer_result pipeline_result = RENDERER_SUCCESS;
+    if(!trace_shader_mod || !denoise_shader_mod || !resolve_shader_mod || (info->enable_wavefront && !wavefront_shader_mod) || (gpu_blas && !lbvh_shader_mod) ||
+       (info->enable_cost_view && (!cost_shader_mod || !heatmap_shader_mod))) {
+        pipeline_result = RENDERER_ERROR_MISSING_SHADER;
+    } else {
+        TIMELINE_ZONE("create_compute_pipelines") {
+            r->trace_pipeline = create_compute_pipeline(device, r->trace_pipeline_layout, trace_shader_mod);
+            r->denoise_pipeline = create_compute_pipeline(device, r->denoise_pipeline_layout, denoise_shader_mod);
+            r->resolve_pipeline = create_compute_pipeline(device, r->resolve_pipeline_layout, resolve_shader_mod);
+            if(wavefront_shader_mod) {
+                r->wavefront_pipeline = create_compute_pipeline(device, r->trace_pipeline_layout, wavefront_shader_mod);
+            }
+
+            if(lbvh_shader_mod) {
+                r->lbvh_pipeline = create_compute_pipeline(device, r->lbvh_pipeline_layout, lbvh_shader_mod);
+            }
+
+            if(cost_shader_mod) {
+                r->cost_pipeline = create_compute_pipeline(device, r->trace_pipeline_layout, cost_shader_mod);
+                r->heatmap_pipeline = create_compute_pipeline(device, r->heatmap_pipeline_layout, heatmap_shader_mod);
+            }
+
+            if(!r->trace_pipeline || !r->denoise_pipeline || !r->resolve_pipeline || (wavefront_shader_mod && !r->wavefront_pipeline) || (lbvh_shader_mod && !r->lbvh_pipeline) ||
+               (cost_shader_mod && (!r->cost_pipeline || !r->heatmap_pipeline))) {
+                pipeline_result = RENDERER_ERROR_INITIALIZATION_FAILED;
+            }
+        }
+    }
+
+    // Pipelines keep their own copy of the code.
+    vkDestroyShaderModule(device, heatmap_shader_mod, NULL);
+    vkDestroyShaderModule(device, cost_shader_mod, NULL);
+    vkDestroyShaderModule(device, lbvh_shader_mod, NULL);
+    vkDestroyShaderModule(device, wavefront_shader_mod, NULL);
+    vkDestroyShaderModule(device, resolve_shader_mod, NULL);
+    vkDestroyShaderModule(device, denoise_shader_mod, NULL);
+    vkDestroyShaderModule(device, trace_shader_mod, NULL);
+
+    if(pipeline_result != RENDERER_SUCCESS) {
+        return pipeline_result;
+    }
+
+    renderer_result texture_result = RENDERER_SUCCESS;
+    TIMELINE_ZONE("upload_textures") {
+        texture_result = upload_textures(r, shader_directory);
+    }
+
+    if(texture_result != RENDERER_SUCCESS) {
+        return texture_result;
+    }
+
+    if(gpu_blas) {
+        double build_start = get_time();
+        bool built = false;
+        TIMELINE_ZONE("build_gpu_blas") {
+            built = build_gpu_blas(r, s);
+        }
+
+        r->bvh_build_time += get_time() - build_start;
+        if(!built) {
+            return RENDERER_ERROR_DEVICE_LOST;
+        }
+    }
+
+    const uint32_t resolution[] = { r->width, r->height };
+    r->trace_hash = hash_bytes(resolution, sizeof(resolution), trace_code_hash);
+
+    r->aovs_enabled = info->enable_aovs;
+    staging_layout layout = get_staging_layout(r, info->enable_aovs);
+    r->staging_buffer = create_staging_buffer(&r->allocator, layout.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, ALLOCATION_STRATEGY_FREE_LIST, &r->staging_memory);
+    if(!r->staging_buffer) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    if(info->enable_checkpoints) {
+        r->checkpoint_buffer = create_staging_buffer(&r->allocator, get_checkpoint_buffer_size(r),
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, ALLOCATION_STRATEGY_FREE_LIST, &r->checkpoint_memory);
+        if(!r->checkpoint_buffer) {
+            return RENDERER_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_create(const renderer_create_info *info, renderer **out) {
+    if(!info || !out) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    *out = NULL;
+
+    renderer *r = calloc(1, sizeof(renderer));
+    if(!r) {
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    const VkDebugUtilsMessengerCreateInfoEXT debug_info = {
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+        .pfnUserCallback = debug_callback,
+        .messageType = 
+            VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+            VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+            VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+
+        .messageSeverity = 
+            //VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+            // VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+            VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+            VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
+    };
+
+    TIMELINE_ZONE("create_instance") {
+        r->instance = create_instance(info->enable_validation ? &debug_info : NULL);
+    }
+
+    if(!r->instance) {
+        renderer_destroy(r);
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    if(info->enable_validation) {
+        r->messenger = create_messenger(r->instance, &debug_info);
+        if(!r->messenger) {
+            renderer_destroy(r);
+            return RENDERER_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    // Only scenes with textures need the texture array, the others also run on devices without it.
+    const scene *s = info->scene_file ? &info->scene_file->scene : info->scene;
+    bool textured = s && s->texture_count > 0;
+    TIMELINE_ZONE("find_physical_device") {
+        r->physical_device = find_physical_device(r->instance, textured);
+    }
+
+    if(!r->physical_device) {
+        fprintf(stderr, textured ? "Failed to find a physical device that can index the texture array\n" : "Failed to find a suitable physical device\n");
+        renderer_destroy(r);
+        return RENDERER_ERROR_NO_DEVICE;
+    }
+
+    r->texture_array_enabled = supports_texture_array(r->physical_device);
+
+    r->compute_queue_index = find_compute_family(r->physical_device);
+    if(r->compute_queue_index == UINT32_MAX) {
+        renderer_destroy(r);
+        return RENDERER_ERROR_NO_DEVICE;
+    }
+
+    r->shader_clock_enabled = info->enable_cost_view && supports_shader_clock(r->physical_device);
+    r->calibrated_timestamps_enabled = info->enable_gpu_timeline && supports_calibrated_timestamps(r->instance, r->physical_device);
+    const device_options options = {
+        .texture_array = r->texture_array_enabled,
+        .shader_clock = r->shader_clock_enabled,
+        .calibrated_timestamps = r->calibrated_timestamps_enabled,
+    };
+
+    TIMELINE_ZONE("create_device") {
+        r->device = create_device(r->physical_device, r->compute_queue_index, info->enable_validation, &options);
+    }
+
+    if(!r->device) {
+        renderer_destroy(r);
+        return RENDERER_ERROR_INITIALIZATION_FAILED;
+    }
+
+    vkGetDeviceQueue(r->device, r->compute_queue_index, 0, &r->compute_queue);
+
+    // Without a scene the renderer starts with the builtin spheres. They only have to live until the scene buffer
+    // and the GPU BLAS are built.
+    scene builtin_scene = {0};
+    if(!s) {
+        if(!scene_create_builtin("spheres", 0.0f, &builtin_scene)) {
+            renderer_destroy(r);
+            return RENDERER_ERROR_OUT_OF_MEMORY;
+        }
+
+        s = &builtin_scene;
+    }
+
+    renderer_result result = RENDERER_SUCCESS;
+    TIMELINE_ZONE("create_device_objects") {
+        result = create_device_objects(r, info, s);
+    }
+
+    scene_free(&builtin_scene);
+
+    if(result != RENDERER_SUCCESS) {
+        renderer_destroy(r);
+        return result;
+    }
+
+    *out = r;
+    return RENDERER_SUCCESS;
+}
+
+void renderer_destroy(renderer *r) {
+    if(!r) {
+        return;
+    }
+
+    VkDevice device = r->device;
+    if(device) {
+        vkDeviceWaitIdle(device);
+
+        vkDestroyBuffer(device, r->checkpoint_buffer, NULL);
+        allocator_free(&r->allocator, &r->checkpoint_memory);
+        vkDestroyBuffer(device, r->staging_buffer, NULL);
+        allocator_free(&r->allocator, &r->staging_memory);
+        vkDestroyBuffer(device, r->bvh_scratch_buffer, NULL);
+        allocator_free(&r->allocator, &r->bvh_scratch_memory);
+        vkDestroyBuffer(device, r->bvh_bounds_buffer, NULL);
+        allocator_free(&r->allocator, &r->bvh_bounds_memory);
+        vkDestroyBuffer(device, r->scene_buffer, NULL);
+        allocator_free(&r->allocator, &r->scene_memory);
+        vkDestroyBuffer(device, r->scene_staging_buffer, NULL);
+        allocator_free(&r->allocator, &r->scene_staging_memory);
+        free(r->scene_shadow);
+        scene_tables_free(&r->scene_tables);
+        vkDestroyBuffer(device, r->texture_staging_buffer, NULL);
+        allocator_free(&r->allocator, &r->texture_staging_memory);
+        vkDestroySampler(device, r->texture_sampler, NULL);
+        for(uint32_t i = 0; r->textures && i <= r->texture_count; i++) {
+            destroy_texture_image(device, &r->allocator, &r->textures[i]);
+        }
+
+        free(r->textures);
+        vkDestroyBuffer(device, r->cost_buffer, NULL);
+        allocator_free(&r->allocator, &r->cost_memory);
+        vkDestroyBuffer(device, r->path_state_buffer, NULL);
+        allocator_free(&r->allocator, &r->path_state_memory);
+        vkDestroyBuffer(device, r->ray_queue_buffer, NULL);
+        allocator_free(&r->allocator, &r->ray_queue_memory);
+        vkDestroyBuffer(device, r->wavefront_control_buffer, NULL);
+        allocator_free(&r->allocator, &r->wavefront_control_memory);
+        vkDestroyBuffer(device, r->tile_order_buffer, NULL);
+        allocator_free(&r->allocator, &r->tile_order_memory);
+        vkDestroyBuffer(device, r->stats_buffer, NULL);
+        allocator_free(&r->allocator, &r->stats_memory);
+        if(r->gpu_timeline) {
+            vkDestroyQueryPool(device, r->gpu_timeline->query_pool, NULL);
+            free(r->gpu_timeline);
+        }
+
+        vkDestroyPipeline(device, r->heatmap_pipeline, NULL);
+        vkDestroyPipeline(device, r->cost_pipeline, NULL);
+        vkDestroyPipeline(device, r->lbvh_pipeline, NULL);
+        vkDestroyPipeline(device, r->resolve_pipeline, NULL);
+        vkDestroyPipeline(device, r->denoise_pipeline, NULL);
+        vkDestroyPipeline(device, r->wavefront_pipeline, NULL);
+        vkDestroyPipeline(device, r->trace_pipeline, NULL);
+        vkDestroyFence(device, r->fence, NULL);
+        vkDestroyCommandPool(device, r->command_pool, NULL);
+        vkDestroyDescriptorPool(device, r->descriptor_pool, NULL);
+        vkDestroyPipelineLayout(device, r->heatmap_pipeline_layout, NULL);
+        vkDestroyPipelineLayout(device, r->lbvh_pipeline_layout, NULL);
+        vkDestroyPipelineLayout(device, r->resolve_pipeline_layout, NULL);
+        vkDestroyPipelineLayout(device, r->denoise_pipeline_layout, NULL);
+        vkDestroyPipelineLayout(device, r->trace_pipeline_layout, NULL);
+        vkDestroyDescriptorSetLayout(device, r->descriptor_set_layout, NULL);
+        destroy_storage_image(device, &r->allocator, &r->hit_id);
+        destroy_storage_image(device, &r->allocator, &r->denoise_pong);
+        destroy_storage_image(device, &r->allocator, &r->denoise_ping);
+        destroy_storage_image(device, &r->allocator, &r->normal_depth);
+        destroy_storage_image(device, &r->allocator, &r->albedo);
+        destroy_storage_image(device, &r->allocator, &r->output);
+        destroy_storage_image(device, &r->allocator, &r->accumulation);
+
+        allocator_destroy(&r->allocator);
+
+        vkDestroyDevice(device, NULL);
+    }
+
+    if(r->messenger) {
+        vkDestroyDebugUtilsMessengerEXT(r->instance, r->messenger, NULL);
+    }
+
+    if(r->instance) {
+        vkDestroyInstance(r->instance, NULL);
+    }
+
+    free(r);
+}
+
+uint32_t renderer_width(const renderer *r) {
+    return r->width;
+}
+
+uint32_t renderer_height(const renderer *r) {
+    return r->height;
+}
+
+uint32_t renderer_band_height(const renderer *r) {
+    return r->band_height;
+}
+
+uint32_t renderer_band_count(const renderer *r) {
+    return r->band_count;
+}
+
+static renderer_result validate_settings(const renderer *r, const render_settings *settings, const checkpoint *resume, const render_stats *stats) {
+    if(!r || !settings || !stats || settings->samples_per_pixel == 0 || settings->samples_per_pass == 0 || settings->time_budget < 0.0) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(settings->pixel_order > PIXEL_ORDER_HILBERT || settings->trace_mode > TRACE_MODE_WAVEFRONT_SORTED) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(settings->trace_mode != TRACE_MODE_MEGAKERNEL && !r->wavefront_pipeline) {
+        fprintf(stderr, "The wavefront was not enabled when the renderer was created\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(settings->cost_view > COST_VIEW_CYCLES) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(settings->cost_view != COST_VIEW_NONE) {
+        if(!r->cost_pipeline) {
+            fprintf(stderr, "Cost views were not enabled when the renderer was created\n");
+            return RENDERER_ERROR_INVALID_ARGUMENT;
+        }
+
+        if(settings->trace_mode != TRACE_MODE_MEGAKERNEL || resume) {
+            fprintf(stderr, "Cost views need the megakernel and cannot resume from a checkpoint\n");
+            return RENDERER_ERROR_INVALID_ARGUMENT;
+        }
+
+        if(settings->cost_view == COST_VIEW_CYCLES && !r->shader_clock_enabled) {
+            fprintf(stderr, "The device has no shader clock to count cycles with\n");
+            return RENDERER_ERROR_INVALID_ARGUMENT;
+        }
+    }
+
+    if(settings->read_aovs && !r->aovs_enabled) {
+        fprintf(stderr, "AOVs were not enabled when the renderer was created\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if((settings->checkpoint_writer || resume) && !r->checkpoint_buffer) {
+        fprintf(stderr, "Checkpoints were not enabled when the renderer was created\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(settings->checkpoint_writer && settings->checkpoint_interval == 0) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    float right[3], up[3], forward[3];
+    if(!camera_basis(&settings->camera, right, up, forward)) {
+        fprintf(stderr, "The camera needs distinct position and target, a field of view between 0 and 180 degrees and must not look along its up vector\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_update_scene(renderer *r, const scene *s, scene_update_stats *stats) {
+    double start = get_time();
+    if(r->scene_from_file) {
+        fprintf(stderr, "Scenes loaded from a file are static, their BVHs cannot be refit\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(s->material_count * sizeof(scene_material) != r->scene_section_ranges[0]) {
+        fprintf(stderr, "Scene updates have to keep the number of materials\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    // The textures were uploaded once, the materials can only pick among them.
+    if(!validate_material_textures(s, r->texture_count)) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(!scene_update_tables(s, &r->scene_tables)) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Every submission is waited for before the render returns, so the GPU is not reading the buffer now. An
+    // update that changes nothing keeps the scene hash, and with it the samples of render_settings.accumulate.
+    scene_upload upload = {0};
+    if(!upload_scene_changes(r, s, &upload)) {
+        return RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    // The BLAS nodes built on the GPU only change with the primitives.
+    bool primitives_changed = upload.changed_sections & (1u << (BINDING_PRIMITIVE_BUFFER - BINDING_MATERIAL_BUFFER));
+    if(r->scene_tables.builder == BLAS_BUILDER_GPU && primitives_changed && !build_gpu_blas(r, s)) {
+        return RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    if(stats) {
+        *stats = (scene_update_stats){
+            .time = get_time() - start,
+            .refits = r->scene_tables.refit_count,
+            .rebuilds = r->scene_tables.rebuild_count,
+            .uploaded_bytes = upload.bytes,
+            .uploaded_ranges = upload.range_count,
+        };
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_render(renderer *r, const render_settings *settings, const checkpoint *resume, render_stats *stats) {
+    renderer_result settings_result = validate_settings(r, settings, resume, stats);
+    if(settings_result != RENDERER_SUCCESS) {
+        return settings_result;
+    }
+
+    if(r->band_count > 1) {
+        fprintf(stderr, "The renderer was created for %u bands, render them with renderer_render_band()\n", r->band_count);
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(resume) {
+        renderer_result result = renderer_validate_checkpoint(r, resume, settings);
+        if(result != RENDERER_SUCCESS) {
+            return result;
+        }
+    }
+
+    // Only whole passes can be continued, and only up to the samples asked for. The cost buffer only ever holds the
+    // passes of one render.
+    uint64_t accumulation_hash = get_accumulation_hash(r, settings);
+    uint32_t kept_passes = 0;
+    if(settings->accumulate && !resume && settings->cost_view == COST_VIEW_NONE && r->accumulated_hash == accumulation_hash && r->accumulated_samples <= settings->samples_per_pixel &&
+        r->accumulated_samples % settings->samples_per_pass == 0) {
+        kept_passes = r->accumulated_samples / settings->samples_per_pass;
+    }
+
+    r->accumulated_samples = 0;
+    if(!render(r, settings, resume, kept_passes, 0, stats)) {
+        return RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    r->accumulated_hash = accumulation_hash;
+    r->accumulated_samples = stats->samples_per_pixel;
+    r->accumulated_aovs_read = settings->read_aovs;
+    r->last_sample_count = stats->samples_per_pixel;
+    r->last_cost_view = settings->cost_view != COST_VIEW_NONE;
+    r->last_band_rows = r->height;
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_render_band(renderer *r, const render_settings *settings, uint32_t band, render_stats *stats) {
+    renderer_result settings_result = validate_settings(r, settings, NULL, stats);
+    if(settings_result != RENDERER_SUCCESS) {
+        return settings_result;
+    }
+
+    if(band >= r->band_count) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    // The denoiser would see a seam at every band edge, and a budget would leave each band with a different sample count.
+    if(r->band_count > 1 && ((settings->denoise && settings->denoise_iterations > 0) || settings->time_budget > 0.0)) {
+        fprintf(stderr, "Denoising and time budgets are not available when rendering in bands\n");
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    r->accumulated_samples = 0;
+    if(!render(r, settings, NULL, 0, band, stats)) {
+        return RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    r->last_sample_count = stats->samples_per_pixel;
+    r->last_cost_view = settings->cost_view != COST_VIEW_NONE;
+    r->last_band_rows = get_band_rows(r, band);
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_readback(renderer *r, uint8_t *pixels) {
+    if(!r || !pixels) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Required when the staging memory is not HOST_COHERENT.
+    allocator_invalidate(&r->allocator, &r->staging_memory);
+
+    // Copy out of the mapping in one sequential pass, readers like stbi_write_png go over their input many times.
+    staging_layout layout = get_staging_layout(r, r->aovs_enabled);
+    memcpy(pixels, (const uint8_t *)r->staging_memory.mapped + layout.output_offset, (size_t)r->width * r->last_band_rows * 4);
+    return RENDERER_SUCCESS;
+}
+
+// The guide images hold per-sample sums, so they are averaged here.
+renderer_result renderer_readback_aovs(renderer *r, float *albedo, float *normal, float *depth, float *hit_id) {
+    if(!r || !albedo || !normal || !depth || !hit_id || !r->aovs_enabled || r->last_sample_count == 0) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    allocator_invalidate(&r->allocator, &r->staging_memory);
+
+    staging_layout layout = get_staging_layout(r, true);
+    const uint8_t *staging = r->staging_memory.mapped;
+    const uint8_t *albedo_sums = staging + layout.albedo_offset;
+    const uint8_t *normal_depth_sums = staging + layout.normal_depth_offset;
+    const uint32_t *hit_ids = (const uint32_t *)(staging + layout.hit_id_offset);
+
+    size_t pixel_count = (size_t)r->width * r->height;
+    size_t texel_size = get_float_texel_size(r);
+    float inv_samples = r->precision == RENDER_PRECISION_HALF ? 1.0f : 1.0f / (float)r->last_sample_count;
+    for(size_t i = 0; i < pixel_count; i++) {
+        float a[4];
+        float n[4];
+        unpack_texels(albedo_sums + i * texel_size, r->precision, 1, inv_samples, a);
+        unpack_texels(normal_depth_sums + i * texel_size, r->precision, 1, inv_samples, n);
+
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+
+        for(size_t c = 0; c < 3; c++) {
+            albedo[i * 3 + c] = a[c];
+            normal[i * 3 + c] = n[c] * inv_length;
+        }
+
+        depth[i] = n[3];
+        hit_id[i] = hit_ids[i] == HIT_ID_MISS ? -1.0f : (float)hit_ids[i];
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_readback_costs(renderer *r, float *costs) {
+    if(!r || !costs || !r->last_cost_view || r->last_sample_count == 0) {
+        return RENDERER_ERROR_INVALID_ARGUMENT;
+    }
+
+    allocator_invalidate(&r->allocator, &r->staging_memory);
+
+    staging_layout layout = get_staging_layout(r, r->aovs_enabled);
+    const float *sums = (const float *)((const uint8_t *)r->staging_memory.mapped + layout.cost_offset);
+
+    size_t pixel_count = (size_t)r->width * r->last_band_rows;
+    float inv_samples = 1.0f / (float)r->last_sample_count;
+    for(size_t i = 0; i < pixel_count; i++) {
+        for(size_t c = 0; c < 3; c++) {
+            costs[i * 3 + c] = sums[i * 4 + c] * inv_samples;
+        }
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_validate_checkpoint(const renderer *r, const checkpoint *checkpoint, const render_settings *settings) {
+    const checkpoint_header *header = &checkpoint->header;
+
+    if(header->width != r->width || header->height != r->height) {
+        fprintf(stderr, "Checkpoint is %ux%u, the renderer is %ux%u\n", header->width, header->height, r->width, r->height);
+        return RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT;
+    }
+
+    if(header->scene_hash != get_scene_hash(r, settings)) {
+        fprintf(stderr, "Checkpoint was rendered from a different scene, camera or precision\n");
+        return RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT;
+    }
+
+    // The RNG is seeded per pass, continuing with a different pass size would not reproduce the same samples.
+    if(header->samples_per_pass != settings->samples_per_pass) {
+        fprintf(stderr, "Checkpoint used %u samples per pass, resume with --samples-per-pass %u\n", header->samples_per_pass, header->samples_per_pass);
+        return RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT;
+    }
+
+    if(header->pass_index * header->samples_per_pass != header->samples_completed) {
+        fprintf(stderr, "Checkpoint pass index does not match its sample count\n");
+        return RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT;
+    }
+
+    if(header->samples_completed > settings->samples_per_pixel) {
+        fprintf(stderr, "Checkpoint already has %u samples, more than the %u requested\n", header->samples_completed, settings->samples_per_pixel);
+        return RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT;
+    }
+
+    return RENDERER_SUCCESS;
+}
+
+renderer_result renderer_get_build_info(const renderer *r, renderer_build_info *info) {
+    const scene_tables *tables = &r->scene_tables;
+    const bvh_node *nodes = tables->blas_nodes;
+    bvh tlas = tables->tlas;
+
+    // GPU built BLAS nodes, and every node of a scene file, only exist in the scene buffer.
+    bvh_node *read_blas = NULL;
+    bvh_node *read_tlas = NULL;
+    if(tables->builder == BLAS_BUILDER_GPU || r->scene_from_file) {
+        read_blas = malloc(r->scene_section_ranges[BINDING_BLAS_BUFFER - BINDING_MATERIAL_BUFFER]);
+        nodes = read_blas;
+    }
+
+    if(r->scene_from_file) {
+        read_tlas = malloc(r->scene_section_ranges[BINDING_TLAS_BUFFER - BINDING_MATERIAL_BUFFER]);
+        tlas = (bvh){
+            .nodes = read_tlas,
+            .node_count = tables->tlas_node_count,
+        };
+    }
+
+    if(!nodes || !tlas.nodes) {
+        free(read_blas);
+        free(read_tlas);
+        return RENDERER_ERROR_OUT_OF_MEMORY;
+    }
+
+    if((read_blas && !read_scene_section(r, BINDING_BLAS_BUFFER - BINDING_MATERIAL_BUFFER, read_blas)) ||
+        (read_tlas && !read_scene_section(r, BINDING_TLAS_BUFFER - BINDING_MATERIAL_BUFFER, read_tlas))) {
+        free(read_blas);
+        free(read_tlas);
+        return RENDERER_ERROR_DEVICE_LOST;
+    }
+
+    // Every object has room for 2n - 1 nodes, the unused ones are empty and add nothing.
+    double blas_cost = 0.0;
+    for(uint32_t i = 0; i < tables->object_count; i++) {
+        uint32_t end_node = i + 1 < tables->object_count ? tables->blas_roots[i + 1] : tables->blas_node_count;
+        const bvh object_bvh = {
+            .nodes = (bvh_node *)&nodes[tables->blas_roots[i]],
+            .node_count = end_node - tables->blas_roots[i],
+        };
+
+        blas_cost += (double)bvh_sah_cost(&object_bvh) * ((object_bvh.node_count + 1) / 2);
+    }
+
+    *info = (renderer_build_info){
+        .time = r->bvh_build_time,
+        .blas_sah_cost = (float)(blas_cost / tables->primitive_count),
+        .tlas_sah_cost = bvh_sah_cost(&tlas),
+    };
+
+    free(read_blas);
+    free(read_tlas);
+    return RENDERER_SUCCESS;
+}
+
+void renderer_get_memory_info(const renderer *r, renderer_memory_info *info) {
+    const storage_image *storage_images[] = {
+        &r->accumulation, &r->output, &r->albedo, &r->normal_depth, &r->denoise_ping, &r->denoise_pong, &r->hit_id,
+    };
+
+    info->image_bytes = 0;
+    for(uint32_t i = 0; i < ARRAY_LENGTH(storage_images); i++) {
+        info->image_bytes += storage_images[i]->memory.size;
+    }
+
+    // Accumulation, albedo and normal/depth are each loaded and stored, the hit ID is only stored.
+    uint64_t pixel_count = (uint64_t)r->width * r->band_height;
+    info->trace_pass_bytes = pixel_count * (get_float_texel_size(r) * 3 * 2 + sizeof(uint32_t));
+    info->wavefront_bytes = r->wavefront_control_memory.size + r->ray_queue_memory.size + r->path_state_memory.size;
+}
+
+void renderer_print_memory_report(const renderer *r) {
+    print_memory_type(r->physical_device, "Image memory", r->output.memory.memory_type);
+    print_memory_type(r->physical_device, "Staging memory", r->staging_memory.memory_type);
+    allocator_print_stats(&r->allocator);
+
+    renderer_memory_info info;
+    renderer_get_memory_info(r, &info);
+    printf("Trace shader: %s\n", r->subgroups_enabled ? "subgroup reductions" : "per invocation atomics");
+    printf("Storage images: %.1f MiB (%s precision), %.1f MiB of image traffic per sample pass\n",
+        info.image_bytes / (1024.0 * 1024.0), r->precision == RENDER_PRECISION_HALF ? "half" : "full",
+        info.trace_pass_bytes / (1024.0 * 1024.0));
+    if(info.wavefront_bytes) {
+        printf("Wavefront ray queue and path states: %.1f MiB\n", info.wavefront_bytes / (1024.0 * 1024.0));
+    }
+}
@@ -0,0 +1,242 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+#include "camera.h"
+#include "checkpoint.h"
+#include "scene.h"
+#include "scene_file.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum renderer_result {
+    RENDERER_SUCCESS = 0,
+    RENDERER_ERROR_INVALID_ARGUMENT,
+    RENDERER_ERROR_OUT_OF_MEMORY,
+    RENDERER_ERROR_INITIALIZATION_FAILED,
+    RENDERER_ERROR_NO_DEVICE,
+    RENDERER_ERROR_MISSING_SHADER,
+    // Recording, submitting or waiting for GPU work failed. The renderer should be destroyed.
+    RENDERER_ERROR_DEVICE_LOST,
+    RENDERER_ERROR_INCOMPATIBLE_CHECKPOINT,
+} renderer_result;
+
+typedef enum tonemap_operator {
+    TONEMAP_ACES = 0,
+    TONEMAP_REINHARD = 1,
+    TONEMAP_NONE = 2,
+} tonemap_operator;
+
+// Format of the accumulation, guide and denoise images.
+typedef enum render_precision {
+    // RGBA32F sums over every sample.
+    RENDER_PRECISION_FULL = 0,
+    // RGBA16F running averages at half the memory and bandwidth. Averages stay in the range where half floats keep
+    // about three significant digits, sums would drop small samples and overflow past 65504. That is plenty for the
+    // 8-bit output, but the AOVs are only accurate to about 1e-3 relative and the denoiser sees slightly noisier guides.
+    RENDER_PRECISION_HALF = 1,
+} render_precision;
+
+// Order in which the invocations of a trace dispatch visit the pixels of the image.
+typedef enum pixel_order {
+    // Rows of 32x32 tiles, each visited row by row.
+    PIXEL_ORDER_LINEAR = 0,
+    // Z-order curve across the tiles and inside each one, so neighbouring lanes and workgroups trace neighbouring rays.
+    PIXEL_ORDER_MORTON = 1,
+    // Hilbert curve, which unlike the Z-order curve never jumps between distant quadrants.
+    PIXEL_ORDER_HILBERT = 2,
+} pixel_order;
+
+// How the trace shader schedules the bounces of a path.
+typedef enum trace_mode {
+    // One invocation follows its pixel's paths through every bounce.
+    TRACE_MODE_MEGAKERNEL = 0,
+    // Every path of the band advances one bounce per dispatch, through a queue of rays. Requires a renderer
+    // created with enable_wavefront.
+    TRACE_MODE_WAVEFRONT = 1,
+    // The wavefront, with the queued rays sorted by origin cell and direction octant before every bounce.
+    TRACE_MODE_WAVEFRONT_SORTED = 2,
+} trace_mode;
+
+// Debug views that replace the image with a false color heatmap of what each pixel cost to trace, from blue for
+// cheap to red for expensive. Require TRACE_MODE_MEGAKERNEL and a renderer created with enable_cost_view.
+typedef enum cost_view {
+    COST_VIEW_NONE = 0,
+    // Rays per sample, from one to the bounce limit of ten.
+    COST_VIEW_BOUNCES = 1,
+    // BVH node and primitive tests per sample, on a log scale from 1/16 to 16 times the mean of the band.
+    COST_VIEW_TESTS = 2,
+    // Shader clock cycles per sample, scaled like the tests. Only on devices with VK_KHR_shader_clock.
+    COST_VIEW_CYCLES = 3,
+} cost_view;
+
+typedef struct render_settings {
+    // Only pushed to the trace shader, so changing it between renders never rebuilds a pipeline.
+    camera camera;
+    uint32_t samples_per_pixel;
+    uint32_t samples_per_pass;
+    float exposure;
+    tonemap_operator tonemap;
+    bool denoise;
+    uint32_t denoise_iterations;
+    // Also copy the albedo, normal/depth and hit ID images back. Requires a renderer created with enable_aovs.
+    bool read_aovs;
+    // Snapshot the accumulated state every checkpoint_interval sample passes. NULL disables checkpoints.
+    checkpoint_writer *checkpoint_writer;
+    uint32_t checkpoint_interval;
+    // Wall clock seconds the sample passes may take, samples_per_pixel becomes an upper bound. Zero disables the budget.
+    double time_budget;
+    // Only changes which invocation traces which pixel, the image is the same. Ignored by the wavefront modes.
+    pixel_order pixel_order;
+    // The wavefront modes trace statistically equivalent paths with a different random sequence.
+    trace_mode trace_mode;
+    // Continue the samples of the previous render instead of starting over, as long as it traced the same scene and
+    // camera with the same samples_per_pass and trace_mode. samples_per_pixel is then the total, a render that
+    // already holds it only resolves again. Scene updates that change nothing keep the samples.
+    bool accumulate;
+    // Replaces the denoiser, exposure and tonemapping with the heatmap. Costs are never carried over from an earlier
+    // render, accumulate starts over and resuming is not supported.
+    cost_view cost_view;
+} render_settings;
+
+typedef struct render_stats {
+    double time;
+    // Lower than samples_per_pixel when a time budget ran out.
+    uint32_t samples_per_pixel;
+    // Ray segments traced, and the primitive intersection tests in the BVH leaves they reached.
+    uint64_t rays;
+    uint64_t primitive_tests;
+    // Rays that hit the scene, the others missed it, and the BVH node bounds tested on the way.
+    uint64_t hits;
+    uint64_t node_tests;
+    // How the paths ended, by missing the scene or at the bounce limit. Together they are every path traced.
+    uint64_t escaped_paths;
+    uint64_t bounce_limited_paths;
+    // Pixels whose mean luminance still changed by more than 1% in the last sample pass.
+    uint32_t unconverged_pixels;
+    // Shader clock cycles of every trace invocation, only counted by the cost views on devices with a shader clock.
+    // The device sums them in units of 256 cycles.
+    uint64_t shader_cycles;
+} render_stats;
+
+typedef struct scene_update_stats {
+    // Host time to refit or rebuild the BVHs and upload what changed.
+    double time;
+    // BVHs that were refit, and those that had degraded enough to be rebuilt instead.
+    uint32_t refits;
+    uint32_t rebuilds;
+    // Bytes copied into the scene buffer, from this many changed ranges. Both zero when nothing changed.
+    uint64_t uploaded_bytes;
+    uint32_t uploaded_ranges;
+} scene_update_stats;
+
+typedef struct renderer_create_info {
+    // Directory containing the compiled .spv shaders, "shaders" when NULL.
+    const char *shader_directory;
+    // Copied into the scene buffer, so it can be freed once the renderer is created. The builtin "spheres" scene
+    // when NULL.
+    const scene *scene;
+    // Used instead of scene when set. Its sections are copied into the scene buffer as they are, with the BVHs it
+    // was written with, so blas_builder and bvh_thread_count do not apply. It can be closed once the renderer is
+    // created, and the renderer cannot update the scene.
+    const scene_file *scene_file;
+    bool enable_validation;
+    // Reserves staging memory for reading back AOVs.
+    bool enable_aovs;
+    // Allocates the buffer needed to write and resume checkpoints.
+    bool enable_checkpoints;
+    // Image size, 1920x1080 when zero.
+    uint32_t width;
+    uint32_t height;
+    // Rows rendered at once. The images and staging memory only hold one band, so this bounds the memory use
+    // independent of the height. Zero renders the whole image at once. AOVs and checkpoints need a single band.
+    uint32_t band_height;
+    render_precision precision;
+    // Use the trace shader without subgroup operations even where they are supported, for comparisons.
+    bool disable_subgroups;
+    // Allocates the ray queue and path state buffers of the wavefront trace modes, 144 bytes per pixel of a band.
+    bool enable_wavefront;
+    // How the BVHs of the scene are built, see scene_build_tables(). BLAS_BUILDER_GPU sorts Morton codes on the
+    // device and also rebuilds every BLAS there on renderer_update_scene().
+    blas_builder blas_builder;
+    // Host threads for building BVHs, one per core when zero.
+    uint32_t bvh_thread_count;
+    // Loads the trace shader of the cost views and allocates their per pixel costs, 16 bytes per pixel of a band.
+    bool enable_cost_view;
+    // Times the uploads, BVH builds, trace passes and resolves on the device with timestamp queries and adds them to
+    // the timeline while it records, see timeline.h. Host zones are added whenever the timeline records.
+    bool enable_gpu_timeline;
+} renderer_create_info;
+
+typedef struct renderer_build_info {
+    // Wall clock seconds the BVHs took when the renderer was created, including the submission of a GPU build, or
+    // copying them from a scene file.
+    double time;
+    // Estimated cost of tracing a ray through a BLAS, averaged over the objects weighted by their primitives, and
+    // through the TLAS. See bvh_sah_cost().
+    float blas_sah_cost;
+    float tlas_sah_cost;
+} renderer_build_info;
+
+typedef struct renderer_memory_info {
+    // Device memory of every storage image.
+    uint64_t image_bytes;
+    // Bytes a sample pass after the first loads and stores, assuming no cache hits.
+    uint64_t trace_pass_bytes;
+    // Device memory of the ray queue and path states, zero without enable_wavefront.
+    uint64_t wavefront_bytes;
+} renderer_memory_info;
+
+// Owns the Vulkan device, pipelines and images. Meant to be created once and reused for many renders.
+typedef struct renderer renderer;
+
+const char *renderer_result_string(renderer_result result);
+
+// Scenes with textures need a device with non-uniform indexing of sampled image arrays, VK_EXT_descriptor_indexing
+// before Vulkan 1.2, and fail with RENDERER_ERROR_NO_DEVICE without one.
+renderer_result renderer_create(const renderer_create_info *info, renderer **out);
+// Accepts a partially created renderer as well as NULL.
+void renderer_destroy(renderer *renderer);
+
+uint32_t renderer_width(const renderer *renderer);
+uint32_t renderer_height(const renderer *renderer);
+uint32_t renderer_band_height(const renderer *renderer);
+uint32_t renderer_band_count(const renderer *renderer);
+
+// Moves the primitives and instances to where they are in scene. It has to have the same objects, and as many
+// materials, primitives and instances, as the scene the renderer was created with, see scene_update_tables().
+// The textures stay those uploaded at creation, the materials may only pick different ones among them. The next
+// render starts over with the new scene. stats is optional. Renderers created from a scene file cannot update it.
+renderer_result renderer_update_scene(renderer *renderer, const scene *scene, scene_update_stats *stats);
+
+// Renders the whole image, only valid when it is a single band. resume is optional, see renderer_validate_checkpoint().
+renderer_result renderer_render(renderer *renderer, const render_settings *settings, const checkpoint *resume, render_stats *stats);
+
+// Renders the rows [band * band_height, (band + 1) * band_height), clipped to the image. Every band traces the same
+// rays as a full frame would, so the bands can be stitched without seams. Denoising and time budgets are not
+// supported with more than one band.
+renderer_result renderer_render_band(renderer *renderer, const render_settings *settings, uint32_t band, render_stats *stats);
+
+// Copies the 8-bit RGBA result of the last render into width * rows * 4 bytes, where rows is the height of the
+// last rendered band, or the whole height after renderer_render().
+renderer_result renderer_readback(renderer *renderer, uint8_t *pixels);
+
+// Averaged AOVs of the last render with read_aovs set: RGB albedo, unit RGB normal, depth and hit ID, the index of
+// the instance that was hit (-1 for misses).
+renderer_result renderer_readback_aovs(renderer *renderer, float *albedo, float *normal, float *depth, float *hit_id);
+
+// Costs of the last render with a cost view, averaged per sample: rays, BVH node and primitive tests, and shader
+// clock cycles (zero without a shader clock). Three floats per pixel of the last rendered band, like renderer_readback().
+renderer_result renderer_readback_costs(renderer *renderer, float *costs);
+
+// Rejects checkpoints that were taken with a different scene, resolution or pass layout.
+renderer_result renderer_validate_checkpoint(const renderer *renderer, const checkpoint *checkpoint, const render_settings *settings);
+
+void renderer_get_memory_info(const renderer *renderer, renderer_memory_info *info);
+
+// Reads GPU built BLAS nodes, and the nodes of a scene file, back from the scene buffer, so it is not meant to be
+// called per frame.
+renderer_result renderer_get_build_info(const renderer *renderer, renderer_build_info *info);
+
+// Prints the memory types of the images and the staging buffer, and the allocator statistics.
+void renderer_print_memory_report(const renderer *renderer);
+
+#endif // RENDERER_H
@@ -0,0 +1,796 @@
+#include "scene.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static float length3(const float v[3]) {
+    return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static bool normalize3(const float v[3], float out[3]) {
+    float length = length3(v);
+    if(!(length > 1e-6f)) {
+        return false;
+    }
+
+    for(int i = 0; i < 3; i++) {
+        out[i] = v[i] / length;
+    }
+
+    return true;
+}
+
+uint32_t scene_add_material(scene *scene, const float albedo[3], const float emission[3], float roughness) {
+    if(scene->material_count == scene->material_capacity) {
+        uint32_t capacity = scene->material_capacity ? scene->material_capacity * 2 : 8;
+        scene_material *materials = realloc(scene->materials, sizeof(scene_material) * capacity);
+        if(!materials) {
+            return UINT32_MAX;
+        }
+
+        scene->materials = materials;
+        scene->material_capacity = capacity;
+    }
+
+    scene_material *material = &scene->materials[scene->material_count];
+    *material = (scene_material){ .roughness = roughness, .albedo_texture = SCENE_NO_TEXTURE };
+    memcpy(material->albedo, albedo, sizeof(material->albedo));
+    memcpy(material->emission, emission, sizeof(material->emission));
+    return scene->material_count++;
+}
+
+uint32_t scene_add_texture(scene *scene, uint32_t width, uint32_t height, const uint8_t *pixels) {
+    if(width == 0 || height == 0) {
+        fprintf(stderr, "Textures need at least one texel\n");
+        return UINT32_MAX;
+    }
+
+    if(scene->texture_count == scene->texture_capacity) {
+        uint32_t capacity = scene->texture_capacity ? scene->texture_capacity * 2 : 4;
+        scene_texture *textures = realloc(scene->textures, sizeof(scene_texture) * capacity);
+        if(!textures) {
+            return UINT32_MAX;
+        }
+
+        scene->textures = textures;
+        scene->texture_capacity = capacity;
+    }
+
+    size_t size = (size_t)width * height * 4;
+    uint8_t *copy = malloc(size);
+    if(!copy) {
+        return UINT32_MAX;
+    }
+
+    memcpy(copy, pixels, size);
+    scene->textures[scene->texture_count] = (scene_texture){ .width = width, .height = height, .pixels = copy };
+    return scene->texture_count++;
+}
+
+bool scene_set_albedo_texture(scene *scene, uint32_t material, uint32_t texture) {
+    if(material >= scene->material_count || (texture != SCENE_NO_TEXTURE && texture >= scene->texture_count)) {
+        fprintf(stderr, "Cannot give material %u texture %u, the scene has %u materials and %u textures\n",
+            material, texture, scene->material_count, scene->texture_count);
+        return false;
+    }
+
+    scene->materials[material].albedo_texture = texture;
+    return true;
+}
+
+static scene_primitive *push_primitive(scene *scene, primitive_type type, uint32_t material) {
+    if(material >= scene->material_count) {
+        fprintf(stderr, "Primitive uses material %u, but the scene only has %u\n", material, scene->material_count);
+        return NULL;
+    }
+
+    if(scene->primitive_count == scene->primitive_capacity) {
+        uint32_t capacity = scene->primitive_capacity ? scene->primitive_capacity * 2 : 16;
+        scene_primitive *primitives = realloc(scene->primitives, sizeof(scene_primitive) * capacity);
+        if(!primitives) {
+            return NULL;
+        }
+
+        scene->primitives = primitives;
+        scene->primitive_capacity = capacity;
+    }
+
+    scene_primitive *primitive = &scene->primitives[scene->primitive_count++];
+    *primitive = (scene_primitive){ .type = type, .material = material };
+    return primitive;
+}
+
+bool scene_add_sphere(scene *scene, const float center[3], float radius, uint32_t material) {
+    if(!(radius > 0.0f)) {
+        fprintf(stderr, "Sphere radius must be positive, got %f\n", radius);
+        return false;
+    }
+
+    scene_primitive *primitive = push_primitive(scene, PRIMITIVE_SPHERE, material);
+    if(!primitive) {
+        return false;
+    }
+
+    memcpy(primitive->a, center, sizeof(float) * 3);
+    primitive->a[3] = radius;
+    return true;
+}
+
+bool scene_add_plane(scene *scene, const float normal[3], float distance, uint32_t material) {
+    float unit_normal[3];
+    if(!normalize3(normal, unit_normal)) {
+        fprintf(stderr, "Plane normal must not be zero\n");
+        return false;
+    }
+
+    scene_primitive *primitive = push_primitive(scene, PRIMITIVE_PLANE, material);
+    if(!primitive) {
+        return false;
+    }
+
+    memcpy(primitive->a, unit_normal, sizeof(unit_normal));
+    primitive->a[3] = distance;
+    return true;
+}
+
+bool scene_add_disc(scene *scene, const float center[3], const float normal[3], float radius, uint32_t material) {
+    float unit_normal[3];
+    if(!normalize3(normal, unit_normal) || !(radius > 0.0f)) {
+        fprintf(stderr, "Discs need a nonzero normal and a positive radius\n");
+        return false;
+    }
+
+    scene_primitive *primitive = push_primitive(scene, PRIMITIVE_DISC, material);
+    if(!primitive) {
+        return false;
+    }
+
+    memcpy(primitive->a, center, sizeof(float) * 3);
+    primitive->a[3] = radius;
+    memcpy(primitive->b, unit_normal, sizeof(unit_normal));
+    return true;
+}
+
+bool scene_add_box(scene *scene, const float min[3], const float max[3], uint32_t material) {
+    if(!(min[0] < max[0] && min[1] < max[1] && min[2] < max[2])) {
+        fprintf(stderr, "Box minimum must lie below its maximum on every axis\n");
+        return false;
+    }
+
+    scene_primitive *primitive = push_primitive(scene, PRIMITIVE_BOX, material);
+    if(!primitive) {
+        return false;
+    }
+
+    memcpy(primitive->a, min, sizeof(float) * 3);
+    memcpy(primitive->b, max, sizeof(float) * 3);
+    return true;
+}
+
+bool scene_add_quad(scene *scene, const float corner[3], const float edge_u[3], const float edge_v[3], uint32_t material) {
+    float normal[3] = {
+        edge_u[1] * edge_v[2] - edge_u[2] * edge_v[1],
+        edge_u[2] * edge_v[0] - edge_u[0] * edge_v[2],
+        edge_u[0] * edge_v[1] - edge_u[1] * edge_v[0],
+    };
+
+    if(!(length3(normal) > 1e-6f)) {
+        fprintf(stderr, "Quad edges must not be parallel\n");
+        return false;
+    }
+
+    scene_primitive *primitive = push_primitive(scene, PRIMITIVE_QUAD, material);
+    if(!primitive) {
+        return false;
+    }
+
+    memcpy(primitive->a, corner, sizeof(float) * 3);
+    memcpy(primitive->b, edge_u, sizeof(float) * 3);
+    memcpy(primitive->c, edge_v, sizeof(float) * 3);
+    return true;
+}
+
+uint32_t scene_end_object(scene *scene) {
+    uint32_t first = 0;
+    if(scene->object_count > 0) {
+        const scene_object *previous = &scene->objects[scene->object_count - 1];
+        first = previous->first_primitive + previous->primitive_count;
+    }
+
+    if(first == scene->primitive_count) {
+        fprintf(stderr, "Objects need at least one primitive\n");
+        return UINT32_MAX;
+    }
+
+    if(scene->object_count == scene->object_capacity) {
+        uint32_t capacity = scene->object_capacity ? scene->object_capacity * 2 : 8;
+        scene_object *objects = realloc(scene->objects, sizeof(scene_object) * capacity);
+        if(!objects) {
+            return UINT32_MAX;
+        }
+
+        scene->objects = objects;
+        scene->object_capacity = capacity;
+    }
+
+    scene->objects[scene->object_count] = (scene_object){ .first_primitive = first, .primitive_count = scene->primitive_count - first };
+    return scene->object_count++;
+}
+
+// Inverse of a row-major 3x4 affine matrix. Fails when the linear part is singular.
+static bool invert_affine(const float m[12], float out[12]) {
+    float c00 = m[5] * m[10] - m[6] * m[9];
+    float c01 = m[6] * m[8] - m[4] * m[10];
+    float c02 = m[4] * m[9] - m[5] * m[8];
+    float determinant = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    if(!(fabsf(determinant) > 1e-12f)) {
+        return false;
+    }
+
+    float inverse = 1.0f / determinant;
+    float linear[9] = {
+        c00 * inverse, (m[2] * m[9] - m[1] * m[10]) * inverse, (m[1] * m[6] - m[2] * m[5]) * inverse,
+        c01 * inverse, (m[0] * m[10] - m[2] * m[8]) * inverse, (m[2] * m[4] - m[0] * m[6]) * inverse,
+        c02 * inverse, (m[1] * m[8] - m[0] * m[9]) * inverse, (m[0] * m[5] - m[1] * m[4]) * inverse,
+    };
+
+    for(int row = 0; row < 3; row++) {
+        const float *l = &linear[row * 3];
+        out[row * 4 + 0] = l[0];
+        out[row * 4 + 1] = l[1];
+        out[row * 4 + 2] = l[2];
+        out[row * 4 + 3] = -(l[0] * m[3] + l[1] * m[7] + l[2] * m[11]);
+    }
+
+    return true;
+}
+
+bool scene_add_instance(scene *scene, uint32_t object, const float transform[12]) {
+    float inverse[12];
+    if(object >= scene->object_count || !invert_affine(transform, inverse)) {
+        fprintf(stderr, "Instances need an existing object and an invertible transform\n");
+        return false;
+    }
+
+    if(scene->instance_count == scene->instance_capacity) {
+        uint32_t capacity = scene->instance_capacity ? scene->instance_capacity * 2 : 16;
+        scene_instance *instances = realloc(scene->instances, sizeof(scene_instance) * capacity);
+        if(!instances) {
+            return false;
+        }
+
+        scene->instances = instances;
+        scene->instance_capacity = capacity;
+    }
+
+    scene_instance *instance = &scene->instances[scene->instance_count++];
+    instance->object = object;
+    memcpy(instance->transform, transform, sizeof(instance->transform));
+    return true;
+}
+
+void scene_transform(float out[12], const float translation[3], float rotation_y, float scale) {
+    float angle = rotation_y * 3.14159265358979f / 180.0f;
+    float c = cosf(angle) * scale;
+    float s = sinf(angle) * scale;
+    const float transform[12] = {
+        c, 0.0f, s, translation[0],
+        0.0f, scale, 0.0f, translation[1],
+        -s, 0.0f, c, translation[2],
+    };
+
+    memcpy(out, transform, sizeof(transform));
+}
+
+// Planes are bounded to a large square, so they fit into a BVH like everything else.
+#define PLANE_EXTENT 1e5f
+// Keeps flat primitives from having boxes of zero thickness.
+#define BOUNDS_PADDING 1e-4f
+
+static void get_primitive_bounds(const scene_primitive *primitive, bvh_bounds *out) {
+    const float *a = primitive->a;
+    const float *b = primitive->b;
+    const float *c = primitive->c;
+
+    switch(primitive->type) {
+    case PRIMITIVE_SPHERE:
+        for(int i = 0; i < 3; i++) {
+            out->min[i] = a[i] - a[3];
+            out->max[i] = a[i] + a[3];
+        }
+        break;
+    case PRIMITIVE_PLANE:
+        for(int i = 0; i < 3; i++) {
+            bool aligned = fabsf(a[i]) == 1.0f;
+            out->min[i] = aligned ? a[3] * a[i] : -PLANE_EXTENT;
+            out->max[i] = aligned ? a[3] * a[i] : PLANE_EXTENT;
+        }
+        break;
+    case PRIMITIVE_DISC:
+        // A disc reaches radius * sqrt(1 - n_i^2) along each axis.
+        for(int i = 0; i < 3; i++) {
+            float extent = a[3] * sqrtf(fmaxf(0.0f, 1.0f - b[i] * b[i]));
+            out->min[i] = a[i] - extent;
+            out->max[i] = a[i] + extent;
+        }
+        break;
+    case PRIMITIVE_BOX:
+        for(int i = 0; i < 3; i++) {
+            out->min[i] = a[i];
+            out->max[i] = b[i];
+        }
+        break;
+    case PRIMITIVE_QUAD:
+        bvh_bounds_empty(out);
+        for(int corner = 0; corner < 4; corner++) {
+            float point[3];
+            for(int i = 0; i < 3; i++) {
+                point[i] = a[i] + ((corner & 1) ? b[i] : 0.0f) + ((corner & 2) ? c[i] : 0.0f);
+            }
+
+            bvh_bounds_grow_point(out, point);
+        }
+        break;
+    }
+
+    for(int i = 0; i < 3; i++) {
+        out->min[i] -= BOUNDS_PADDING;
+        out->max[i] += BOUNDS_PADDING;
+    }
+}
+
+// World bounds of the eight transformed corners of the object bounds.
+static void get_instance_bounds(const float transform[12], const bvh_bounds *object_bounds, bvh_bounds *out) {
+    bvh_bounds_empty(out);
+    for(int corner = 0; corner < 8; corner++) {
+        float local[3] = {
+            (corner & 1) ? object_bounds->max[0] : object_bounds->min[0],
+            (corner & 2) ? object_bounds->max[1] : object_bounds->min[1],
+            (corner & 4) ? object_bounds->max[2] : object_bounds->min[2],
+        };
+
+        float world[3];
+        for(int row = 0; row < 3; row++) {
+            const float *m = &transform[row * 4];
+            world[row] = m[0] * local[0] + m[1] * local[1] + m[2] * local[2] + m[3];
+        }
+
+        bvh_bounds_grow_point(out, world);
+    }
+}
+
+// Refitting is cheap as long as the tree stays close to what a rebuild would give. Past this much extra cost it
+// pays to start over.
+#define REBUILD_COST_RATIO 1.5f
+// Objects with at least this many primitives are built one after another, each on every thread. Smaller ones are
+// built side by side, one thread each.
+#define LARGE_OBJECT_PRIMITIVES 65536
+
+// Lets the threads of scene_build_tables() and scene_update_tables() each take whole objects.
+typedef struct object_task_context {
+    const scene *scene;
+    scene_tables *tables;
+    bool refit;
+    // Only objects of LARGE_OBJECT_PRIMITIVES or more when set, only smaller ones otherwise.
+    bool large;
+    bool *rebuilt;
+    bool *failed;
+} object_task_context;
+
+// Copies the primitives of an object in BLAS order, and its nodes with absolute leaf ranges and child indices.
+// Nodes the tree does not use are zeroed, so the tables only depend on the current trees.
+static void write_object_tables(const scene *s, scene_tables *tables, uint32_t index) {
+    const scene_object *object = &s->objects[index];
+    const bvh *object_bvh = &tables->object_bvhs[index];
+    for(uint32_t i = 0; i < object->primitive_count; i++) {
+        tables->primitives[object->first_primitive + i] = s->primitives[object->first_primitive + object_bvh->order[i]];
+    }
+
+    bvh_node *nodes = &tables->blas_nodes[tables->blas_roots[index]];
+    for(uint32_t i = 0; i < object_bvh->node_count; i++) {
+        nodes[i] = object_bvh->nodes[i];
+        nodes[i].first += nodes[i].count > 0 ? object->first_primitive : tables->blas_roots[index];
+    }
+
+    memset(&nodes[object_bvh->node_count], 0, sizeof(bvh_node) * (2 * object->primitive_count - 1 - object_bvh->node_count));
+}
+
+static void update_object(void *context, uint32_t index) {
+    object_task_context *task = context;
+    const scene_object *object = &task->scene->objects[index];
+    scene_tables *tables = task->tables;
+    if((object->primitive_count >= LARGE_OBJECT_PRIMITIVES) != task->large) {
+        return;
+    }
+
+    bvh_bounds *bounds = &tables->primitive_bounds[object->first_primitive];
+    bvh_bounds *object_bounds = &tables->object_bounds[index];
+    bvh_bounds_empty(object_bounds);
+    for(uint32_t i = 0; i < object->primitive_count; i++) {
+        get_primitive_bounds(&task->scene->primitives[object->first_primitive + i], &bounds[i]);
+        bvh_bounds_grow(object_bounds, &bounds[i]);
+    }
+
+    // The GPU builds from the bounds and leaves the primitives where they are.
+    if(tables->builder == BLAS_BUILDER_GPU) {
+        task->rebuilt[index] = true;
+        memcpy(&tables->primitives[object->first_primitive], &task->scene->primitives[object->first_primitive], sizeof(scene_primitive) * object->primitive_count);
+        return;
+    }
+
+    bvh *object_bvh = &tables->object_bvhs[index];
+    bool rebuild = true;
+    if(task->refit) {
+        bvh_refit(object_bvh, bounds);
+        rebuild = bvh_sah_cost(object_bvh) > object_bvh->build_cost * REBUILD_COST_RATIO;
+    }
+
+    if(rebuild) {
+        bvh_split split = tables->builder == BLAS_BUILDER_MEDIAN ? BVH_SPLIT_MEDIAN : BVH_SPLIT_SAH;
+        bvh_free(object_bvh);
+        if(!bvh_build(bounds, object->primitive_count, split, task->large ? tables->thread_count : 1, object_bvh)) {
+            task->failed[index] = true;
+            return;
+        }
+    }
+
+    task->rebuilt[index] = rebuild;
+    write_object_tables(task->scene, tables, index);
+}
+
+// Builds or refits the BLAS of every object, spread over threads, then the TLAS over the instances.
+static bool update_tables(const scene *s, scene_tables *tables, bool refit) {
+    bvh_bounds *instance_bounds = malloc(sizeof(bvh_bounds) * s->instance_count);
+    bool *rebuilt = calloc(s->object_count, sizeof(bool));
+    bool *failed = calloc(s->object_count, sizeof(bool));
+
+    bool success = instance_bounds && rebuilt && failed;
+    if(success) {
+        object_task_context context = {
+            .scene = s,
+            .tables = tables,
+            .refit = refit,
+            .large = true,
+            .rebuilt = rebuilt,
+            .failed = failed,
+        };
+
+        for(uint32_t i = 0; i < s->object_count; i++) {
+            update_object(&context, i);
+        }
+
+        context.large = false;
+        parallel_for(s->object_count, tables->thread_count, update_object, &context);
+    }
+
+    tables->refit_count = 0;
+    tables->rebuild_count = 0;
+    for(uint32_t i = 0; success && i < s->object_count; i++) {
+        success = !failed[i];
+        tables->refit_count += rebuilt[i] ? 0 : 1;
+        tables->rebuild_count += rebuilt[i] ? 1 : 0;
+    }
+
+    for(uint32_t i = 0; success && i < s->instance_count; i++) {
+        const scene_instance *instance = &s->instances[i];
+        get_instance_bounds(instance->transform, &tables->object_bounds[instance->object], &instance_bounds[i]);
+    }
+
+    bool rebuild = true;
+    if(success && refit) {
+        bvh_refit(&tables->tlas, instance_bounds);
+        rebuild = bvh_sah_cost(&tables->tlas) > tables->tlas.build_cost * REBUILD_COST_RATIO;
+    }
+
+    if(success && rebuild) {
+        bvh_split split = tables->builder == BLAS_BUILDER_MEDIAN ? BVH_SPLIT_MEDIAN : BVH_SPLIT_SAH;
+        bvh_free(&tables->tlas);
+        success = bvh_build(instance_bounds, s->instance_count, split, tables->thread_count, &tables->tlas);
+    }
+
+    tables->refit_count += rebuild ? 0 : 1;
+    tables->rebuild_count += rebuild ? 1 : 0;
+
+    // The TLAS nodes are used as they are, their leaves index the instances in TLAS order.
+    for(uint32_t i = 0; success && i < s->instance_count; i++) {
+        const scene_instance *instance = &s->instances[tables->tlas.order[i]];
+        scene_gpu_instance *gpu_instance = &tables->instances[i];
+        *gpu_instance = (scene_gpu_instance){
+            .blas_root = tables->blas_roots[instance->object],
+            .instance_index = tables->tlas.order[i],
+        };
+
+        // Checked by scene_add_instance().
+        invert_affine(instance->transform, gpu_instance->object_from_world);
+    }
+
+    free(failed);
+    free(rebuilt);
+    free(instance_bounds);
+    return success;
+}
+
+bool scene_build_tables(const scene *s, blas_builder builder, uint32_t thread_count, scene_tables *out) {
+    *out = (scene_tables){0};
+
+    uint32_t covered = 0;
+    if(s->object_count > 0) {
+        covered = s->objects[s->object_count - 1].first_primitive + s->objects[s->object_count - 1].primitive_count;
+    }
+
+    if(covered != s->primitive_count || s->instance_count == 0) {
+        fprintf(stderr, "Every primitive has to belong to an object, and the scene needs at least one instance\n");
+        return false;
+    }
+
+    out->builder = builder;
+    out->thread_count = thread_count ? thread_count : parallel_thread_count();
+    out->primitive_count = s->primitive_count;
+    out->object_count = s->object_count;
+    out->instance_count = s->instance_count;
+    out->tlas_node_count = 2 * s->instance_count - 1;
+
+    out->objects = malloc(sizeof(scene_object) * s->object_count);
+    out->blas_roots = malloc(sizeof(uint32_t) * s->object_count);
+    if(out->objects && out->blas_roots) {
+        memcpy(out->objects, s->objects, sizeof(scene_object) * s->object_count);
+        for(uint32_t i = 0; i < s->object_count; i++) {
+            out->blas_roots[i] = out->blas_node_count;
+            out->blas_node_count += 2 * s->objects[i].primitive_count - 1;
+        }
+    }
+
+    out->primitives = malloc(sizeof(scene_primitive) * s->primitive_count);
+    out->blas_nodes = calloc(out->blas_node_count, sizeof(bvh_node));
+    out->instances = malloc(sizeof(scene_gpu_instance) * s->instance_count);
+    out->object_bvhs = calloc(s->object_count, sizeof(bvh));
+    out->primitive_bounds = malloc(sizeof(bvh_bounds) * s->primitive_count);
+    out->object_bounds = malloc(sizeof(bvh_bounds) * s->object_count);
+    if(!out->objects || !out->blas_roots || !out->primitives || !out->blas_nodes || !out->instances || !out->object_bvhs ||
+       !out->primitive_bounds || !out->object_bounds || !update_tables(s, out, false)) {
+        scene_tables_free(out);
+        return false;
+    }
+
+    return true;
+}
+
+bool scene_update_tables(const scene *s, scene_tables *tables) {
+    bool same_objects = s->primitive_count == tables->primitive_count && s->object_count == tables->object_count && s->instance_count == tables->instance_count;
+    for(uint32_t i = 0; same_objects && i < s->object_count; i++) {
+        same_objects = s->objects[i].first_primitive == tables->objects[i].first_primitive &&
+                       s->objects[i].primitive_count == tables->objects[i].primitive_count;
+    }
+
+    if(!same_objects) {
+        fprintf(stderr, "Scene updates have to keep the objects and the number of primitives and instances\n");
+        return false;
+    }
+
+    return update_tables(s, tables, true);
+}
+
+void scene_tables_free(scene_tables *tables) {
+    for(uint32_t i = 0; tables->object_bvhs && i < tables->object_count; i++) {
+        bvh_free(&tables->object_bvhs[i]);
+    }
+
+    bvh_free(&tables->tlas);
+    free(tables->object_bounds);
+    free(tables->primitive_bounds);
+    free(tables->object_bvhs);
+    free(tables->objects);
+    free(tables->instances);
+    free(tables->blas_nodes);
+    free(tables->primitives);
+    free(tables->blas_roots);
+    *tables = (scene_tables){0};
+}
+
+// Turns the primitives added since the previous object into an object with one untransformed instance.
+static bool place_object(scene *s) {
+    float identity[12];
+    scene_transform(identity, (const float[]){ 0.0f, 0.0f, 0.0f }, 0.0f, 1.0f);
+
+    uint32_t object = scene_end_object(s);
+    return object != UINT32_MAX && scene_add_instance(s, object, identity);
+}
+
+static bool create_spheres_scene(scene *s, float time) {
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t red = scene_add_material(s, (const float[]){ 1.0f, 0.1f, 0.1f }, black, 0.5f);
+    uint32_t grey = scene_add_material(s, (const float[]){ 0.8f, 0.8f, 0.8f }, black, 0.3f);
+    uint32_t green = scene_add_material(s, (const float[]){ 0.4f, 1.0f, 0.4f }, black, 1.0f);
+    uint32_t light = scene_add_material(s, black, (const float[]){ 3.0f, 1.6f, 1.2f }, 1.0f);
+
+    // The red sphere bobs while the grey one circles it, both where they always were at time zero.
+    float bob = 0.3f * sinf(time * 2.0f);
+    float orbit_cos = cosf(time * 0.8f);
+    float orbit_sin = sinf(time * 0.8f);
+
+    // The ground used to be a sphere of radius 100 centered at (0, -101, -4), its top sits at y = -1.
+    // Every primitive is an object of its own, so the hit IDs stay what they were.
+    return
+        scene_add_sphere(s, (const float[]){ 0.0f, bob, -4.0f }, 1.0f, red) && place_object(s) &&
+        scene_add_sphere(s, (const float[]){ -1.4f * orbit_cos - 0.3f * orbit_sin, -0.5f, -4.0f + 0.3f * orbit_cos - 1.4f * orbit_sin }, 0.5f, grey) && place_object(s) &&
+        scene_add_plane(s, (const float[]){ 0.0f, 1.0f, 0.0f }, -1.0f, green) && place_object(s) &&
+        scene_add_sphere(s, (const float[]){ 10.0f, 10.0f, 0.0f }, 7.0f, light) && place_object(s);
+}
+
+static bool create_shapes_scene(scene *s) {
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t white = scene_add_material(s, (const float[]){ 0.8f, 0.8f, 0.8f }, black, 1.0f);
+    uint32_t red = scene_add_material(s, (const float[]){ 0.9f, 0.2f, 0.1f }, black, 1.0f);
+    uint32_t mirror = scene_add_material(s, (const float[]){ 0.9f, 0.9f, 0.9f }, black, 0.05f);
+    uint32_t blue = scene_add_material(s, (const float[]){ 0.1f, 0.3f, 0.9f }, black, 0.6f);
+    uint32_t light = scene_add_material(s, black, (const float[]){ 6.0f, 5.5f, 5.0f }, 1.0f);
+
+    return
+        scene_add_plane(s, (const float[]){ 0.0f, 1.0f, 0.0f }, -1.0f, white) && place_object(s) &&
+        scene_add_box(s, (const float[]){ -2.4f, -1.0f, -5.0f }, (const float[]){ -1.2f, 0.2f, -3.8f }, red) && place_object(s) &&
+        scene_add_sphere(s, (const float[]){ 0.0f, 0.0f, -4.5f }, 1.0f, mirror) && place_object(s) &&
+        scene_add_disc(s, (const float[]){ 1.8f, -0.2f, -4.0f }, (const float[]){ -0.5f, 0.3f, 1.0f }, 0.8f, blue) && place_object(s) &&
+        scene_add_quad(s, (const float[]){ -1.5f, 3.0f, -5.5f }, (const float[]){ 3.0f, 0.0f, 0.0f }, (const float[]){ 0.0f, 0.0f, 3.0f }, light) && place_object(s);
+}
+
+// Squares of two colors, or thin lines of the first color on the second with lines set. squares to a side.
+static uint32_t add_pattern_texture(scene *s, uint32_t size, uint32_t squares, const uint8_t first[3], const uint8_t second[3], bool lines) {
+    uint8_t *pixels = malloc((size_t)size * size * 4);
+    if(!pixels) {
+        return UINT32_MAX;
+    }
+
+    uint32_t square_size = size / squares;
+    for(uint32_t y = 0; y < size; y++) {
+        for(uint32_t x = 0; x < size; x++) {
+            bool use_first = lines
+                ? x % square_size < square_size / 8 || y % square_size < square_size / 8
+                : (x / square_size + y / square_size) % 2 == 0;
+
+            uint8_t *texel = &pixels[((size_t)y * size + x) * 4];
+            memcpy(texel, use_first ? first : second, 3);
+            texel[3] = 255;
+        }
+    }
+
+    uint32_t texture = scene_add_texture(s, size, size, pixels);
+    free(pixels);
+    return texture;
+}
+
+static bool create_textures_scene(scene *s) {
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    const float white[3] = { 1.0f, 1.0f, 1.0f };
+    uint32_t ground = scene_add_material(s, white, black, 1.0f);
+    uint32_t globe = scene_add_material(s, white, black, 0.8f);
+    uint32_t crate = scene_add_material(s, (const float[]){ 1.0f, 0.7f, 0.5f }, black, 1.0f);
+    uint32_t panel = scene_add_material(s, white, black, 0.3f);
+    uint32_t light = scene_add_material(s, black, (const float[]){ 3.0f, 2.8f, 2.5f }, 1.0f);
+
+    uint32_t checker = add_pattern_texture(s, 512, 8, (const uint8_t[]){ 230, 230, 230 }, (const uint8_t[]){ 40, 40, 40 }, false);
+    uint32_t grid = add_pattern_texture(s, 256, 8, (const uint8_t[]){ 20, 20, 20 }, (const uint8_t[]){ 200, 120, 40 }, true);
+    uint32_t tiles = add_pattern_texture(s, 128, 4, (const uint8_t[]){ 180, 40, 30 }, (const uint8_t[]){ 240, 220, 190 }, false);
+
+    return
+        checker != UINT32_MAX && grid != UINT32_MAX && tiles != UINT32_MAX &&
+        scene_set_albedo_texture(s, ground, checker) && scene_set_albedo_texture(s, globe, grid) &&
+        scene_set_albedo_texture(s, crate, tiles) && scene_set_albedo_texture(s, panel, checker) &&
+        scene_add_plane(s, (const float[]){ 0.0f, 1.0f, 0.0f }, -1.0f, ground) && place_object(s) &&
+        scene_add_sphere(s, (const float[]){ 0.0f, 0.0f, -4.5f }, 1.0f, globe) && place_object(s) &&
+        scene_add_box(s, (const float[]){ -2.6f, -1.0f, -5.0f }, (const float[]){ -1.4f, 0.2f, -3.8f }, crate) && place_object(s) &&
+        scene_add_disc(s, (const float[]){ 1.8f, -0.2f, -4.0f }, (const float[]){ -0.5f, 0.3f, 1.0f }, 0.8f, crate) && place_object(s) &&
+        scene_add_quad(s, (const float[]){ -2.0f, -1.0f, -7.0f }, (const float[]){ 4.0f, 0.0f, 0.0f }, (const float[]){ 0.0f, 2.5f, 0.0f }, panel) && place_object(s) &&
+        scene_add_sphere(s, (const float[]){ 10.0f, 10.0f, 0.0f }, 7.0f, light) && place_object(s);
+}
+
+// Two small objects repeated on a grid of side x side, with varying rotation and scale. Over time every copy wanders
+// off on a circle of its own, so the grid slowly mixes and a refit TLAS degrades. The builtin scene uses INSTANCE_GRID.
+#define INSTANCE_GRID 64
+
+static bool create_instances_scene(scene *s, uint32_t side, float time) {
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t ground = scene_add_material(s, (const float[]){ 0.6f, 0.6f, 0.6f }, black, 1.0f);
+    uint32_t stone = scene_add_material(s, (const float[]){ 0.7f, 0.5f, 0.3f }, black, 0.9f);
+    uint32_t gold = scene_add_material(s, (const float[]){ 1.0f, 0.8f, 0.3f }, black, 0.2f);
+    uint32_t teal = scene_add_material(s, (const float[]){ 0.1f, 0.6f, 0.6f }, black, 0.7f);
+    uint32_t light = scene_add_material(s, black, (const float[]){ 3.0f, 1.6f, 1.2f }, 1.0f);
+
+    // A finite ground, a plane would stretch the TLAS root so far that its SAH cost stops telling trees apart. It grows
+    // with grids larger than the builtin one.
+    float ground_size = side * 0.6f + 20.0f > 60.0f ? side * 0.6f + 20.0f : 60.0f;
+    if(!scene_add_quad(s, (const float[]){ -0.5f * ground_size, -1.0f, 10.0f }, (const float[]){ ground_size, 0.0f, 0.0f }, (const float[]){ 0.0f, 0.0f, -ground_size }, ground) || !place_object(s) ||
+       !scene_add_sphere(s, (const float[]){ 10.0f, 10.0f, 0.0f }, 7.0f, light) || !place_object(s)) {
+        return false;
+    }
+
+    // A pillar with a ball on top, and a flat tile with a disc standing on it.
+    if(!scene_add_box(s, (const float[]){ -0.1f, 0.0f, -0.1f }, (const float[]){ 0.1f, 0.5f, 0.1f }, stone) ||
+       !scene_add_sphere(s, (const float[]){ 0.0f, 0.65f, 0.0f }, 0.15f, gold)) {
+        return false;
+    }
+
+    uint32_t pillar = scene_end_object(s);
+    if(!scene_add_box(s, (const float[]){ -0.2f, 0.0f, -0.2f }, (const float[]){ 0.2f, 0.05f, 0.2f }, stone) ||
+       !scene_add_disc(s, (const float[]){ 0.0f, 0.25f, 0.0f }, (const float[]){ 0.0f, 0.0f, 1.0f }, 0.2f, teal)) {
+        return false;
+    }
+
+    uint32_t tile = scene_end_object(s);
+    if(pillar == UINT32_MAX || tile == UINT32_MAX) {
+        return false;
+    }
+
+    for(uint32_t z = 0; z < side; z++) {
+        for(uint32_t x = 0; x < side; x++) {
+            // Cheap deterministic variation per grid cell.
+            uint32_t hash = (x * 73856093u) ^ (z * 19349663u);
+            hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+            float rotation = (float)(hash % 360) + time * 90.0f;
+            float scale = 0.6f + (float)((hash >> 9) % 64) / 128.0f;
+            float radius = 0.3f + (float)((hash >> 15) % 64) / 32.0f;
+            float angle = time * (0.5f + (float)((hash >> 21) % 64) / 64.0f) * ((hash >> 27) & 1 ? 1.0f : -1.0f);
+
+            float transform[12];
+            const float position[3] = {
+                ((float)x - side * 0.5f) * 0.6f + radius * (cosf(angle) - 1.0f),
+                -1.0f,
+                -2.5f - (float)z * 0.6f + radius * sinf(angle),
+            };
+            scene_transform(transform, position, rotation, scale);
+            if(!scene_add_instance(s, (x + z) % 2 ? tile : pillar, transform)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool scene_create_builtin(const char *name, float time, scene *out) {
+    *out = (scene){0};
+
+    bool created;
+    if(strcmp(name, "spheres") == 0) {
+        created = create_spheres_scene(out, time);
+    } else if(strcmp(name, "shapes") == 0) {
+        created = create_shapes_scene(out);
+    } else if(strcmp(name, "instances") == 0) {
+        created = create_instances_scene(out, INSTANCE_GRID, time);
+    } else if(strcmp(name, "textures") == 0) {
+        created = create_textures_scene(out);
+    } else {
+        fprintf(stderr, "Unknown scene: %s\n", name);
+        return false;
+    }
+
+    if(!created) {
+        scene_free(out);
+    }
+
+    return created;
+}
+
+bool scene_create_instance_grid(uint32_t side, float time, scene *out) {
+    *out = (scene){0};
+    bool created = create_instances_scene(out, side, time);
+    if(!created) {
+        scene_free(out);
+    }
+
+    return created;
+}
+
+void scene_free(scene *scene) {
+    for(uint32_t i = 0; i < scene->texture_count; i++) {
+        free(scene->textures[i].pixels);
+    }
+
+    free(scene->textures);
+    free(scene->instances);
+    free(scene->objects);
+    free(scene->primitives);
+    free(scene->materials);
+    *scene = (struct scene){0};
+}
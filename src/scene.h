@@ -0,0 +1,176 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include "bvh.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Matches PRIMITIVE_* in pathtracer.comp.
+typedef enum primitive_type {
+    PRIMITIVE_SPHERE = 0,
+    PRIMITIVE_PLANE = 1,
+    PRIMITIVE_DISC = 2,
+    PRIMITIVE_BOX = 3,
+    PRIMITIVE_QUAD = 4,
+} primitive_type;
+
+// Materials without an albedo texture.
+#define SCENE_NO_TEXTURE UINT32_MAX
+
+// std430 layout of struct material in pathtracer.comp. The albedo texture, if any, is multiplied with the albedo.
+typedef struct scene_material {
+    float albedo[3];
+    float roughness;
+    float emission[3];
+    uint32_t albedo_texture;
+} scene_material;
+
+// sRGB encoded RGBA8 texels, rows top to bottom. The renderer generates the mip chain.
+typedef struct scene_texture {
+    uint32_t width;
+    uint32_t height;
+    uint8_t *pixels;
+} scene_texture;
+
+// std430 layout of struct primitive in pathtracer.comp. The parameters depend on the type:
+//   sphere: a = center and radius
+//   plane:  a = unit normal and signed distance of the plane from the origin along it
+//   disc:   a = center and radius, b = unit normal
+//   box:    a = minimum corner, b = maximum corner
+//   quad:   a = corner, b and c = the edges leaving it, spanning a parallelogram
+// Coordinates are in the space of the object the primitive belongs to.
+typedef struct scene_primitive {
+    float a[4];
+    float b[4];
+    float c[4];
+    uint32_t type;
+    uint32_t material;
+    uint32_t padding[2];
+} scene_primitive;
+
+// A range of primitives that is instanced as a whole, with a BVH of its own.
+typedef struct scene_object {
+    uint32_t first_primitive;
+    uint32_t primitive_count;
+} scene_object;
+
+// A copy of an object. The transform maps object space to world space as a row-major 3x4 affine matrix.
+typedef struct scene_instance {
+    uint32_t object;
+    float transform[12];
+} scene_instance;
+
+// Memory scales with the unique primitives, an instance only adds a transform. The instance index is the hit ID.
+typedef struct scene {
+    scene_material *materials;
+    uint32_t material_count;
+    uint32_t material_capacity;
+    scene_texture *textures;
+    uint32_t texture_count;
+    uint32_t texture_capacity;
+    scene_primitive *primitives;
+    uint32_t primitive_count;
+    uint32_t primitive_capacity;
+    scene_object *objects;
+    uint32_t object_count;
+    uint32_t object_capacity;
+    scene_instance *instances;
+    uint32_t instance_count;
+    uint32_t instance_capacity;
+} scene;
+
+// std430 layout of struct instance in pathtracer.comp. Rays are moved into object space with the inverse of the
+// instance transform, which also carries the normals back to world space.
+typedef struct scene_gpu_instance {
+    float object_from_world[12];
+    uint32_t blas_root;
+    uint32_t instance_index;
+    uint32_t padding[2];
+} scene_gpu_instance;
+
+// How scene_build_tables() builds the BLAS of every object. The TLAS is built on the host with the median split for
+// BLAS_BUILDER_MEDIAN and the SAH split otherwise.
+typedef enum blas_builder {
+    BLAS_BUILDER_SAH = 0,
+    BLAS_BUILDER_MEDIAN = 1,
+    // Left to the renderer, which builds linear BVHs on the GPU. The tables keep the primitives in scene order and
+    // leave blas_nodes zeroed, the bounds are all there is to build from. The renderer switches to BLAS_BUILDER_SAH
+    // for good once a tree comes out deeper than BVH_MAX_DEPTH.
+    BLAS_BUILDER_GPU = 2,
+} blas_builder;
+
+// Everything the trace shader reads besides the materials. The primitives of each object are reordered to follow
+// its BLAS, the instances to follow the TLAS. BLAS nodes of all objects share one array, their leaf ranges and child
+// indices are absolute. Every BVH has room for the 2n - 1 nodes a tree over n items can need, so rebuilding one never
+// moves the others and the tables keep their size.
+typedef struct scene_tables {
+    scene_primitive *primitives;
+    uint32_t primitive_count;
+    bvh_node *blas_nodes;
+    uint32_t blas_node_count;
+    // The TLAS nodes are tlas.nodes, tlas_node_count of them including the unused ones.
+    bvh tlas;
+    uint32_t tlas_node_count;
+    scene_gpu_instance *instances;
+    uint32_t instance_count;
+
+    // Kept so scene_update_tables() can refit them. Empty with BLAS_BUILDER_GPU.
+    bvh *object_bvhs;
+    scene_object *objects;
+    uint32_t object_count;
+    uint32_t *blas_roots;
+    // Bounds of every primitive in scene order, and of every object.
+    bvh_bounds *primitive_bounds;
+    bvh_bounds *object_bounds;
+    blas_builder builder;
+    uint32_t thread_count;
+
+    // BVHs the last build or update refit, and those it built from scratch.
+    uint32_t refit_count;
+    uint32_t rebuild_count;
+} scene_tables;
+
+// Returns the index of the new material, or UINT32_MAX when out of memory.
+uint32_t scene_add_material(scene *scene, const float albedo[3], const float emission[3], float roughness);
+// Copies width * height RGBA8 texels. Returns the index of the new texture, or UINT32_MAX on failure.
+uint32_t scene_add_texture(scene *scene, uint32_t width, uint32_t height, const uint8_t *pixels);
+// Textures are mapped per primitive type: latitude and longitude on spheres, the two edges on quads, each face
+// on boxes, the disc's square on discs, and one repeat per unit on planes. SCENE_NO_TEXTURE removes the texture.
+bool scene_set_albedo_texture(scene *scene, uint32_t material, uint32_t texture);
+
+// Normals are normalized here. Planes and discs and quads are two-sided, boxes and spheres have outward normals.
+bool scene_add_sphere(scene *scene, const float center[3], float radius, uint32_t material);
+bool scene_add_plane(scene *scene, const float normal[3], float distance, uint32_t material);
+bool scene_add_disc(scene *scene, const float center[3], const float normal[3], float radius, uint32_t material);
+bool scene_add_box(scene *scene, const float min[3], const float max[3], uint32_t material);
+bool scene_add_quad(scene *scene, const float corner[3], const float edge_u[3], const float edge_v[3], uint32_t material);
+
+// Groups the primitives added since the previous object into a new one. Returns its index, UINT32_MAX on failure.
+uint32_t scene_end_object(scene *scene);
+// Fails for unknown objects and transforms that cannot be inverted.
+bool scene_add_instance(scene *scene, uint32_t object, const float transform[12]);
+// Scales uniformly, then rotates by rotation_y degrees about the y axis, then translates.
+void scene_transform(float out[12], const float translation[3], float rotation_y, float scale);
+
+// Builds a BLAS per object and the TLAS over the instances on up to thread_count threads, zero meaning one per core.
+// Every primitive has to belong to an object and there has to be at least one instance.
+bool scene_build_tables(const scene *scene, blas_builder builder, uint32_t thread_count, scene_tables *out);
+// For scenes whose primitives and instances moved since the tables were built. The objects, and the number of
+// primitives and instances, have to stay the same. Every BVH is refit, and only rebuilt once refitting has made its
+// SAH cost half again as high as right after its last build. With BLAS_BUILDER_GPU only the TLAS is, and every
+// BLAS counts as rebuilt.
+bool scene_update_tables(const scene *scene, scene_tables *tables);
+void scene_tables_free(scene_tables *tables);
+
+// "spheres" is the scene the trace shader used to hardcode, with a plane instead of the radius 100 ground sphere.
+// "shapes" shows every primitive type under a quad light, "instances" places thousands of copies of a few objects.
+// "textures" puts checkered and gridded textures on every primitive type, with a ground that recedes far enough
+// to need the smallest mip levels. The scenes are posed at time in seconds. Everything but "shapes" and "textures"
+// moves, while the objects and the number of primitives and instances stay the same, so scene_update_tables() can
+// follow.
+bool scene_create_builtin(const char *name, float time, scene *out);
+// The "instances" scene with side x side copies on its grid instead of 64 x 64, for seeing how tracing scales with
+// the number of instances.
+bool scene_create_instance_grid(uint32_t side, float time, scene *out);
+void scene_free(scene *scene);
+
+#endif // SCENE_H
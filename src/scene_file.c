@@ -0,0 +1,403 @@
+#include "scene_file.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint64_t SECTION_ELEMENT_SIZES[SCENE_FILE_SECTION_COUNT] = {
+    [SCENE_FILE_MATERIALS] = sizeof(scene_material),
+    [SCENE_FILE_PRIMITIVES] = sizeof(scene_primitive),
+    [SCENE_FILE_BLAS_NODES] = sizeof(bvh_node),
+    [SCENE_FILE_TLAS_NODES] = sizeof(bvh_node),
+    [SCENE_FILE_INSTANCES] = sizeof(scene_gpu_instance),
+    [SCENE_FILE_BLAS_ROOTS] = sizeof(uint32_t),
+    [SCENE_FILE_TEXTURES] = sizeof(scene_file_texture),
+    [SCENE_FILE_TEXELS] = 1,
+};
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+}
+
+static bool write_padding(FILE *file, uint64_t bytes) {
+    static const uint8_t zeros[SCENE_FILE_ALIGNMENT] = {0};
+    return fwrite(zeros, 1, (size_t)bytes, file) == bytes;
+}
+
+bool scene_file_write(const char *filename, const scene *s, const scene_tables *tables) {
+    if(tables->builder == BLAS_BUILDER_GPU) {
+        fprintf(stderr, "Scene files store BVHs built on the host, not with the GPU builder\n");
+        return false;
+    }
+
+    // The texel offsets are only known once the textures are laid out one after another.
+    scene_file_texture *textures = calloc(s->texture_count ? s->texture_count : 1, sizeof(scene_file_texture));
+    if(!textures) {
+        fprintf(stderr, "Failed to allocate the texture table of %s\n", filename);
+        return false;
+    }
+
+    uint64_t texel_size = 0;
+    for(uint32_t i = 0; i < s->texture_count; i++) {
+        textures[i] = (scene_file_texture){ .width = s->textures[i].width, .height = s->textures[i].height, .offset = texel_size };
+        texel_size += (uint64_t)s->textures[i].width * s->textures[i].height * 4;
+    }
+
+    // The texels are written texture by texture, their section has no single source.
+    const void *sections[SCENE_FILE_SECTION_COUNT] = {
+        [SCENE_FILE_MATERIALS] = s->materials,
+        [SCENE_FILE_PRIMITIVES] = tables->primitives,
+        [SCENE_FILE_BLAS_NODES] = tables->blas_nodes,
+        [SCENE_FILE_TLAS_NODES] = tables->tlas.nodes,
+        [SCENE_FILE_INSTANCES] = tables->instances,
+        [SCENE_FILE_BLAS_ROOTS] = tables->blas_roots,
+        [SCENE_FILE_TEXTURES] = textures,
+    };
+
+    scene_file_header header = {
+        .magic = SCENE_FILE_MAGIC,
+        .version = SCENE_FILE_VERSION,
+        .builder = tables->builder,
+        .content_hash = HASH_SEED,
+        .section_sizes = {
+            [SCENE_FILE_MATERIALS] = (uint64_t)s->material_count * sizeof(scene_material),
+            [SCENE_FILE_PRIMITIVES] = (uint64_t)tables->primitive_count * sizeof(scene_primitive),
+            [SCENE_FILE_BLAS_NODES] = (uint64_t)tables->blas_node_count * sizeof(bvh_node),
+            [SCENE_FILE_TLAS_NODES] = (uint64_t)tables->tlas_node_count * sizeof(bvh_node),
+            [SCENE_FILE_INSTANCES] = (uint64_t)tables->instance_count * sizeof(scene_gpu_instance),
+            [SCENE_FILE_BLAS_ROOTS] = (uint64_t)tables->object_count * sizeof(uint32_t),
+            [SCENE_FILE_TEXTURES] = (uint64_t)s->texture_count * sizeof(scene_file_texture),
+            [SCENE_FILE_TEXELS] = texel_size,
+        },
+    };
+
+    uint64_t offset = sizeof(header);
+    for(uint32_t i = 0; i < SCENE_FILE_SECTION_COUNT; i++) {
+        header.section_offsets[i] = align_offset(offset);
+        offset = header.section_offsets[i] + header.section_sizes[i];
+        if(sections[i]) {
+            header.content_hash = hash_bytes(sections[i], (size_t)header.section_sizes[i], header.content_hash);
+        }
+    }
+
+    for(uint32_t i = 0; i < s->texture_count; i++) {
+        header.content_hash = hash_bytes(s->textures[i].pixels, (size_t)textures[i].width * textures[i].height * 4, header.content_hash);
+    }
+
+    char temp_filename[4096];
+    if(snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename) >= (int)sizeof(temp_filename)) {
+        fprintf(stderr, "Scene file path is too long: %s\n", filename);
+        free(textures);
+        return false;
+    }
+
+    FILE *file = fopen(temp_filename, "wb");
+    if(!file) {
+        perror(temp_filename);
+        free(textures);
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    offset = sizeof(header);
+    for(uint32_t i = 0; i < SCENE_FILE_SECTION_COUNT && written; i++) {
+        written = write_padding(file, header.section_offsets[i] - offset);
+        if(i == SCENE_FILE_TEXELS) {
+            for(uint32_t j = 0; j < s->texture_count && written; j++) {
+                size_t texel_bytes = (size_t)textures[j].width * textures[j].height * 4;
+                written = fwrite(s->textures[j].pixels, 1, texel_bytes, file) == texel_bytes;
+            }
+        } else if(header.section_sizes[i] > 0) {
+            written = written && fwrite(sections[i], (size_t)header.section_sizes[i], 1, file) == 1;
+        }
+
+        offset = header.section_offsets[i] + header.section_sizes[i];
+    }
+
+    free(textures);
+    if(fclose(file) != 0) {
+        written = false;
+    }
+
+    if(!written) {
+        perror(temp_filename);
+        remove(temp_filename);
+        return false;
+    }
+
+    // rename() does not replace existing files on Windows.
+    if(rename(temp_filename, filename) != 0) {
+        remove(filename);
+        if(rename(temp_filename, filename) != 0) {
+            perror(filename);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#ifdef _WIN32
+
+// Read in one go instead, which still skips any parsing.
+static bool map_file(const char *filename, scene_file *file) {
+    file->mapping = read_file(filename, &file->mapping_size);
+    return file->mapping != NULL;
+}
+
+static void unmap_file(scene_file *file) {
+    free(file->mapping);
+}
+
+#else
+
+static bool map_file(const char *filename, scene_file *file) {
+    int descriptor = open(filename, O_RDONLY);
+    if(descriptor < 0) {
+        perror(filename);
+        return false;
+    }
+
+    struct stat status;
+    if(fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        fprintf(stderr, "%s: empty or unreadable scene file\n", filename);
+        close(descriptor);
+        return false;
+    }
+
+    // Private and read-only, the renderer copies the sections out and never writes back.
+    void *mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if(mapping == MAP_FAILED) {
+        perror(filename);
+        return false;
+    }
+
+    // Every page is about to be copied once, so start reading ahead right away.
+    posix_madvise(mapping, (size_t)status.st_size, POSIX_MADV_WILLNEED);
+    file->mapping = mapping;
+    file->mapping_size = (size_t)status.st_size;
+    return true;
+}
+
+static void unmap_file(scene_file *file) {
+    if(file->mapping) {
+        munmap(file->mapping, file->mapping_size);
+    }
+}
+
+#endif
+
+// Builders place children after their parent, so one pass in index order reaches every node after its parent. levels
+// holds one plus the depth of each node reached from a root and zero for the rest, which are the unused nodes of a
+// tree and never visited. Requiring children after their parent also rules out cycles.
+static bool validate_nodes(const char *filename, const char *name, const bvh_node *nodes, uint32_t node_count, uint32_t item_count, uint8_t *levels) {
+    for(uint32_t i = 0; i < node_count; i++) {
+        const bvh_node *node = &nodes[i];
+        if(levels[i] == 0) {
+            continue;
+        }
+
+        if(node->count > 0) {
+            if(node->first > item_count || node->count > item_count - node->first) {
+                fprintf(stderr, "%s: %s leaf %u holds items past the end\n", filename, name, i);
+                return false;
+            }
+            continue;
+        }
+
+        if(node->first <= i || node->first >= node_count - 1 || levels[i] >= BVH_MAX_DEPTH) {
+            fprintf(stderr, "%s: %s node %u has children out of order or deeper than %u levels\n", filename, name, i, BVH_MAX_DEPTH);
+            return false;
+        }
+
+        for(uint32_t child = node->first; child < node->first + 2; child++) {
+            levels[child] = levels[child] > levels[i] + 1 ? levels[child] : (uint8_t)(levels[i] + 1);
+        }
+    }
+
+    return true;
+}
+
+// Checks that every section lies within the file at an aligned offset and holds whole elements, that the textures
+// lie within the texels, and that every index the shaders follow stays within its table. The shaders trust the file,
+// so a bad index here would read out of bounds or loop on the device.
+static bool validate_layout(const char *filename, const scene_file *file) {
+    const scene_file_header *header = &file->header;
+    if(header->magic != SCENE_FILE_MAGIC || header->version != SCENE_FILE_VERSION || header->builder > BLAS_BUILDER_MEDIAN) {
+        fprintf(stderr, "%s: not a version %u scene file\n", filename, SCENE_FILE_VERSION);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < SCENE_FILE_SECTION_COUNT; i++) {
+        uint64_t offset = header->section_offsets[i];
+        uint64_t size = header->section_sizes[i];
+        if(offset % SCENE_FILE_ALIGNMENT != 0 || offset > file->mapping_size || size > file->mapping_size - offset ||
+           size % SECTION_ELEMENT_SIZES[i] != 0 || size / SECTION_ELEMENT_SIZES[i] > UINT32_MAX) {
+            fprintf(stderr, "%s: section %u is truncated or misaligned\n", filename, i);
+            return false;
+        }
+    }
+
+    if(header->section_sizes[SCENE_FILE_MATERIALS] == 0 || header->section_sizes[SCENE_FILE_PRIMITIVES] == 0 ||
+       header->section_sizes[SCENE_FILE_TLAS_NODES] == 0 || header->section_sizes[SCENE_FILE_INSTANCES] == 0) {
+        fprintf(stderr, "%s: the scene needs at least one material, primitive and instance\n", filename);
+        return false;
+    }
+
+    const scene_tables *tables = &file->tables;
+    for(uint32_t i = 0; i < tables->object_count; i++) {
+        if(tables->blas_roots[i] >= tables->blas_node_count) {
+            fprintf(stderr, "%s: the BLAS of object %u starts past the nodes\n", filename, i);
+            return false;
+        }
+    }
+
+    for(uint32_t i = 0; i < tables->instance_count; i++) {
+        if(tables->instances[i].blas_root >= tables->blas_node_count) {
+            fprintf(stderr, "%s: the BLAS of instance %u starts past the nodes\n", filename, i);
+            return false;
+        }
+    }
+
+    // Only the trees the shaders walk, from the TLAS root and the BLAS root of every instance.
+    uint32_t level_count = tables->blas_node_count > tables->tlas_node_count ? tables->blas_node_count : tables->tlas_node_count;
+    uint8_t *levels = calloc(level_count, 1);
+    if(!levels) {
+        fprintf(stderr, "Failed to allocate the node levels of %s\n", filename);
+        return false;
+    }
+
+    levels[0] = 1;
+    bool nodes_valid = validate_nodes(filename, "TLAS", tables->tlas.nodes, tables->tlas_node_count, tables->instance_count, levels);
+    if(nodes_valid) {
+        memset(levels, 0, level_count);
+        for(uint32_t i = 0; i < tables->instance_count; i++) {
+            levels[tables->instances[i].blas_root] = 1;
+        }
+
+        nodes_valid = validate_nodes(filename, "BLAS", tables->blas_nodes, tables->blas_node_count, tables->primitive_count, levels);
+    }
+
+    free(levels);
+    if(!nodes_valid) {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < tables->primitive_count; i++) {
+        if(tables->primitives[i].material >= file->scene.material_count) {
+            fprintf(stderr, "%s: primitive %u uses a material past the materials\n", filename, i);
+            return false;
+        }
+    }
+
+    for(uint32_t i = 0; i < file->scene.material_count; i++) {
+        uint32_t texture = file->scene.materials[i].albedo_texture;
+        if(texture != SCENE_NO_TEXTURE && texture >= file->scene.texture_count) {
+            fprintf(stderr, "%s: material %u uses a texture past the textures\n", filename, i);
+            return false;
+        }
+    }
+
+    const uint8_t *base = file->mapping;
+    const scene_file_texture *textures = (const scene_file_texture *)(base + header->section_offsets[SCENE_FILE_TEXTURES]);
+    uint64_t texel_size = header->section_sizes[SCENE_FILE_TEXELS];
+    for(uint32_t i = 0; i < file->scene.texture_count; i++) {
+        uint64_t bytes = (uint64_t)textures[i].width * textures[i].height * 4;
+        if(textures[i].width == 0 || textures[i].height == 0 || textures[i].offset > texel_size || bytes > texel_size - textures[i].offset) {
+            fprintf(stderr, "%s: texture %u lies outside the texels\n", filename, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool scene_file_open(const char *filename, scene_file *out) {
+    *out = (scene_file){0};
+    if(!map_file(filename, out)) {
+        return false;
+    }
+
+    if(out->mapping_size < sizeof(scene_file_header)) {
+        fprintf(stderr, "%s: truncated scene file header\n", filename);
+        scene_file_close(out);
+        return false;
+    }
+
+    memcpy(&out->header, out->mapping, sizeof(out->header));
+
+    // Pointed at the sections before validating, the counts are what validate_layout() checks.
+    uint8_t *base = out->mapping;
+    const scene_file_header *header = &out->header;
+    void *sections[SCENE_FILE_SECTION_COUNT];
+    uint32_t counts[SCENE_FILE_SECTION_COUNT];
+    for(uint32_t i = 0; i < SCENE_FILE_SECTION_COUNT; i++) {
+        bool inside = header->section_offsets[i] <= out->mapping_size;
+        sections[i] = inside ? base + header->section_offsets[i] : NULL;
+        counts[i] = inside ? (uint32_t)(header->section_sizes[i] / SECTION_ELEMENT_SIZES[i]) : 0;
+    }
+
+    out->tables = (scene_tables){
+        .primitives = sections[SCENE_FILE_PRIMITIVES],
+        .primitive_count = counts[SCENE_FILE_PRIMITIVES],
+        .blas_nodes = sections[SCENE_FILE_BLAS_NODES],
+        .blas_node_count = counts[SCENE_FILE_BLAS_NODES],
+        .tlas = { .nodes = sections[SCENE_FILE_TLAS_NODES], .node_count = counts[SCENE_FILE_TLAS_NODES] },
+        .tlas_node_count = counts[SCENE_FILE_TLAS_NODES],
+        .instances = sections[SCENE_FILE_INSTANCES],
+        .instance_count = counts[SCENE_FILE_INSTANCES],
+        .blas_roots = sections[SCENE_FILE_BLAS_ROOTS],
+        .object_count = counts[SCENE_FILE_BLAS_ROOTS],
+        .builder = (blas_builder)header->builder,
+    };
+
+    out->scene = (scene){
+        .materials = sections[SCENE_FILE_MATERIALS],
+        .material_count = counts[SCENE_FILE_MATERIALS],
+        .texture_count = counts[SCENE_FILE_TEXTURES],
+        .primitive_count = counts[SCENE_FILE_PRIMITIVES],
+        .object_count = counts[SCENE_FILE_BLAS_ROOTS],
+        .instance_count = counts[SCENE_FILE_INSTANCES],
+    };
+
+    if(!validate_layout(filename, out)) {
+        scene_file_close(out);
+        return false;
+    }
+
+    // The only allocation, a handful of structs pointing at the texels.
+    if(out->scene.texture_count > 0) {
+        out->scene.textures = malloc(sizeof(scene_texture) * out->scene.texture_count);
+        if(!out->scene.textures) {
+            fprintf(stderr, "Failed to allocate the textures of %s\n", filename);
+            scene_file_close(out);
+            return false;
+        }
+
+        const scene_file_texture *textures = sections[SCENE_FILE_TEXTURES];
+        uint8_t *texels = sections[SCENE_FILE_TEXELS];
+        for(uint32_t i = 0; i < out->scene.texture_count; i++) {
+            out->scene.textures[i] = (scene_texture){
+                .width = textures[i].width,
+                .height = textures[i].height,
+                .pixels = texels + textures[i].offset,
+            };
+        }
+    }
+
+    return true;
+}
+
+void scene_file_close(scene_file *file) {
+    free(file->scene.textures);
+    unmap_file(file);
+    *file = (scene_file){0};
+}
@@ -0,0 +1,76 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+#include "scene.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCENE_FILE_MAGIC 0x4e435350u // "PSCN"
+#define SCENE_FILE_VERSION 1u
+
+// Sections start at multiples of the usual page size, so each one could be mapped or imported on its own.
+#define SCENE_FILE_ALIGNMENT 4096u
+
+// The first five are the sections of the renderer's scene buffer, in its order and its std430 layout, so loading
+// is a copy per section. Counts follow from the section sizes.
+typedef enum scene_file_section {
+    // scene_material.
+    SCENE_FILE_MATERIALS = 0,
+    // scene_primitive, in the order of the BLAS leaves.
+    SCENE_FILE_PRIMITIVES = 1,
+    // bvh_node, the BLAS of every object with room for 2n - 1 nodes each, then the TLAS.
+    SCENE_FILE_BLAS_NODES = 2,
+    SCENE_FILE_TLAS_NODES = 3,
+    // scene_gpu_instance, in the order of the TLAS leaves.
+    SCENE_FILE_INSTANCES = 4,
+    // uint32_t index of the root node of every object's BLAS.
+    SCENE_FILE_BLAS_ROOTS = 5,
+    // scene_file_texture, and the RGBA8 texels they point into.
+    SCENE_FILE_TEXTURES = 6,
+    SCENE_FILE_TEXELS = 7,
+    SCENE_FILE_SECTION_COUNT,
+} scene_file_section;
+
+typedef struct scene_file_texture {
+    uint32_t width;
+    uint32_t height;
+    // Byte offset of the texels within SCENE_FILE_TEXELS.
+    uint64_t offset;
+} scene_file_texture;
+
+typedef struct scene_file_header {
+    uint32_t magic;
+    uint32_t version;
+    // The blas_builder the BVHs were built with, never BLAS_BUILDER_GPU.
+    uint32_t builder;
+    uint32_t reserved;
+    // Hash of every section in order, taken by the renderer as the scene hash instead of hashing the contents again.
+    uint64_t content_hash;
+    // Offsets are from the start of the file.
+    uint64_t section_offsets[SCENE_FILE_SECTION_COUNT];
+    uint64_t section_sizes[SCENE_FILE_SECTION_COUNT];
+} scene_file_header;
+
+// Every array points into a read-only mapping of the file, nothing is parsed or copied. Opening checks the layout and
+// every index the shaders follow, the bounds, transforms and material values are trusted like those of a checkpoint.
+typedef struct scene_file {
+    scene_file_header header;
+    // The materials and textures, with the counts of the primitives, objects and instances. The primitives, objects
+    // and instances themselves are not stored in scene order, so their arrays stay NULL.
+    scene scene;
+    // The primitives, BLAS nodes, TLAS nodes, instances and BLAS roots with their counts, everything else is empty.
+    // The TLAS is tlas.nodes and tlas.node_count.
+    scene_tables tables;
+
+    void *mapping;
+    size_t mapping_size;
+} scene_file;
+
+// tables have to be built from scene by scene_build_tables() with a host builder. Writes to a temporary file first
+// and renames it over the old one, like checkpoint_write().
+bool scene_file_write(const char *filename, const scene *scene, const scene_tables *tables);
+
+bool scene_file_open(const char *filename, scene_file *out);
+void scene_file_close(scene_file *file);
+
+#endif // SCENE_FILE_H
@@ -0,0 +1,358 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+bool server_start(server *server, const char *socket_path) {
+    (void)server;
+    (void)socket_path;
+    fprintf(stderr, "The render server needs Unix domain sockets, which are not supported on this platform\n");
+    return false;
+}
+
+server_job *server_wait_job(server *server) {
+    (void)server;
+    return NULL;
+}
+
+void server_reply_path(server_job *job, uint32_t samples_per_pixel, double render_time, const char *path) {
+    (void)samples_per_pixel;
+    (void)render_time;
+    (void)path;
+    free(job);
+}
+
+void server_reply_bytes(server_job *job, uint32_t samples_per_pixel, double render_time, const void *data, size_t len) {
+    (void)samples_per_pixel;
+    (void)render_time;
+    (void)data;
+    (void)len;
+    free(job);
+}
+
+void server_reply_error(server_job *job, const char *message) {
+    (void)message;
+    free(job);
+}
+
+void server_stop(server *server) {
+    (void)server;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_REQUEST_LENGTH 4096
+// The listener reads requests one client at a time, so a client that stops sending is dropped after this long.
+#define REQUEST_TIMEOUT_SECONDS 5
+
+static bool send_all(int client, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while(len > 0) {
+        ssize_t sent = send(client, bytes, len, 0);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        bytes += sent;
+        len -= (size_t)sent;
+    }
+
+    return true;
+}
+
+static void finish_job(server_job *job, const char *header, const void *data, size_t len) {
+    if(!send_all(job->client, header, strlen(header)) || (len > 0 && !send_all(job->client, data, len))) {
+        perror("Failed to send a reply to a server client");
+    }
+
+    close(job->client);
+    free(job);
+}
+
+// Reads up to the first newline. Anything the client sends after it is ignored.
+static bool read_request(int client, char *line, size_t capacity) {
+    const struct timeval timeout = { .tv_sec = REQUEST_TIMEOUT_SECONDS };
+    if(setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        perror("Failed to set a receive timeout on a server client");
+        return false;
+    }
+
+    size_t len = 0;
+    while(len + 1 < capacity) {
+        ssize_t received = recv(client, line + len, capacity - 1 - len, 0);
+        if(received < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // Also the timeout, which must not pass a partial line on as a request.
+        if(received < 0) {
+            return false;
+        }
+
+        if(received == 0) {
+            break;
+        }
+
+        len += (size_t)received;
+        char *newline = memchr(line, '\n', len);
+        if(newline) {
+            *newline = '\0';
+            return true;
+        }
+    }
+
+    line[len] = '\0';
+    return len > 0 && len + 1 < capacity;
+}
+
+static bool copy_value(char *destination, size_t capacity, const char *value) {
+    if(strlen(value) >= capacity) {
+        return false;
+    }
+
+    strcpy(destination, value);
+    return true;
+}
+
+static bool parse_job(char *line, server_job *job, const char **error) {
+    char *token = strtok(line, " \t\r");
+    if(!token || strcmp(token, "render") != 0) {
+        *error = "expected a render request";
+        return false;
+    }
+
+    while((token = strtok(NULL, " \t\r"))) {
+        char *value = strchr(token, '=');
+        if(!value) {
+            *error = "expected key=value pairs";
+            return false;
+        }
+
+        *value++ = '\0';
+
+        bool valid = true;
+        if(strcmp(token, "spp") == 0) {
+            job->samples_per_pixel = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else if(strcmp(token, "samples-per-pass") == 0) {
+            job->samples_per_pass = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else if(strcmp(token, "exposure") == 0) {
+            job->has_exposure = true;
+            job->exposure = strtof(value, NULL);
+        }
+        else if(strcmp(token, "tonemap") == 0) {
+            valid = copy_value(job->tonemap, sizeof(job->tonemap), value);
+        }
+        else if(strcmp(token, "denoise") == 0) {
+            job->denoise = strcmp(value, "0") != 0;
+        }
+        else if(strcmp(token, "denoise-iterations") == 0) {
+            job->denoise_iterations = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else if(strcmp(token, "time-budget") == 0) {
+            job->time_budget = strtod(value, NULL);
+        }
+        else if(strcmp(token, "scene") == 0) {
+            valid = copy_value(job->scene, sizeof(job->scene), value);
+        }
+        else if(strcmp(token, "camera") == 0) {
+            valid = copy_value(job->camera, sizeof(job->camera), value);
+        }
+        else if(strcmp(token, "output") == 0) {
+            valid = copy_value(job->output, sizeof(job->output), value);
+        }
+        else {
+            *error = "unknown key";
+            return false;
+        }
+
+        if(!valid) {
+            *error = "value too long";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void enqueue(server *server, server_job *job) {
+    mtx_lock(&server->mutex);
+    if(server->tail) {
+        server->tail->next = job;
+    } else {
+        server->head = job;
+    }
+    server->tail = job;
+    cnd_signal(&server->condition);
+    mtx_unlock(&server->mutex);
+}
+
+// Accepts connections and queues their requests, so clients never wait on the GPU just to be heard.
+static int listener_thread(void *arg) {
+    server *server = arg;
+
+    for(;;) {
+        int client = accept(server->listen_socket, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            // server_stop() shuts the listening socket down to get here.
+            break;
+        }
+
+        char line[MAX_REQUEST_LENGTH];
+        if(!read_request(client, line, sizeof(line))) {
+            close(client);
+            continue;
+        }
+
+        if(strcmp(line, "shutdown") == 0 || strcmp(line, "shutdown\r") == 0) {
+            send_all(client, "ok\n", 3);
+            close(client);
+            break;
+        }
+
+        server_job *job = calloc(1, sizeof(server_job));
+        if(!job) {
+            close(client);
+            continue;
+        }
+
+        job->client = client;
+        job->denoise = -1;
+
+        const char *error = NULL;
+        if(!parse_job(line, job, &error)) {
+            server_reply_error(job, error);
+            continue;
+        }
+
+        enqueue(server, job);
+    }
+
+    mtx_lock(&server->mutex);
+    server->quit = true;
+    cnd_broadcast(&server->condition);
+    mtx_unlock(&server->mutex);
+    return 0;
+}
+
+bool server_start(server *server, const char *socket_path) {
+    memset(server, 0, sizeof(*server));
+    server->socket_path = socket_path;
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+        return false;
+    }
+
+    strcpy(address.sun_path, socket_path);
+
+    // A client that disconnects early must not take the server down with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    server->listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server->listen_socket < 0) {
+        perror("Failed to create server socket");
+        return false;
+    }
+
+    // A stale socket file from a previous run would make bind() fail.
+    unlink(socket_path);
+
+    if(bind(server->listen_socket, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server->listen_socket, 16) != 0) {
+        perror(socket_path);
+        close(server->listen_socket);
+        return false;
+    }
+
+    if(mtx_init(&server->mutex, mtx_plain) != thrd_success || cnd_init(&server->condition) != thrd_success) {
+        fprintf(stderr, "Failed to create server job queue\n");
+        close(server->listen_socket);
+        unlink(socket_path);
+        return false;
+    }
+
+    if(thrd_create(&server->listener, listener_thread, server) != thrd_success) {
+        fprintf(stderr, "Failed to create server listener thread\n");
+        cnd_destroy(&server->condition);
+        mtx_destroy(&server->mutex);
+        close(server->listen_socket);
+        unlink(socket_path);
+        return false;
+    }
+
+    return true;
+}
+
+server_job *server_wait_job(server *server) {
+    mtx_lock(&server->mutex);
+    while(!server->head && !server->quit) {
+        cnd_wait(&server->condition, &server->mutex);
+    }
+
+    server_job *job = server->head;
+    if(job) {
+        server->head = job->next;
+        if(!server->head) {
+            server->tail = NULL;
+        }
+        job->next = NULL;
+    }
+    mtx_unlock(&server->mutex);
+
+    return job;
+}
+
+void server_reply_path(server_job *job, uint32_t samples_per_pixel, double render_time, const char *path) {
+    char header[1200];
+    snprintf(header, sizeof(header), "ok %u %.3f %s\n", samples_per_pixel, render_time, path);
+    finish_job(job, header, NULL, 0);
+}
+
+void server_reply_bytes(server_job *job, uint32_t samples_per_pixel, double render_time, const void *data, size_t len) {
+    char header[128];
+    snprintf(header, sizeof(header), "ok %u %.3f %zu\n", samples_per_pixel, render_time, len);
+    finish_job(job, header, data, len);
+}
+
+void server_reply_error(server_job *job, const char *message) {
+    char header[512];
+    snprintf(header, sizeof(header), "error %s\n", message);
+    finish_job(job, header, NULL, 0);
+}
+
+void server_stop(server *server) {
+    // Wakes the listener out of accept().
+    shutdown(server->listen_socket, SHUT_RDWR);
+    thrd_join(server->listener, NULL);
+    close(server->listen_socket);
+    unlink(server->socket_path);
+
+    server_job *job;
+    while((job = server_wait_job(server))) {
+        server_reply_error(job, "server is shutting down");
+    }
+
+    cnd_destroy(&server->condition);
+    mtx_destroy(&server->mutex);
+}
+
+#endif
\ No newline at end of file
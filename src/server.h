@@ -0,0 +1,57 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+// One render request read from a client connection. Numeric fields left at zero mean "use the server's default".
+//
+// Requests are a single line of space separated key=value pairs after the word "render", e.g.
+//     render spp=256 denoise=1 output=/tmp/frame.png
+// Keys: spp, samples-per-pass, exposure, tonemap, denoise, denoise-iterations, time-budget, scene, camera, output.
+// Without an output path the PNG is sent back over the socket. The line "shutdown" stops the server.
+// Clients that go quiet for a few seconds before finishing their request are disconnected.
+typedef struct server_job {
+    int client;
+
+    uint32_t samples_per_pixel;
+    uint32_t samples_per_pass;
+    bool has_exposure;
+    float exposure;
+    char tonemap[16];
+    int denoise; // -1 when not given
+    uint32_t denoise_iterations;
+    double time_budget;
+    char scene[256];
+    char camera[256];
+    char output[1024];
+
+    struct server_job *next;
+} server_job;
+
+typedef struct server {
+    const char *socket_path;
+    int listen_socket;
+
+    thrd_t listener;
+    mtx_t mutex;
+    cnd_t condition;
+    server_job *head;
+    server_job *tail;
+    bool quit;
+} server;
+
+bool server_start(server *server, const char *socket_path);
+
+// Blocks until a job is queued. Returns NULL once a shutdown was requested and the queue is empty.
+server_job *server_wait_job(server *server);
+
+// Every job gets exactly one reply, after which it is closed and freed.
+void server_reply_path(server_job *job, uint32_t samples_per_pixel, double render_time, const char *path);
+void server_reply_bytes(server_job *job, uint32_t samples_per_pixel, double render_time, const void *data, size_t len);
+void server_reply_error(server_job *job, const char *message);
+
+void server_stop(server *server);
+
+#endif // SERVER_H
\ No newline at end of file
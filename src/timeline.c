@@ -0,0 +1,198 @@
+#include "timeline.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Track 0 is the GPU, 1 the thread that started the timeline, then one per parallel_for() worker slot. Any other
+// threads are numbered as they add events.
+#define GPU_TRACK 0u
+#define MAIN_TRACK 1u
+#define FIRST_WORKER_TRACK 2u
+#define WORKER_TRACK_COUNT 64u
+#define FIRST_THREAD_TRACK (FIRST_WORKER_TRACK + WORKER_TRACK_COUNT)
+
+typedef struct timeline_event {
+    const char *name;
+    double start;
+    double end;
+    uint32_t track;
+} timeline_event;
+
+atomic_bool timeline_recording;
+
+static timeline_event *events;
+static uint32_t event_capacity;
+static atomic_uint event_count;
+static atomic_uint next_track;
+// Bit per worker slot that added events, only those tracks are named.
+static _Atomic uint64_t used_workers;
+static const char *output_filename;
+static double start_time;
+
+// Zero until the thread adds its first event.
+static _Thread_local uint32_t thread_track;
+
+double timeline_time(void) {
+#ifdef _WIN32
+    return get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+bool timeline_clock_is_monotonic(void) {
+#ifdef _WIN32
+    return false;
+#else
+    return true;
+#endif
+}
+
+bool timeline_start(const char *filename, uint32_t max_events) {
+    events = malloc(sizeof(timeline_event) * max_events);
+    if(!events) {
+        fprintf(stderr, "Failed to allocate %u timeline events\n", max_events);
+        return false;
+    }
+
+    event_capacity = max_events;
+    atomic_store(&event_count, 0);
+    atomic_store(&next_track, FIRST_THREAD_TRACK);
+    atomic_store(&used_workers, 0);
+    thread_track = MAIN_TRACK;
+    output_filename = filename;
+    start_time = timeline_time();
+    atomic_store(&timeline_recording, true);
+    return true;
+}
+
+static void add_event(const char *name, double start, double end, uint32_t track) {
+    uint32_t index = atomic_fetch_add_explicit(&event_count, 1u, memory_order_relaxed);
+    if(index >= event_capacity) {
+        return;
+    }
+
+    events[index] = (timeline_event){
+        .name = name,
+        .start = start,
+        .end = end,
+        .track = track,
+    };
+}
+
+void timeline_add_host(const char *name, double start, double end) {
+    if(!timeline_enabled()) {
+        return;
+    }
+
+    if(thread_track == 0) {
+        thread_track = atomic_fetch_add_explicit(&next_track, 1u, memory_order_relaxed);
+    }
+
+    add_event(name, start, end, thread_track);
+}
+
+void timeline_set_worker(uint32_t slot) {
+    if(!timeline_enabled() || slot >= WORKER_TRACK_COUNT) {
+        return;
+    }
+
+    thread_track = FIRST_WORKER_TRACK + slot;
+    atomic_fetch_or_explicit(&used_workers, 1ull << slot, memory_order_relaxed);
+}
+
+void timeline_add_gpu(const char *name, double start, double end) {
+    if(!timeline_enabled()) {
+        return;
+    }
+
+    add_event(name, start, end, GPU_TRACK);
+}
+
+// Names are string literals of ours, but quotes and backslashes would still break the file.
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for(const char *c = text; *c; c++) {
+        if(*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+
+        fputc(*c, file);
+    }
+
+    fputc('"', file);
+}
+
+bool timeline_finish(void) {
+    if(!events) {
+        return false;
+    }
+
+    atomic_store(&timeline_recording, false);
+
+    uint32_t count = atomic_load(&event_count);
+    uint32_t recorded = count < event_capacity ? count : event_capacity;
+    uint32_t track_count = atomic_load(&next_track);
+    uint64_t workers = atomic_load(&used_workers);
+
+    FILE *file = fopen(output_filename, "w");
+    if(!file) {
+        perror(output_filename);
+        free(events);
+        events = NULL;
+        return false;
+    }
+
+    // Metadata events name the process and the tracks, then one complete event per zone or range in microseconds.
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"pathtracer\"}}");
+    for(uint32_t track = 0; track < track_count; track++) {
+        bool worker = track >= FIRST_WORKER_TRACK && track < FIRST_THREAD_TRACK;
+        if(worker && !(workers >> (track - FIRST_WORKER_TRACK) & 1)) {
+            continue;
+        }
+
+        char track_name[32];
+        if(track == GPU_TRACK) {
+            snprintf(track_name, sizeof(track_name), "GPU compute queue");
+        } else if(track == MAIN_TRACK) {
+            snprintf(track_name, sizeof(track_name), "main thread");
+        } else if(worker) {
+            snprintf(track_name, sizeof(track_name), "parallel_for worker %u", track - FIRST_WORKER_TRACK);
+        } else {
+            snprintf(track_name, sizeof(track_name), "thread %u", track - FIRST_THREAD_TRACK + 1);
+        }
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", track, track_name);
+        fprintf(file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}", track, track);
+    }
+
+    for(uint32_t i = 0; i < recorded; i++) {
+        const timeline_event *event = &events[i];
+        fprintf(file, ",\n{\"name\":");
+        write_json_string(file, event->name);
+        fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            event->track == GPU_TRACK ? "gpu" : "host", event->track,
+            (event->start - start_time) * 1e6, (event->end - event->start) * 1e6);
+    }
+
+    fprintf(file, "\n]}\n");
+
+    free(events);
+    events = NULL;
+
+    bool written = !ferror(file);
+    if(fclose(file) != 0 || !written) {
+        perror(output_filename);
+        return false;
+    }
+
+    if(count > recorded) {
+        fprintf(stderr, "The timeline dropped %u events past the first %u\n", count - recorded, event_capacity);
+    }
+
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Host zones and GPU ranges of a run on one timeline, written as Chrome trace-event JSON that Perfetto and
+// chrome://tracing open. Until timeline_start(), and after timeline_finish(), a zone costs a relaxed load and a branch.
+
+extern atomic_bool timeline_recording;
+
+static inline bool timeline_enabled(void) {
+    return atomic_load_explicit(&timeline_recording, memory_order_relaxed);
+}
+
+// Seconds on the clock every event is placed on. CLOCK_MONOTONIC where there is one, so device timestamps can be
+// calibrated against it, the wall clock of get_time() otherwise.
+double timeline_time(void);
+// Whether timeline_time() reads CLOCK_MONOTONIC.
+bool timeline_clock_is_monotonic(void);
+
+// Records up to max_events events, later ones are dropped and counted. The calling thread becomes the main thread.
+bool timeline_start(const char *filename, uint32_t max_events);
+// Stops recording and writes the events. Only call it once the other threads stopped adding events.
+bool timeline_finish(void);
+
+// Adds a complete event from start to end, in timeline_time() seconds. name must outlive the timeline, which string
+// literals do. Host events go on the track of the calling thread, GPU events on a track of their own.
+void timeline_add_host(const char *name, double start, double end);
+void timeline_add_gpu(const char *name, double start, double end);
+
+// Puts the events of the calling thread on the track of parallel_for() worker slot, shared by the threads every call
+// starts for that slot, so repeated calls do not each add rows to the trace.
+void timeline_set_worker(uint32_t slot);
+
+typedef struct timeline_zone {
+    const char *name;
+    double start;
+    bool active;
+} timeline_zone;
+
+static inline timeline_zone timeline_zone_begin(const char *name) {
+    bool active = timeline_enabled();
+    return (timeline_zone){ .name = name, .start = active ? timeline_time() : 0.0, .active = active };
+}
+
+static inline void timeline_zone_end(const timeline_zone *zone) {
+    if(zone->active) {
+        timeline_add_host(zone->name, zone->start, timeline_time());
+    }
+}
+
+// Times the statement or block that follows as one zone, as in TIMELINE_ZONE("create_device") { ... }. Leaving it
+// with return, break or goto skips the end, and the zone is missing from the trace.
+#define TIMELINE_ZONE(zone_name) \
+    for(timeline_zone timeline_zone_ = timeline_zone_begin(zone_name); timeline_zone_.name; timeline_zone_end(&timeline_zone_), timeline_zone_.name = NULL)
+
+#endif // TIMELINE_H
@@ -1,6 +1,8 @@
 #include "utils.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 uint8_t *read_file(const char *filename, size_t *len) {
     FILE *file = fopen(filename, "rb");
@@ -11,15 +13,512 @@ uint8_t *read_file(const char *filename, size_t *len) {
 
     fseek(file, 0, SEEK_END);
     size_t file_size = (size_t)ftell(file);
-    fseek(file, SEEK_SET, 0);
+    fseek(file, 0, SEEK_SET);
 
     uint8_t *buffer = malloc(sizeof(uint8_t) * file_size);
+    if(!buffer) {
+        fprintf(stderr, "%s: failed to allocate %zu bytes\n", filename, file_size);
+        fclose(file);
+        return NULL;
+    }
+
     size_t bytes_read = fread(buffer, sizeof(uint8_t), file_size, file);
+    fclose(file);
     if(bytes_read != file_size) {
         perror(filename);
+        free(buffer);
         return NULL;
     }
 
     *len = file_size;
     return buffer;
+}
+
+double get_time(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *bytes = data;
+    uint64_t hash = seed;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+bool write_pfm(const char *filename, uint32_t width, uint32_t height, uint32_t channels, const float *pixels) {
+    if(channels != 1 && channels != 3) {
+        fprintf(stderr, "PFM files only support 1 or 3 channels\n");
+        return false;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if(!file) {
+        perror(filename);
+        return false;
+    }
+
+    // A negative scale marks the data as little-endian, which is what every platform we run on uses.
+    fprintf(file, "%s\n%u %u\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+
+    // PFM stores the bottom row first.
+    bool written = true;
+    for(uint32_t y = height; y-- > 0 && written;) {
+        const float *row = pixels + (size_t)y * width * channels;
+        written = fwrite(row, sizeof(float) * channels, width, file) == width;
+    }
+
+    if(!written) {
+        perror(filename);
+    }
+
+    fclose(file);
+    return written;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+
+    return crc;
+}
+
+static void write_be32(FILE *file, uint32_t value) {
+    const uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static void write_chunk(FILE *file, const char *type, const uint8_t *data, size_t len) {
+    write_be32(file, (uint32_t)len);
+    fwrite(type, 1, 4, file);
+    fwrite(data, 1, len, file);
+
+    uint32_t crc = crc32_update(0xFFFFFFFFu, (const uint8_t *)type, 4);
+    crc = crc32_update(crc, data, len);
+    write_be32(file, crc ^ 0xFFFFFFFFu);
+}
+
+// Keyword and text are separated by a single null byte. Written piece by piece, so the text can have any length.
+static void write_text_chunk(FILE *file, const png_text *text) {
+    size_t keyword_len = strlen(text->keyword);
+    size_t text_len = strlen(text->text);
+    const uint8_t separator = 0;
+
+    write_be32(file, (uint32_t)(keyword_len + 1 + text_len));
+    fwrite("tEXt", 1, 4, file);
+    fwrite(text->keyword, 1, keyword_len, file);
+    fwrite(&separator, 1, 1, file);
+    fwrite(text->text, 1, text_len, file);
+
+    uint32_t crc = crc32_update(0xFFFFFFFFu, (const uint8_t *)"tEXt", 4);
+    crc = crc32_update(crc, (const uint8_t *)text->keyword, keyword_len);
+    crc = crc32_update(crc, &separator, 1);
+    crc = crc32_update(crc, (const uint8_t *)text->text, text_len);
+    write_be32(file, crc ^ 0xFFFFFFFFu);
+}
+
+bool png_write_with_text(const char *filename, const uint8_t *png, size_t png_len, const png_text *texts, size_t count) {
+    // The signature is followed by IHDR, which always has 13 bytes of data plus length, type and CRC.
+    const size_t ihdr_end = 8 + 4 + 4 + 13 + 4;
+    if(png_len < ihdr_end || memcmp(png + 12, "IHDR", 4) != 0) {
+        fprintf(stderr, "%s: not a PNG image\n", filename);
+        return false;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if(!file) {
+        perror(filename);
+        return false;
+    }
+
+    fwrite(png, 1, ihdr_end, file);
+
+    for(size_t i = 0; i < count; i++) {
+        write_text_chunk(file, &texts[i]);
+    }
+
+    fwrite(png + ihdr_end, 1, png_len - ihdr_end, file);
+
+    bool written = !ferror(file);
+    if(fclose(file) != 0 || !written) {
+        perror(filename);
+        return false;
+    }
+
+    return true;
+}
+
+static void store_be32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+// Deflate's length and distance codes, the first value each code stands for and the extra bits that follow it.
+static const uint16_t LENGTH_BASES[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t LENGTH_EXTRA_BITS[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t DISTANCE_BASES[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577,
+};
+static const uint8_t DISTANCE_EXTRA_BITS[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+#define MATCH_WINDOW 32768u
+#define MATCH_HASH_SIZE 32768u
+#define MIN_MATCH_LENGTH 3u
+#define MAX_MATCH_LENGTH 258u
+// How many earlier positions with the same hash are tried, more compresses better but slower.
+#define MAX_MATCH_CHAIN 32u
+
+typedef struct bit_writer {
+    uint8_t *out;
+    size_t len;
+    uint64_t bits;
+    uint32_t bit_count;
+} bit_writer;
+
+// Deflate fills each byte from its least significant bit up.
+static void put_bits(bit_writer *writer, uint32_t value, uint32_t count) {
+    writer->bits |= (uint64_t)value << writer->bit_count;
+    writer->bit_count += count;
+    while(writer->bit_count >= 8) {
+        writer->out[writer->len++] = (uint8_t)writer->bits;
+        writer->bits >>= 8;
+        writer->bit_count -= 8;
+    }
+}
+
+// Huffman codes are the exception and go most significant bit first.
+static void put_code(bit_writer *writer, uint32_t code, uint32_t length) {
+    uint32_t reversed = 0;
+    for(uint32_t i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1u);
+    }
+
+    put_bits(writer, reversed, length);
+}
+
+// The fixed literal/length code of deflate, which needs no code table in the stream.
+static void put_symbol(bit_writer *writer, uint32_t symbol) {
+    if(symbol < 144) {
+        put_code(writer, 0x30 + symbol, 8);
+    } else if(symbol < 256) {
+        put_code(writer, 0x190 + symbol - 144, 9);
+    } else if(symbol < 280) {
+        put_code(writer, symbol - 256, 7);
+    } else {
+        put_code(writer, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(bit_writer *writer, uint32_t length, uint32_t distance) {
+    uint32_t length_code = 0;
+    while(length_code + 1 < 29 && LENGTH_BASES[length_code + 1] <= length) {
+        length_code++;
+    }
+
+    put_symbol(writer, 257 + length_code);
+    put_bits(writer, length - LENGTH_BASES[length_code], LENGTH_EXTRA_BITS[length_code]);
+
+    uint32_t distance_code = 0;
+    while(distance_code + 1 < 30 && DISTANCE_BASES[distance_code + 1] <= distance) {
+        distance_code++;
+    }
+
+    put_code(writer, distance_code, 5);
+    put_bits(writer, distance - DISTANCE_BASES[distance_code], DISTANCE_EXTRA_BITS[distance_code]);
+}
+
+static uint32_t hash_match(const uint8_t *bytes) {
+    uint32_t value = (uint32_t)bytes[0] << 16 | (uint32_t)bytes[1] << 8 | bytes[2];
+    return (value * 2654435761u) >> 17;
+}
+
+// Compresses data into one fixed Huffman block that is not the last, followed by an empty stored block that byte
+// aligns the stream like zlib's Z_SYNC_FLUSH, so the next call can carry on in a new IDAT chunk. Matches only look
+// back within data. Returns the number of bytes written to out, which needs room for data_size * 9 / 8 + 16.
+static size_t deflate_rows(png_stream *stream, const uint8_t *data, size_t data_size, uint8_t *out) {
+    // Both tables hold positions plus one, zero ends a chain.
+    uint32_t *heads = stream->match_heads;
+    uint32_t *links = stream->match_links;
+    memset(heads, 0, sizeof(uint32_t) * MATCH_HASH_SIZE);
+
+    bit_writer writer = { .out = out };
+    // BFINAL = 0, BTYPE = 01 (fixed Huffman codes).
+    put_bits(&writer, 0, 1);
+    put_bits(&writer, 1, 2);
+
+    size_t position = 0;
+    while(position < data_size) {
+        uint32_t best_length = 0;
+        uint32_t best_distance = 0;
+        if(data_size - position >= MIN_MATCH_LENGTH) {
+            uint32_t hash = hash_match(data + position);
+            uint32_t max_length = data_size - position < MAX_MATCH_LENGTH ? (uint32_t)(data_size - position) : MAX_MATCH_LENGTH;
+
+            // A link older than the window may have been overwritten by a newer position, which ends the chain.
+            uint32_t candidate = heads[hash];
+            for(uint32_t chain = 0; candidate && position + 1 - candidate <= MATCH_WINDOW && chain < MAX_MATCH_CHAIN; chain++) {
+                const uint8_t *match = data + candidate - 1;
+                uint32_t length = 0;
+                while(length < max_length && match[length] == data[position + length]) {
+                    length++;
+                }
+
+                if(length > best_length) {
+                    best_length = length;
+                    best_distance = (uint32_t)(position + 1 - candidate);
+                    if(length == max_length) {
+                        break;
+                    }
+                }
+
+                uint32_t next = links[(candidate - 1) % MATCH_WINDOW];
+                candidate = next < candidate ? next : 0;
+            }
+        }
+
+        uint32_t advance = best_length >= MIN_MATCH_LENGTH ? best_length : 1;
+        if(best_length >= MIN_MATCH_LENGTH) {
+            put_match(&writer, best_length, best_distance);
+        } else {
+            put_symbol(&writer, data[position]);
+        }
+
+        // Every position the block moves past can start a later match.
+        for(size_t end = position + advance; position < end; position++) {
+            if(data_size - position >= MIN_MATCH_LENGTH) {
+                uint32_t hash = hash_match(data + position);
+                links[position % MATCH_WINDOW] = heads[hash];
+                heads[hash] = (uint32_t)(position + 1);
+            }
+        }
+    }
+
+    put_symbol(&writer, 256);
+
+    // BFINAL = 0, BTYPE = 00 (stored), then the padding to the next byte, LEN = 0 and its complement.
+    put_bits(&writer, 0, 3);
+    if(writer.bit_count > 0) {
+        put_bits(&writer, 0, 8 - writer.bit_count);
+    }
+
+    static const uint8_t empty_stored_block[4] = { 0x00, 0x00, 0xFF, 0xFF };
+    memcpy(writer.out + writer.len, empty_stored_block, sizeof(empty_stored_block));
+    return writer.len + sizeof(empty_stored_block);
+}
+
+static uint8_t paeth_predictor(uint8_t left, uint8_t up, uint8_t up_left) {
+    int estimate = left + up - up_left;
+    int left_distance = abs(estimate - left);
+    int up_distance = abs(estimate - up);
+    int up_left_distance = abs(estimate - up_left);
+    if(left_distance <= up_distance && left_distance <= up_left_distance) {
+        return left;
+    }
+
+    return up_distance <= up_left_distance ? up : up_left;
+}
+
+// Filters one row of RGB bytes with the given PNG filter type, using the previous row of the image.
+static void filter_row(uint8_t type, const uint8_t *row, const uint8_t *previous, size_t size, uint8_t *out) {
+    for(size_t i = 0; i < size; i++) {
+        uint8_t left = i >= 3 ? row[i - 3] : 0;
+        uint8_t up_left = i >= 3 ? previous[i - 3] : 0;
+        uint8_t prediction = 0;
+        switch(type) {
+        case 1: prediction = left; break;
+        case 2: prediction = previous[i]; break;
+        case 3: prediction = (uint8_t)((left + previous[i]) / 2); break;
+        case 4: prediction = paeth_predictor(left, previous[i], up_left); break;
+        default: break;
+        }
+
+        out[i] = (uint8_t)(row[i] - prediction);
+    }
+}
+
+bool png_stream_begin(png_stream *stream, const char *filename, uint32_t width, uint32_t height) {
+    *stream = (png_stream){
+        .filename = filename,
+        .width = width,
+        .height = height,
+        .adler_a = 1,
+        .adler_b = 0,
+    };
+
+    // The row before the first one is all zeros to the filters.
+    stream->rows = calloc(2 * (size_t)width * 3, 1);
+    stream->match_heads = malloc(sizeof(uint32_t) * MATCH_HASH_SIZE);
+    stream->match_links = malloc(sizeof(uint32_t) * MATCH_WINDOW);
+    if(!stream->rows || !stream->match_heads || !stream->match_links) {
+        fprintf(stderr, "%s: failed to allocate the compression state\n", filename);
+        free(stream->rows);
+        free(stream->match_heads);
+        free(stream->match_links);
+        return false;
+    }
+
+    stream->file = fopen(filename, "wb");
+    if(!stream->file) {
+        perror(filename);
+        free(stream->rows);
+        free(stream->match_heads);
+        free(stream->match_links);
+        return false;
+    }
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, sizeof(signature), stream->file);
+
+    // 8 bits per channel, truecolor, no interlacing.
+    uint8_t ihdr[13] = { 0 };
+    store_be32(ihdr, width);
+    store_be32(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    write_chunk(stream->file, "IHDR", ihdr, sizeof(ihdr));
+
+    // zlib header for deflate with a 32 KiB window and no preset dictionary.
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    write_chunk(stream->file, "IDAT", zlib_header, sizeof(zlib_header));
+
+    return !ferror(stream->file);
+}
+
+bool png_stream_write_rows(png_stream *stream, const uint8_t *pixels, uint32_t rows) {
+    if(rows > stream->height - stream->rows_written) {
+        fprintf(stderr, "%s: more rows than the image height\n", stream->filename);
+        return false;
+    }
+
+    // Every row starts with its filter type. The filtered rows come first, the compressed block goes behind them.
+    size_t row_size = 1 + (size_t)stream->width * 3;
+    size_t data_size = row_size * rows;
+    size_t chunk_size = data_size + data_size + data_size / 8 + 16;
+    if(data_size >= UINT32_MAX - MATCH_WINDOW) {
+        fprintf(stderr, "%s: too many rows at once\n", stream->filename);
+        return false;
+    }
+
+    if(chunk_size > stream->chunk_capacity) {
+        uint8_t *chunk = realloc(stream->chunk, chunk_size);
+        if(!chunk) {
+            fprintf(stderr, "%s: failed to allocate %zu bytes for the rows\n", stream->filename, chunk_size);
+            return false;
+        }
+
+        stream->chunk = chunk;
+        stream->chunk_capacity = chunk_size;
+    }
+
+    // Each row takes the filter whose output has the smallest sum of absolute values, as the PNG specification
+    // suggests. The previous row carries over from the last call.
+    uint8_t *filtered = stream->chunk;
+    size_t rgb_size = (size_t)stream->width * 3;
+    uint8_t *previous = stream->rows;
+    uint8_t *current = stream->rows + rgb_size;
+    for(uint32_t y = 0; y < rows; y++) {
+        const uint8_t *source = pixels + (size_t)stream->width * 4 * y;
+        for(uint32_t x = 0; x < stream->width; x++) {
+            current[x * 3 + 0] = source[x * 4 + 0];
+            current[x * 3 + 1] = source[x * 4 + 1];
+            current[x * 3 + 2] = source[x * 4 + 2];
+        }
+
+        uint8_t *row = filtered + row_size * y;
+        uint8_t best_type = 0;
+        uint64_t best_sum = UINT64_MAX;
+        for(uint8_t type = 0; type < 5; type++) {
+            filter_row(type, current, previous, rgb_size, row + 1);
+            uint64_t sum = 0;
+            for(size_t i = 0; i < rgb_size; i++) {
+                sum += (uint64_t)abs((int8_t)row[1 + i]);
+            }
+
+            if(sum < best_sum) {
+                best_sum = sum;
+                best_type = type;
+            }
+        }
+
+        row[0] = best_type;
+        filter_row(best_type, current, previous, rgb_size, row + 1);
+        memcpy(previous, current, rgb_size);
+    }
+
+    // Adler-32 sums only need reducing every 5552 bytes without overflowing 32 bits.
+    for(size_t offset = 0; offset < data_size;) {
+        size_t end = data_size - offset > 5552 ? offset + 5552 : data_size;
+        for(; offset < end; offset++) {
+            stream->adler_a += filtered[offset];
+            stream->adler_b += stream->adler_a;
+        }
+
+        stream->adler_a %= 65521;
+        stream->adler_b %= 65521;
+    }
+
+    uint8_t *compressed = stream->chunk + data_size;
+    size_t compressed_size = deflate_rows(stream, filtered, data_size, compressed);
+    write_chunk(stream->file, "IDAT", compressed, compressed_size);
+    stream->rows_written += rows;
+
+    if(ferror(stream->file)) {
+        perror(stream->filename);
+        return false;
+    }
+
+    return true;
+}
+
+bool png_stream_end(png_stream *stream, const png_text *texts, size_t count) {
+    bool complete = stream->rows_written == stream->height;
+    if(!complete) {
+        fprintf(stderr, "%s: only %u of %u rows were written\n", stream->filename, stream->rows_written, stream->height);
+    }
+
+    // An empty final stored block ends the deflate stream, the Adler-32 of the uncompressed data ends the zlib stream.
+    uint8_t trailer[9] = { 1, 0x00, 0x00, 0xFF, 0xFF };
+    store_be32(trailer + 5, (stream->adler_b << 16) | stream->adler_a);
+    write_chunk(stream->file, "IDAT", trailer, sizeof(trailer));
+
+    for(size_t i = 0; i < count; i++) {
+        write_text_chunk(stream->file, &texts[i]);
+    }
+
+    write_chunk(stream->file, "IEND", NULL, 0);
+
+    free(stream->chunk);
+    free(stream->rows);
+    free(stream->match_heads);
+    free(stream->match_links);
+    stream->chunk = NULL;
+    stream->rows = NULL;
+    stream->match_heads = NULL;
+    stream->match_links = NULL;
+
+    bool written = !ferror(stream->file);
+    if(fclose(stream->file) != 0 || !written) {
+        perror(stream->filename);
+        return false;
+    }
+
+    return complete;
 }
\ No newline at end of file
@@ -1,7 +1,57 @@
 #ifndef UTILS_H
 #define UTILS_H
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 uint8_t *read_file(const char *filename, size_t *len);
 
+// Wall clock time in seconds, only meaningful as a difference between two calls.
+double get_time(void);
+
+#define HASH_SEED 14695981039346656037ull
+
+// 64-bit FNV-1a. Pass HASH_SEED to start a new hash, or a previous result to extend it.
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+// Writes 1 (grayscale) or 3 (RGB) channel float pixels, rows ordered top to bottom, as a little-endian PFM file.
+bool write_pfm(const char *filename, uint32_t width, uint32_t height, uint32_t channels, const float *pixels);
+
+typedef struct png_text {
+    const char *keyword;
+    const char *text;
+} png_text;
+
+// Writes a PNG encoded in memory to a file, with tEXt chunks inserted right after its IHDR chunk.
+bool png_write_with_text(const char *filename, const uint8_t *png, size_t png_len, const png_text *texts, size_t count);
+
+// Writes an RGB PNG a few rows at a time, so the whole image never has to be in memory. The rows of each call are
+// filtered and compressed on their own, matches never reach back into an earlier call, which costs little once a
+// call holds more than the 32 KiB deflate window.
+typedef struct png_stream {
+    FILE *file;
+    const char *filename;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rows_written;
+    // Running Adler-32 of the zlib stream that spans every IDAT chunk.
+    uint32_t adler_a;
+    uint32_t adler_b;
+    // Holds the filtered rows and the chunk built from them by one call to png_stream_write_rows().
+    uint8_t *chunk;
+    size_t chunk_capacity;
+    // The last row written before filtering, followed by room for the next one.
+    uint8_t *rows;
+    // Hash chains of the match finder, positions with the same first three bytes.
+    uint32_t *match_heads;
+    uint32_t *match_links;
+} png_stream;
+
+bool png_stream_begin(png_stream *stream, const char *filename, uint32_t width, uint32_t height);
+// Appends rows of RGBA8 pixels, top to bottom. The alpha channel is dropped.
+bool png_stream_write_rows(png_stream *stream, const uint8_t *pixels, uint32_t rows);
+// Fails if fewer than height rows were written. The tEXt chunks go after the image data, so they can describe the finished render.
+bool png_stream_end(png_stream *stream, const png_text *texts, size_t count);
+
 #endif // UTILS_H
\ No newline at end of file